@@ -0,0 +1,69 @@
+/*
+ * Heap allocation counting
+ */
+
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <stdlib.h>
+
+namespace {
+
+std::atomic<uint64_t> allocations{ 0 };
+
+/* Trivial, so that touching it from malloc() never allocates */
+thread_local uint64_t threadAllocations = 0;
+
+void countAllocation()
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	threadAllocations++;
+}
+
+} /* namespace */
+
+#if defined(__GLIBC__)
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+	countAllocation();
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) __THROW
+{
+	countAllocation();
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+	countAllocation();
+	return __libc_realloc(ptr, size);
+}
+}
+
+bool countingAllocations()
+{
+	return true;
+}
+#else
+bool countingAllocations()
+{
+	return false;
+}
+#endif
+
+uint64_t allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+uint64_t threadAllocationCount()
+{
+	return threadAllocations;
+}
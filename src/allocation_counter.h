@@ -0,0 +1,19 @@
+/*
+ * Heap allocation counting
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * On glibc malloc(), calloc() and realloc() are interposed, and every heap
+ * allocation, operator new and g_malloc() included, is counted in total and
+ * for the calling thread. Comparing the count of a thread around some code
+ * tells whether that code allocates. Elsewhere countingAllocations() is
+ * false and the counts stay 0.
+ */
+bool countingAllocations();
+
+uint64_t allocationCount();
+uint64_t threadAllocationCount();
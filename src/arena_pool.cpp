@@ -0,0 +1,183 @@
+/*
+ * GstBufferPool whose memory comes from a FrameArena
+ */
+
+#include "arena_pool.h"
+
+#include <string.h>
+
+#include "frame_arena.h"
+
+namespace {
+
+struct ArenaMemory {
+	GstMemory memory;
+	uint8_t *data;
+	/* Bytes of the arena block, and the next free block */
+	size_t capacity;
+	ArenaMemory *next;
+};
+
+struct ArenaAllocator {
+	GstAllocator parent;
+	FrameArena *arena;
+	GMutex lock;
+	ArenaMemory *free;
+};
+
+struct ArenaAllocatorClass {
+	GstAllocatorClass parent_class;
+};
+
+G_DEFINE_TYPE(ArenaAllocator, arena_allocator, GST_TYPE_ALLOCATOR)
+
+/* Reuse the first free block large enough, the pool asks for one size */
+GstMemory *arenaAlloc(GstAllocator *allocator, gsize size, GstAllocationParams *params)
+{
+	ArenaAllocator *self = reinterpret_cast<ArenaAllocator *>(allocator);
+	const gsize maxsize = params->prefix + size + params->padding;
+	ArenaMemory *mem = nullptr;
+
+	/* Arena blocks are page aligned, which covers any sane request */
+	if (params->align >= FrameArena::Alignment)
+		return nullptr;
+
+	g_mutex_lock(&self->lock);
+	for (ArenaMemory **link = &self->free; *link; link = &(*link)->next) {
+		if ((*link)->capacity >= maxsize) {
+			mem = *link;
+			*link = mem->next;
+			break;
+		}
+	}
+	g_mutex_unlock(&self->lock);
+
+	if (!mem) {
+		uint8_t *data = self->arena->allocate(maxsize);
+		if (!data)
+			return nullptr;
+
+		mem = new ArenaMemory();
+		mem->data = data;
+		mem->capacity = maxsize;
+	}
+
+	gst_memory_init(GST_MEMORY_CAST(mem), params->flags, allocator, nullptr,
+			maxsize, params->align, params->prefix, size);
+
+	if (params->prefix && (params->flags & GST_MEMORY_FLAG_ZERO_PREFIXED))
+		memset(mem->data, 0, params->prefix);
+	if (params->padding && (params->flags & GST_MEMORY_FLAG_ZERO_PADDED))
+		memset(mem->data + params->prefix + size, 0, params->padding);
+
+	return GST_MEMORY_CAST(mem);
+}
+
+/* Shared memories only borrow the block of their parent */
+void arenaFree(GstAllocator *allocator, GstMemory *memory)
+{
+	ArenaAllocator *self = reinterpret_cast<ArenaAllocator *>(allocator);
+	ArenaMemory *mem = reinterpret_cast<ArenaMemory *>(memory);
+
+	if (memory->parent) {
+		delete mem;
+		return;
+	}
+
+	g_mutex_lock(&self->lock);
+	mem->next = self->free;
+	self->free = mem;
+	g_mutex_unlock(&self->lock);
+}
+
+gpointer arenaMap(GstMemory *memory, gsize maxsize, GstMapFlags flags)
+{
+	return reinterpret_cast<ArenaMemory *>(memory)->data;
+}
+
+void arenaUnmap(GstMemory *memory)
+{
+}
+
+GstMemory *arenaShare(GstMemory *memory, gssize offset, gssize size)
+{
+	GstMemory *parent = memory->parent ? memory->parent : memory;
+
+	if (size == -1)
+		size = memory->size - offset;
+
+	ArenaMemory *sub = new ArenaMemory();
+	sub->data = reinterpret_cast<ArenaMemory *>(memory)->data;
+	sub->capacity = 0;
+
+	gst_memory_init(GST_MEMORY_CAST(sub),
+			static_cast<GstMemoryFlags>(GST_MINI_OBJECT_FLAGS(parent) |
+						    GST_MINI_OBJECT_FLAG_LOCK_READONLY),
+			memory->allocator, parent, memory->maxsize, memory->align,
+			memory->offset + offset, size);
+
+	return GST_MEMORY_CAST(sub);
+}
+
+void arenaFinalize(GObject *object)
+{
+	ArenaAllocator *self = reinterpret_cast<ArenaAllocator *>(object);
+
+	while (ArenaMemory *mem = self->free) {
+		self->free = mem->next;
+		delete mem;
+	}
+	g_mutex_clear(&self->lock);
+
+	G_OBJECT_CLASS(arena_allocator_parent_class)->finalize(object);
+}
+
+void arena_allocator_class_init(ArenaAllocatorClass *klass)
+{
+	GstAllocatorClass *allocatorClass = GST_ALLOCATOR_CLASS(klass);
+
+	allocatorClass->alloc = arenaAlloc;
+	allocatorClass->free = arenaFree;
+	G_OBJECT_CLASS(klass)->finalize = arenaFinalize;
+}
+
+void arena_allocator_init(ArenaAllocator *self)
+{
+	GstAllocator *allocator = GST_ALLOCATOR_CAST(self);
+
+	allocator->mem_type = "ArenaMemory";
+	allocator->mem_map = arenaMap;
+	allocator->mem_unmap = arenaUnmap;
+	allocator->mem_share = arenaShare;
+	GST_OBJECT_FLAG_SET(allocator, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
+
+	self->arena = nullptr;
+	self->free = nullptr;
+	g_mutex_init(&self->lock);
+}
+
+} /* namespace */
+
+GstBufferPool *arenaBufferPoolNew(FrameArena *arena, size_t size,
+				  unsigned int minBuffers, unsigned int maxBuffers)
+{
+	ArenaAllocator *allocator =
+		static_cast<ArenaAllocator *>(g_object_new(arena_allocator_get_type(), nullptr));
+	gst_object_ref_sink(allocator);
+	allocator->arena = arena;
+
+	GstBufferPool *pool = gst_buffer_pool_new();
+	GstStructure *config = gst_buffer_pool_get_config(pool);
+	gst_buffer_pool_config_set_params(config, nullptr, size, minBuffers, maxBuffers);
+	gst_buffer_pool_config_set_allocator(config, GST_ALLOCATOR_CAST(allocator), nullptr);
+	gst_object_unref(allocator);
+
+	/* Activation allocates the minimum, which fails if the arena cannot */
+	if (!gst_buffer_pool_set_config(pool, config) ||
+	    !gst_buffer_pool_set_active(pool, TRUE)) {
+		gst_object_unref(pool);
+		return nullptr;
+	}
+
+	return pool;
+}
@@ -0,0 +1,24 @@
+/*
+ * GstBufferPool whose memory comes from a FrameArena
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <gst/gst.h>
+
+class FrameArena;
+
+/*
+ * Returns an active pool of \a size byte buffers, or nullptr on failure.
+ * \a minBuffers are allocated up front, and the pool grows up to
+ * \a maxBuffers (0 for no limit) when all of them are downstream.
+ *
+ * The pool's allocator carves its memory out of \a arena and keeps released
+ * memory on a free list, so that once the pool has grown to what the
+ * pipeline holds, acquiring and releasing a buffer allocates nothing. The
+ * arena must outlive the pool and every buffer taken from it.
+ */
+GstBufferPool *arenaBufferPoolNew(FrameArena *arena, size_t size,
+				  unsigned int minBuffers, unsigned int maxBuffers);
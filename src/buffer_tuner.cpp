@@ -0,0 +1,35 @@
+/*
+ * Sizing of the request pool from how long frames are held downstream
+ */
+
+#include "buffer_tuner.h"
+
+#include <algorithm>
+
+BufferTuner::BufferTuner(unsigned int allocated)
+	: allocated_(allocated), target_(allocated)
+{
+}
+
+unsigned int BufferTuner::update(uint64_t hold, uint64_t frameDuration, bool starved)
+{
+	if (!frameDuration)
+		return target_;
+
+	const uint64_t held = (hold + frameDuration - 1) / frameDuration;
+	unsigned int needed = std::min<uint64_t>(MinQueued + held, allocated_);
+	needed = std::max(needed, std::min(MinQueued + 1, allocated_));
+
+	if (starved)
+		needed = std::max(needed, std::min(target_ + 1, allocated_));
+
+	if (needed >= target_) {
+		target_ = needed;
+		shrink_ = 0;
+	} else if (++shrink_ >= ShrinkAfter) {
+		target_--;
+		shrink_ = 0;
+	}
+
+	return target_;
+}
@@ -0,0 +1,42 @@
+/*
+ * Sizing of the request pool from how long frames are held downstream
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The camera needs MinQueued requests queued at all times not to drop
+ * frames, and every request held downstream (by the pairer, the ring copy
+ * or, with zero-copy, until GStreamer releases its dmabufs) is missing from
+ * the camera for that long. The target pool is therefore MinQueued plus the
+ * frames captured over the 99th percentile hold time. Any request beyond
+ * that only lets frames queue up downstream, adding latency.
+ *
+ * The target grows as soon as the hold time or a starved camera asks for
+ * it, and shrinks one request at a time after ShrinkAfter updates in a row
+ * that needed fewer.
+ */
+class BufferTuner
+{
+public:
+	static constexpr unsigned int MinQueued = 2;
+	static constexpr unsigned int ShrinkAfter = 5;
+
+	BufferTuner(unsigned int allocated);
+
+	/*
+	 * \a hold and \a frameDuration in microseconds, \a starved when the
+	 * camera ran out of queued requests since the previous update.
+	 * Returns the new target.
+	 */
+	unsigned int update(uint64_t hold, uint64_t frameDuration, bool starved);
+
+	unsigned int target() const { return target_; }
+
+private:
+	unsigned int allocated_;
+	unsigned int target_;
+	unsigned int shrink_ = 0;
+};
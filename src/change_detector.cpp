@@ -0,0 +1,139 @@
+/*
+ * Detection of frames that differ from the last one streamed
+ */
+
+#include "change_detector.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/formats.h>
+
+#include "convert.h"
+#include "image.h"
+
+using namespace libcamera;
+
+namespace {
+
+struct LumaInfo {
+	PixelFormat format;
+	/* Luma byte of the first pixel and bytes between pixels, in plane 0 */
+	unsigned int offset;
+	unsigned int step;
+};
+
+const LumaInfo lumaInfo[] = {
+	{ formats::YUV420, 0, 1 },
+	{ formats::YVU420, 0, 1 },
+	{ formats::NV12, 0, 1 },
+	{ formats::NV21, 0, 1 },
+	{ formats::R8, 0, 1 },
+	{ formats::YUYV, 0, 2 },
+	{ formats::XRGB8888, 1, 4 },
+	{ formats::XBGR8888, 1, 4 },
+	{ formats::RGB888, 1, 3 },
+	{ formats::BGR888, 1, 3 },
+};
+
+/* Sum of absolute differences of a block, Block samples per row */
+unsigned int blockSad(const uint8_t *a, const uint8_t *b, unsigned int stride)
+{
+#if defined(__ARM_NEON)
+	if (convertKernel() == ConvertKernel::Neon) {
+		uint16x8_t sum = vdupq_n_u16(0);
+		for (unsigned int y = 0; y < ChangeDetector::Block; ++y)
+			sum = vabal_u8(sum, vld1_u8(a + y * stride), vld1_u8(b + y * stride));
+
+#if defined(__aarch64__)
+		return vaddvq_u16(sum);
+#else
+		uint64x2_t total = vpaddlq_u32(vpaddlq_u16(sum));
+		return vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#endif
+	}
+#endif
+
+	unsigned int sum = 0;
+	for (unsigned int y = 0; y < ChangeDetector::Block; ++y) {
+		for (unsigned int x = 0; x < ChangeDetector::Block; ++x) {
+			const int d = a[y * stride + x] - b[y * stride + x];
+			sum += d < 0 ? -d : d;
+		}
+	}
+
+	return sum;
+}
+
+} /* namespace */
+
+ChangeDetector::ChangeDetector(const FrameLayout &layout, unsigned int threshold)
+	: threshold_(threshold)
+{
+	const LumaInfo *info = nullptr;
+	for (const LumaInfo &entry : lumaInfo) {
+		if (entry.format == layout.format)
+			info = &entry;
+	}
+
+	if (!info || layout.planes.empty())
+		return;
+
+	offset_ = info->offset;
+	step_ = info->step;
+
+	blocksX_ = layout.size.width / Subsample / Block;
+	blocksY_ = layout.size.height / Subsample / Block;
+	width_ = blocksX_ * Block;
+
+	current_.resize(width_ * blocksY_ * Block);
+	reference_.resize(current_.size());
+}
+
+void ChangeDetector::sample(const uint8_t *src, unsigned int stride)
+{
+	const unsigned int step = step_ * Subsample;
+
+	for (unsigned int y = 0; y < blocksY_ * Block; ++y) {
+		const uint8_t *s = src + static_cast<size_t>(y) * Subsample * stride + offset_;
+		uint8_t *d = current_.data() + y * width_;
+
+		for (unsigned int x = 0; x < width_; ++x)
+			d[x] = s[x * step];
+	}
+}
+
+/* Stops at the first changed block, moving scenes cost little beyond sampling */
+bool ChangeDetector::changed(const Image &image)
+{
+	{
+		ImageAccess access(image, 1 << 0, Image::MapMode::ReadOnly);
+		const PlaneView<const uint8_t> luma = image.plane(0);
+		sample(luma.data, luma.stride);
+	}
+
+	if (!hasReference_)
+		return true;
+
+	const unsigned int limit = threshold_ * Block * Block;
+
+	for (unsigned int by = 0; by < blocksY_; ++by) {
+		const size_t row = static_cast<size_t>(by) * Block * width_;
+
+		for (unsigned int bx = 0; bx < blocksX_; ++bx) {
+			const size_t offset = row + bx * Block;
+			if (blockSad(current_.data() + offset, reference_.data() + offset,
+				     width_) > limit)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void ChangeDetector::commit()
+{
+	current_.swap(reference_);
+	hasReference_ = true;
+}
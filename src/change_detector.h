@@ -0,0 +1,63 @@
+/*
+ * Detection of frames that differ from the last one streamed
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include "frame_layout.h"
+
+class Image;
+
+/*
+ * Compares the luma of each frame, sampled every Subsample pixels in both
+ * directions, with the luma of the last committed frame. The sampled plane is
+ * cut in blocks of Block x Block samples (the right and bottom samples left
+ * over are not compared), and a frame has changed as soon as the mean
+ * absolute difference of one block exceeds the threshold, in 8-bit levels.
+ * Averaging over a block keeps sensor noise below the threshold while a
+ * small moving object still stands out.
+ *
+ * Luma is the Y plane of YUV formats, and green stands in for it in RGB
+ * formats. Both buffers are allocated up front.
+ */
+class ChangeDetector
+{
+public:
+	static constexpr unsigned int Subsample = 4;
+	static constexpr unsigned int Block = 8;
+
+	ChangeDetector(const FrameLayout &layout, unsigned int threshold);
+
+	bool isValid() const { return blocksX_ && blocksY_; }
+
+	/*
+	 * Sample \a image and compare it with the reference. The first frame
+	 * has always changed.
+	 */
+	bool changed(const Image &image);
+	/* Make the frame last passed to changed() the reference */
+	void commit();
+
+private:
+	LIBCAMERA_DISABLE_COPY(ChangeDetector)
+
+	void sample(const uint8_t *src, unsigned int stride);
+
+	unsigned int offset_ = 0;
+	unsigned int step_ = 0;
+	unsigned int threshold_;
+
+	/* Sampled width and height, in whole blocks */
+	unsigned int blocksX_ = 0;
+	unsigned int blocksY_ = 0;
+	unsigned int width_ = 0;
+
+	std::vector<uint8_t> current_;
+	std::vector<uint8_t> reference_;
+	bool hasReference_ = false;
+};
@@ -0,0 +1,174 @@
+/*
+ * Line-based control socket for runtime reconfiguration
+ */
+
+#include "control_server.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <sstream>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+
+namespace {
+
+/* Commands are short, a client sending more without a newline is dropped */
+constexpr size_t MaxLineLength = 4096;
+
+} /* namespace */
+
+ControlServer::ControlServer()
+{
+}
+
+ControlServer::~ControlServer()
+{
+	stop();
+}
+
+int ControlServer::start(const std::string &path)
+{
+	struct sockaddr_un addr = {};
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd_ < 0)
+		return -errno;
+
+	/* A socket left behind by a previous run would make bind() fail */
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	unlink(path.c_str());
+
+	if (bind(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+	    listen(fd_, 4) < 0) {
+		int ret = -errno;
+		close(fd_);
+		fd_ = -1;
+		return ret;
+	}
+
+	path_ = path;
+	watch_ = g_unix_fd_add(fd_, G_IO_IN, onConnection, this);
+
+	addCommand("help", "help", [this](const std::vector<std::string> &) {
+		std::string usage;
+		for (const auto &[name, command] : commands_)
+			usage += (usage.empty() ? "" : ", ") + command.usage;
+		return Reply{ true, usage };
+	});
+
+	return 0;
+}
+
+void ControlServer::addCommand(const std::string &name, const std::string &usage,
+			       Handler handler)
+{
+	commands_[name] = { usage, std::move(handler) };
+}
+
+void ControlServer::stop()
+{
+	while (!clients_.empty())
+		removeClient(clients_.back().get());
+
+	if (watch_)
+		g_source_remove(watch_);
+	watch_ = 0;
+
+	if (fd_ >= 0) {
+		close(fd_);
+		unlink(path_.c_str());
+	}
+	fd_ = -1;
+}
+
+gboolean ControlServer::onConnection(gint fd, GIOCondition condition, gpointer data)
+{
+	ControlServer *server = static_cast<ControlServer *>(data);
+
+	int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client < 0)
+		return TRUE;
+
+	auto entry = std::make_unique<Client>();
+	entry->server = server;
+	entry->fd = client;
+	entry->watch = g_unix_fd_add(client, static_cast<GIOCondition>(G_IO_IN | G_IO_HUP),
+				     onClient, entry.get());
+	server->clients_.push_back(std::move(entry));
+
+	return TRUE;
+}
+
+gboolean ControlServer::onClient(gint fd, GIOCondition condition, gpointer data)
+{
+	Client *client = static_cast<Client *>(data);
+	ControlServer *server = client->server;
+	char buffer[1024];
+	ssize_t ret;
+
+	while ((ret = read(fd, buffer, sizeof(buffer))) > 0)
+		client->input.append(buffer, ret);
+
+	size_t end;
+	while ((end = client->input.find('\n')) != std::string::npos) {
+		std::string line = client->input.substr(0, end);
+		client->input.erase(0, end + 1);
+
+		std::string reply = server->execute(line) + "\n";
+		send(fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+	}
+
+	/* EOF, error or a runaway line: the watch goes away with the client */
+	if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR) ||
+	    client->input.size() > MaxLineLength) {
+		client->watch = 0;
+		server->removeClient(client);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+std::string ControlServer::execute(const std::string &line)
+{
+	std::istringstream words(line);
+	std::vector<std::string> args;
+	std::string name, arg;
+
+	if (!(words >> name))
+		return "error empty command";
+
+	while (words >> arg)
+		args.push_back(arg);
+
+	auto it = commands_.find(name);
+	if (it == commands_.end())
+		return "error unknown command '" + name + "'";
+
+	Reply reply = it->second.handler(args);
+	if (!reply.ok)
+		return "error " + reply.text;
+
+	return reply.text.empty() ? "ok" : "ok " + reply.text;
+}
+
+/* A client without watch is being removed from its own callback */
+void ControlServer::removeClient(Client *client)
+{
+	auto it = std::find_if(clients_.begin(), clients_.end(),
+			       [client](const std::unique_ptr<Client> &c) { return c.get() == client; });
+	if (it == clients_.end())
+		return;
+
+	if (client->watch)
+		g_source_remove(client->watch);
+	close(client->fd);
+	clients_.erase(it);
+}
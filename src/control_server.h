@@ -0,0 +1,72 @@
+/*
+ * Line-based control socket for runtime reconfiguration
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include <glib.h>
+
+/*
+ * Listens on a Unix stream socket. Every line a client sends is a command
+ * name followed by space-separated arguments, and is answered with one line:
+ * "ok", optionally followed by a result, or "error <message>". Clients may
+ * send any number of commands before closing the connection, for instance
+ *
+ *   echo "add 192.168.1.20 5000" | socat - UNIX-CONNECT:/tmp/stereo.sock
+ *
+ * Handlers run on the GLib main loop of the caller.
+ */
+class ControlServer
+{
+public:
+	/* Result of a command, or the error message when !ok */
+	struct Reply {
+		bool ok;
+		std::string text;
+	};
+	using Handler = std::function<Reply(const std::vector<std::string> &args)>;
+
+	ControlServer();
+	~ControlServer();
+
+	int start(const std::string &path);
+
+	/* \a usage is listed by the built-in "help" command */
+	void addCommand(const std::string &name, const std::string &usage, Handler handler);
+
+private:
+	LIBCAMERA_DISABLE_COPY(ControlServer)
+
+	struct Command {
+		std::string usage;
+		Handler handler;
+	};
+
+	struct Client {
+		ControlServer *server;
+		int fd;
+		guint watch;
+		std::string input;
+	};
+
+	static gboolean onConnection(gint fd, GIOCondition condition, gpointer data);
+	static gboolean onClient(gint fd, GIOCondition condition, gpointer data);
+
+	std::string execute(const std::string &line);
+	void removeClient(Client *client);
+	void stop();
+
+	int fd_ = -1;
+	guint watch_ = 0;
+	std::string path_;
+	std::map<std::string, Command> commands_;
+	std::vector<std::unique_ptr<Client>> clients_;
+};
@@ -0,0 +1,347 @@
+/*
+ * Pixel format conversion kernels
+ */
+
+#include "convert.h"
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "thread_pool.h"
+
+namespace {
+
+#if defined(__ARM_NEON)
+std::atomic<ConvertKernel> kernel{ ConvertKernel::Neon };
+#else
+std::atomic<ConvertKernel> kernel{ ConvertKernel::Scalar };
+#endif
+
+/*
+ * Split [0, height) into bands of whole multiples of \a align rows, a few
+ * per thread so that uneven progress balances out.
+ */
+template<typename Func>
+void forEachBand(unsigned int height, unsigned int align, ThreadPool *pool,
+		 Func func)
+{
+	const unsigned int threads = pool ? pool->size() : 1;
+	if (threads == 1) {
+		func(0, height);
+		return;
+	}
+
+	unsigned int bands = threads * 2;
+	unsigned int rows = (height + bands - 1) / bands;
+	rows = (rows + align - 1) / align * align;
+	bands = (height + rows - 1) / rows;
+
+	pool->run(bands, [&](unsigned int band) {
+		unsigned int y0 = band * rows;
+		func(y0, std::min(y0 + rows, height));
+	});
+}
+
+inline uint8_t lumaLimited(unsigned int r, unsigned int g, unsigned int b)
+{
+	return ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+}
+
+inline uint8_t lumaFull(unsigned int r, unsigned int g, unsigned int b)
+{
+	return (77 * r + 150 * g + 29 * b + 128) >> 8;
+}
+
+inline uint8_t chromaU(int r, int g, int b)
+{
+	return ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+}
+
+inline uint8_t chromaV(int r, int g, int b)
+{
+	return ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Scalar rows, also used for the tails of the vector rows                 */
+
+void rowToRGB(const uint8_t *s, uint8_t *d, unsigned int x, unsigned int width)
+{
+	for (; x < width; ++x) {
+		d[x * 3 + 0] = s[x * 4 + 2];
+		d[x * 3 + 1] = s[x * 4 + 1];
+		d[x * 3 + 2] = s[x * 4 + 0];
+	}
+}
+
+void rowToGray(const uint8_t *s, uint8_t *d, unsigned int x, unsigned int width)
+{
+	for (; x < width; ++x)
+		d[x] = lumaFull(s[x * 4 + 2], s[x * 4 + 1], s[x * 4 + 0]);
+}
+
+void rowToLuma(const uint8_t *s, uint8_t *d, unsigned int x, unsigned int width)
+{
+	for (; x < width; ++x)
+		d[x] = lumaLimited(s[x * 4 + 2], s[x * 4 + 1], s[x * 4 + 0]);
+}
+
+/*
+ * Chroma of a pair of rows from column pair x / 2 onwards, averaging 2x2
+ * blocks (the last column is repeated for odd widths). u and v advance by
+ * step bytes per sample, so that NV12 writes interleaved CbCr.
+ */
+void rowsToChroma(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v,
+		  unsigned int step, unsigned int x, unsigned int width)
+{
+	for (; x < width; x += 2) {
+		unsigned int x1 = std::min(x + 1, width - 1);
+		int b = s0[x * 4 + 0] + s0[x1 * 4 + 0] + s1[x * 4 + 0] + s1[x1 * 4 + 0];
+		int g = s0[x * 4 + 1] + s0[x1 * 4 + 1] + s1[x * 4 + 1] + s1[x1 * 4 + 1];
+		int r = s0[x * 4 + 2] + s0[x1 * 4 + 2] + s1[x * 4 + 2] + s1[x1 * 4 + 2];
+
+		b = (b + 2) >> 2;
+		g = (g + 2) >> 2;
+		r = (r + 2) >> 2;
+
+		u[x / 2 * step] = chromaU(r, g, b);
+		v[x / 2 * step] = chromaV(r, g, b);
+	}
+}
+
+/* ---------------------------------------------------------------------- */
+/* NEON rows, 16 pixels per iteration, returning the first column left    */
+
+#if defined(__ARM_NEON)
+
+unsigned int neonRowToRGB(const uint8_t *s, uint8_t *d, unsigned int width)
+{
+	unsigned int x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		uint8x16x4_t px = vld4q_u8(s + x * 4);
+		uint8x16x3_t rgb;
+		rgb.val[0] = px.val[2];
+		rgb.val[1] = px.val[1];
+		rgb.val[2] = px.val[0];
+		vst3q_u8(d + x * 3, rgb);
+	}
+
+	return x;
+}
+
+inline uint8x8_t neonLuma(uint8x8_t r, uint8x8_t g, uint8x8_t b,
+			  uint8x8_t cr, uint8x8_t cg, uint8x8_t cb)
+{
+	uint16x8_t sum = vmull_u8(r, cr);
+	sum = vmlal_u8(sum, g, cg);
+	sum = vmlal_u8(sum, b, cb);
+	/* Rounding narrow, (sum + 128) >> 8 */
+	return vrshrn_n_u16(sum, 8);
+}
+
+unsigned int neonRowToLuma(const uint8_t *s, uint8_t *d, unsigned int width,
+			   bool limited)
+{
+	const uint8x8_t cr = vdup_n_u8(limited ? 66 : 77);
+	const uint8x8_t cg = vdup_n_u8(limited ? 129 : 150);
+	const uint8x8_t cb = vdup_n_u8(limited ? 25 : 29);
+	const uint8x16_t offset = vdupq_n_u8(limited ? 16 : 0);
+	unsigned int x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		uint8x16x4_t px = vld4q_u8(s + x * 4);
+
+		uint8x8_t lo = neonLuma(vget_low_u8(px.val[2]), vget_low_u8(px.val[1]),
+					vget_low_u8(px.val[0]), cr, cg, cb);
+		uint8x8_t hi = neonLuma(vget_high_u8(px.val[2]), vget_high_u8(px.val[1]),
+					vget_high_u8(px.val[0]), cr, cg, cb);
+
+		vst1q_u8(d + x, vaddq_u8(vcombine_u8(lo, hi), offset));
+	}
+
+	return x;
+}
+
+/* 2x2 average of one channel over two rows of 16 pixels: 8 samples */
+inline int16x8_t neonAverage(uint8x16_t row0, uint8x16_t row1)
+{
+	uint16x8_t sum = vaddq_u16(vpaddlq_u8(row0), vpaddlq_u8(row1));
+	return vreinterpretq_s16_u16(vrshrq_n_u16(sum, 2));
+}
+
+inline uint8x8_t neonChroma(int16x8_t r, int16x8_t g, int16x8_t b,
+			    int16_t cr, int16_t cg, int16_t cb)
+{
+	int16x8_t sum = vmulq_n_s16(r, cr);
+	sum = vmlaq_n_s16(sum, g, cg);
+	sum = vmlaq_n_s16(sum, b, cb);
+	sum = vshrq_n_s16(vaddq_s16(sum, vdupq_n_s16(128)), 8);
+	return vqmovun_s16(vaddq_s16(sum, vdupq_n_s16(128)));
+}
+
+unsigned int neonRowsToChroma(const uint8_t *s0, const uint8_t *s1,
+			      uint8_t *u, uint8_t *v, bool interleaved,
+			      unsigned int width)
+{
+	unsigned int x = 0;
+
+	for (; x + 16 <= width; x += 16) {
+		uint8x16x4_t p0 = vld4q_u8(s0 + x * 4);
+		uint8x16x4_t p1 = vld4q_u8(s1 + x * 4);
+
+		int16x8_t b = neonAverage(p0.val[0], p1.val[0]);
+		int16x8_t g = neonAverage(p0.val[1], p1.val[1]);
+		int16x8_t r = neonAverage(p0.val[2], p1.val[2]);
+
+		uint8x8_t cu = neonChroma(r, g, b, -38, -74, 112);
+		uint8x8_t cv = neonChroma(r, g, b, 112, -94, -18);
+
+		if (interleaved) {
+			uint8x8x2_t uv = { { cu, cv } };
+			vst2_u8(u + x, uv);
+		} else {
+			vst1_u8(u + x / 2, cu);
+			vst1_u8(v + x / 2, cv);
+		}
+	}
+
+	return x;
+}
+
+#endif /* __ARM_NEON */
+
+/* ---------------------------------------------------------------------- */
+
+void convertRGB(const uint8_t *s, uint8_t *d, unsigned int width)
+{
+	unsigned int x = 0;
+#if defined(__ARM_NEON)
+	if (useNeonKernels())
+		x = neonRowToRGB(s, d, width);
+#endif
+	rowToRGB(s, d, x, width);
+}
+
+void convertGray(const uint8_t *s, uint8_t *d, unsigned int width)
+{
+	unsigned int x = 0;
+#if defined(__ARM_NEON)
+	if (useNeonKernels())
+		x = neonRowToLuma(s, d, width, false);
+#endif
+	rowToGray(s, d, x, width);
+}
+
+void convertLuma(const uint8_t *s, uint8_t *d, unsigned int width)
+{
+	unsigned int x = 0;
+#if defined(__ARM_NEON)
+	if (useNeonKernels())
+		x = neonRowToLuma(s, d, width, true);
+#endif
+	rowToLuma(s, d, x, width);
+}
+
+void convertChroma(const uint8_t *s0, const uint8_t *s1, uint8_t *u, uint8_t *v,
+		   bool interleaved, unsigned int width)
+{
+	unsigned int x = 0;
+#if defined(__ARM_NEON)
+	if (useNeonKernels())
+		x = neonRowsToChroma(s0, s1, u, v, interleaved, width);
+#endif
+	rowsToChroma(s0, s1, u, v, interleaved ? 2 : 1, x, width);
+}
+
+/* Shared by I420 and NV12, \a v is unused (u + 1) for interleaved chroma */
+void convertYUV420(const uint8_t *src, unsigned int srcStride,
+		   uint8_t *y, unsigned int yStride,
+		   uint8_t *u, unsigned int uStride,
+		   uint8_t *v, unsigned int vStride, bool interleaved,
+		   unsigned int width, unsigned int height, ThreadPool *pool)
+{
+	forEachBand(height, 2, pool, [&](unsigned int y0, unsigned int y1) {
+		for (unsigned int row = y0; row < y1; ++row)
+			convertLuma(src + row * srcStride, y + row * yStride, width);
+
+		for (unsigned int row = y0; row < y1; row += 2) {
+			const uint8_t *s0 = src + row * srcStride;
+			const uint8_t *s1 = row + 1 < height ? s0 + srcStride : s0;
+			uint8_t *cu = u + row / 2 * uStride;
+			uint8_t *cv = interleaved ? cu + 1 : v + row / 2 * vStride;
+
+			convertChroma(s0, s1, cu, cv, interleaved, width);
+		}
+	});
+}
+
+} /* namespace */
+
+ConvertKernel defaultConvertKernel()
+{
+#if defined(__ARM_NEON)
+	return ConvertKernel::Neon;
+#else
+	return ConvertKernel::Scalar;
+#endif
+}
+
+ConvertKernel convertKernel()
+{
+	return kernel.load(std::memory_order_relaxed);
+}
+
+bool setConvertKernel(ConvertKernel k)
+{
+#if !defined(__ARM_NEON)
+	if (k == ConvertKernel::Neon)
+		return false;
+#endif
+
+	kernel.store(k, std::memory_order_relaxed);
+	return true;
+}
+
+void XRGB8888toRGB(const uint8_t *src, unsigned int srcStride,
+		   uint8_t *dst, unsigned int dstStride,
+		   unsigned int width, unsigned int height, ThreadPool *pool)
+{
+	forEachBand(height, 1, pool, [&](unsigned int y0, unsigned int y1) {
+		for (unsigned int row = y0; row < y1; ++row)
+			convertRGB(src + row * srcStride, dst + row * dstStride, width);
+	});
+}
+
+void XRGB8888toGRAY8(const uint8_t *src, unsigned int srcStride,
+		     uint8_t *dst, unsigned int dstStride,
+		     unsigned int width, unsigned int height, ThreadPool *pool)
+{
+	forEachBand(height, 1, pool, [&](unsigned int y0, unsigned int y1) {
+		for (unsigned int row = y0; row < y1; ++row)
+			convertGray(src + row * srcStride, dst + row * dstStride, width);
+	});
+}
+
+void XRGB8888toI420(const uint8_t *src, unsigned int srcStride,
+		    uint8_t *y, unsigned int yStride,
+		    uint8_t *u, unsigned int uStride,
+		    uint8_t *v, unsigned int vStride,
+		    unsigned int width, unsigned int height, ThreadPool *pool)
+{
+	convertYUV420(src, srcStride, y, yStride, u, uStride, v, vStride, false,
+		      width, height, pool);
+}
+
+void XRGB8888toNV12(const uint8_t *src, unsigned int srcStride,
+		    uint8_t *y, unsigned int yStride,
+		    uint8_t *uv, unsigned int uvStride,
+		    unsigned int width, unsigned int height, ThreadPool *pool)
+{
+	convertYUV420(src, srcStride, y, yStride, uv, uvStride, nullptr, 0, true,
+		      width, height, pool);
+}
@@ -0,0 +1,58 @@
+/*
+ * Pixel format conversion kernels
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+class ThreadPool;
+
+/*
+ * All kernels take XRGB8888 (B, G, R, X bytes in memory) and honour source
+ * and destination strides. Work is split in bands of rows across \a pool
+ * when one is given. I420 and NV12 are BT.601 limited range, GRAY8 is full
+ * range luma as used for stereo matching.
+ */
+
+enum class ConvertKernel {
+	Scalar,
+	Neon,
+};
+
+/* Fastest kernel available on this build, Neon where supported */
+ConvertKernel defaultConvertKernel();
+ConvertKernel convertKernel();
+/* Returns false if the kernel is not available on this build */
+bool setConvertKernel(ConvertKernel kernel);
+
+#if defined(__ARM_NEON)
+/* Whether kernels with a NEON variant, here or elsewhere, should run it */
+inline bool useNeonKernels()
+{
+	return convertKernel() == ConvertKernel::Neon;
+}
+#endif
+
+void XRGB8888toRGB(const uint8_t *src, unsigned int srcStride,
+		   uint8_t *dst, unsigned int dstStride,
+		   unsigned int width, unsigned int height,
+		   ThreadPool *pool = nullptr);
+
+void XRGB8888toGRAY8(const uint8_t *src, unsigned int srcStride,
+		     uint8_t *dst, unsigned int dstStride,
+		     unsigned int width, unsigned int height,
+		     ThreadPool *pool = nullptr);
+
+void XRGB8888toI420(const uint8_t *src, unsigned int srcStride,
+		    uint8_t *y, unsigned int yStride,
+		    uint8_t *u, unsigned int uStride,
+		    uint8_t *v, unsigned int vStride,
+		    unsigned int width, unsigned int height,
+		    ThreadPool *pool = nullptr);
+
+void XRGB8888toNV12(const uint8_t *src, unsigned int srcStride,
+		    uint8_t *y, unsigned int yStride,
+		    uint8_t *uv, unsigned int uvStride,
+		    unsigned int width, unsigned int height,
+		    ThreadPool *pool = nullptr);
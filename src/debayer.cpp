@@ -0,0 +1,416 @@
+/*
+ * Raw Bayer frames to grayscale and RGB
+ */
+
+#include "debayer.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/formats.h>
+
+#include "convert.h"
+#include "thread_pool.h"
+
+using namespace libcamera;
+
+namespace {
+
+using Order = BayerFormat::Order;
+
+const struct {
+	PixelFormat format;
+	BayerFormat bayer;
+} bayerFormats[] = {
+	{ formats::SRGGB8, { Order::RGGB, 8, false } },
+	{ formats::SGRBG8, { Order::GRBG, 8, false } },
+	{ formats::SGBRG8, { Order::GBRG, 8, false } },
+	{ formats::SBGGR8, { Order::BGGR, 8, false } },
+	{ formats::SRGGB10, { Order::RGGB, 10, false } },
+	{ formats::SGRBG10, { Order::GRBG, 10, false } },
+	{ formats::SGBRG10, { Order::GBRG, 10, false } },
+	{ formats::SBGGR10, { Order::BGGR, 10, false } },
+	{ formats::SRGGB10_CSI2P, { Order::RGGB, 10, true } },
+	{ formats::SGRBG10_CSI2P, { Order::GRBG, 10, true } },
+	{ formats::SGBRG10_CSI2P, { Order::GBRG, 10, true } },
+	{ formats::SBGGR10_CSI2P, { Order::BGGR, 10, true } },
+	{ formats::SRGGB12, { Order::RGGB, 12, false } },
+	{ formats::SGRBG12, { Order::GRBG, 12, false } },
+	{ formats::SGBRG12, { Order::GBRG, 12, false } },
+	{ formats::SBGGR12, { Order::BGGR, 12, false } },
+	{ formats::SRGGB12_CSI2P, { Order::RGGB, 12, true } },
+	{ formats::SGRBG12_CSI2P, { Order::GRBG, 12, true } },
+	{ formats::SGBRG12_CSI2P, { Order::GBRG, 12, true } },
+	{ formats::SBGGR12_CSI2P, { Order::BGGR, 12, true } },
+	{ formats::SRGGB16, { Order::RGGB, 16, false } },
+	{ formats::SGRBG16, { Order::GRBG, 16, false } },
+	{ formats::SGBRG16, { Order::GBRG, 16, false } },
+	{ formats::SBGGR16, { Order::BGGR, 16, false } },
+};
+
+/* Bands of rows as in the conversion kernels, \a align rows each */
+template<typename Func>
+void forEachBand(unsigned int height, unsigned int align, ThreadPool *pool,
+		 Func func)
+{
+	const unsigned int threads = pool ? pool->size() : 1;
+	if (threads == 1) {
+		func(0, height);
+		return;
+	}
+
+	unsigned int bands = threads * 2;
+	unsigned int rows = (height + bands - 1) / bands;
+	rows = (rows + align - 1) / align * align;
+	bands = (height + rows - 1) / rows;
+
+	pool->run(bands, [&](unsigned int band) {
+		unsigned int y0 = band * rows;
+		func(y0, std::min(y0 + rows, height));
+	});
+}
+
+/*
+ * Colours of row y: whether it holds red (or else blue) samples, and the
+ * parity of their columns, the others are green.
+ */
+struct RowColors {
+	bool red;
+	unsigned int column;
+};
+
+RowColors rowColors(Order order, unsigned int y)
+{
+	/* Column and row of the red sample in the top-left quad */
+	const unsigned int rx = order == Order::RGGB || order == Order::GBRG ? 0 : 1;
+	const unsigned int ry = order == Order::RGGB || order == Order::GRBG ? 0 : 1;
+	const bool red = (y & 1) == ry;
+
+	return { red, red ? rx : 1 - rx };
+}
+
+/* ---------------------------------------------------------------------- */
+/* Scalar rows, also used for the borders and tails of the vector rows    */
+
+void unpackRow(const uint8_t *s, const BayerFormat &format, uint8_t *d,
+	       unsigned int x, unsigned int width)
+{
+	if (format.packed && format.bits == 10) {
+		for (; x < width; ++x)
+			d[x] = s[x / 4 * 5 + x % 4];
+	} else if (format.packed) {
+		for (; x < width; ++x)
+			d[x] = s[x / 2 * 3 + x % 2];
+	} else {
+		const unsigned int shift = format.bits - 8;
+		for (; x < width; ++x)
+			d[x] = (s[x * 2] | s[x * 2 + 1] << 8) >> shift;
+	}
+}
+
+void binRow(const uint8_t *s0, const uint8_t *s1, uint8_t *d,
+	    unsigned int x, unsigned int width)
+{
+	for (; x < width; ++x)
+		d[x] = (s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2;
+}
+
+/*
+ * Row c between rows p and n. A red or blue sample takes green from its 4
+ * neighbours and the other colour from its 4 diagonals; a green sample
+ * takes the colour of its row from left and right, the other one from above
+ * and below. Columns beyond the borders are mirrored.
+ */
+void bilinearRow(const uint8_t *p, const uint8_t *c, const uint8_t *n, uint8_t *d,
+		 RowColors colors, unsigned int x, unsigned int end, unsigned int width)
+{
+	for (; x < end; ++x) {
+		const unsigned int l = x ? x - 1 : 1;
+		const unsigned int r = x + 1 < width ? x + 1 : width - 2;
+		unsigned int own, green, other;
+
+		if ((x & 1) == colors.column) {
+			own = c[x];
+			green = (c[l] + c[r] + p[x] + n[x] + 2) >> 2;
+			other = (p[l] + p[r] + n[l] + n[r] + 2) >> 2;
+		} else {
+			own = (c[l] + c[r] + 1) >> 1;
+			green = c[x];
+			other = (p[x] + n[x] + 1) >> 1;
+		}
+
+		d[x * 4 + 0] = colors.red ? other : own;
+		d[x * 4 + 1] = green;
+		d[x * 4 + 2] = colors.red ? own : other;
+		d[x * 4 + 3] = 255;
+	}
+}
+
+/* ---------------------------------------------------------------------- */
+/* NEON rows, returning the first column left                             */
+
+#if defined(__ARM_NEON)
+
+unsigned int neonUnpackRow(const uint8_t *s, const BayerFormat &format, uint8_t *d,
+			   unsigned int width)
+{
+	unsigned int x = 0;
+
+	if (format.packed && format.bits == 10) {
+#if defined(__aarch64__)
+		/* 16 samples from 20 bytes, the loads read 12 more */
+		static const uint8_t msb[16] = { 0, 1, 2, 3, 5, 6, 7, 8,
+						 10, 11, 12, 13, 15, 16, 17, 18 };
+		const uint8x16_t index = vld1q_u8(msb);
+
+		for (; x + 32 <= width; x += 16) {
+			const uint8_t *group = s + x / 4 * 5;
+			uint8x16x2_t bytes = { { vld1q_u8(group), vld1q_u8(group + 16) } };
+			vst1q_u8(d + x, vqtbl2q_u8(bytes, index));
+		}
+#endif
+	} else if (format.packed) {
+		for (; x + 16 <= width; x += 16) {
+			uint8x8x3_t bytes = vld3_u8(s + x / 2 * 3);
+			uint8x8x2_t msb = { { bytes.val[0], bytes.val[1] } };
+			vst2_u8(d + x, msb);
+		}
+	} else {
+		const int16x8_t shift = vdupq_n_s16(8 - static_cast<int>(format.bits));
+		const uint16_t *words = reinterpret_cast<const uint16_t *>(s);
+
+		for (; x + 16 <= width; x += 16) {
+			uint16x8_t lo = vshlq_u16(vld1q_u16(words + x), shift);
+			uint16x8_t hi = vshlq_u16(vld1q_u16(words + x + 8), shift);
+			vst1q_u8(d + x, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+		}
+	}
+
+	return x;
+}
+
+unsigned int neonBinRow(const uint8_t *s0, const uint8_t *s1, uint8_t *d,
+			unsigned int width)
+{
+	unsigned int x = 0;
+
+	for (; x + 8 <= width; x += 8) {
+		uint16x8_t sum = vaddq_u16(vpaddlq_u8(vld1q_u8(s0 + 2 * x)),
+					   vpaddlq_u8(vld1q_u8(s1 + 2 * x)));
+		vst1_u8(d + x, vrshrn_n_u16(sum, 2));
+	}
+
+	return x;
+}
+
+/* Rounded (a + b + c + d) / 4, as the scalar rows */
+inline uint8x16_t neonAverage4(uint8x16_t a, uint8x16_t b, uint8x16_t c, uint8x16_t d)
+{
+	uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(a), vget_low_u8(b)),
+				  vaddl_u8(vget_low_u8(c), vget_low_u8(d)));
+	uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(a), vget_high_u8(b)),
+				  vaddl_u8(vget_high_u8(c), vget_high_u8(d)));
+	return vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2));
+}
+
+/* 32 samples from an even column: even and odd ones, and their neighbours */
+struct NeonRow {
+	uint8x16_t even;
+	uint8x16_t odd;
+	uint8x16_t oddPrev;
+	uint8x16_t evenNext;
+};
+
+inline NeonRow neonLoadRow(const uint8_t *s)
+{
+	uint8x16x2_t at = vld2q_u8(s);
+	return { at.val[0], at.val[1], vld2q_u8(s - 2).val[1], vld2q_u8(s + 2).val[0] };
+}
+
+/* From column 2, so that the left neighbours are in the row */
+unsigned int neonBilinearRow(const uint8_t *p, const uint8_t *c, const uint8_t *n,
+			     uint8_t *d, RowColors colors, unsigned int width)
+{
+	const uint8x16_t alpha = vdupq_n_u8(255);
+	unsigned int x = 2;
+
+	for (; x + 34 <= width; x += 32) {
+		const NeonRow rp = neonLoadRow(p + x);
+		const NeonRow rc = neonLoadRow(c + x);
+		const NeonRow rn = neonLoadRow(n + x);
+		/* Even lanes, then odd lanes */
+		uint8x16_t own[2], green[2], other[2];
+
+		if (colors.column == 0) {
+			own[0] = rc.even;
+			green[0] = neonAverage4(rc.oddPrev, rc.odd, rp.even, rn.even);
+			other[0] = neonAverage4(rp.oddPrev, rp.odd, rn.oddPrev, rn.odd);
+			own[1] = vrhaddq_u8(rc.even, rc.evenNext);
+			green[1] = rc.odd;
+			other[1] = vrhaddq_u8(rp.odd, rn.odd);
+		} else {
+			own[0] = vrhaddq_u8(rc.oddPrev, rc.odd);
+			green[0] = rc.even;
+			other[0] = vrhaddq_u8(rp.even, rn.even);
+			own[1] = rc.odd;
+			green[1] = neonAverage4(rc.even, rc.evenNext, rp.odd, rn.odd);
+			other[1] = neonAverage4(rp.even, rp.evenNext, rn.even, rn.evenNext);
+		}
+
+		const uint8x16x2_t o = vzipq_u8(own[0], own[1]);
+		const uint8x16x2_t g = vzipq_u8(green[0], green[1]);
+		const uint8x16x2_t t = vzipq_u8(other[0], other[1]);
+
+		for (unsigned int half = 0; half < 2; ++half) {
+			uint8x16x4_t px;
+			px.val[0] = colors.red ? t.val[half] : o.val[half];
+			px.val[1] = g.val[half];
+			px.val[2] = colors.red ? o.val[half] : t.val[half];
+			px.val[3] = alpha;
+			vst4q_u8(d + (x + 16 * half) * 4, px);
+		}
+	}
+
+	return x;
+}
+
+#endif /* __ARM_NEON */
+
+/* ---------------------------------------------------------------------- */
+
+void convertUnpack(const uint8_t *s, const BayerFormat &format, uint8_t *d,
+		   unsigned int width)
+{
+	unsigned int x = 0;
+#if defined(__ARM_NEON)
+	if (useNeonKernels())
+		x = neonUnpackRow(s, format, d, width);
+#endif
+	unpackRow(s, format, d, x, width);
+}
+
+void convertBin(const uint8_t *s0, const uint8_t *s1, uint8_t *d, unsigned int width)
+{
+	unsigned int x = 0;
+#if defined(__ARM_NEON)
+	if (useNeonKernels())
+		x = neonBinRow(s0, s1, d, width);
+#endif
+	binRow(s0, s1, d, x, width);
+}
+
+void convertBilinear(const uint8_t *p, const uint8_t *c, const uint8_t *n, uint8_t *d,
+		     RowColors colors, unsigned int width)
+{
+	unsigned int x = 0;
+#if defined(__ARM_NEON)
+	if (useNeonKernels()) {
+		bilinearRow(p, c, n, d, colors, 0, 2, width);
+		x = neonBilinearRow(p, c, n, d, colors, width);
+	}
+#endif
+	bilinearRow(p, c, n, d, colors, x, width, width);
+}
+
+/* Unpacked rows, per thread and sized on first use */
+thread_local std::vector<uint8_t> scratch[3];
+
+/*
+ * Rows of a raw frame as 8-bit samples. 8-bit frames are read in place,
+ * others are unpacked into a ring of the last three rows, so that every row
+ * of a band is unpacked once.
+ */
+class RawRows
+{
+public:
+	RawRows(const uint8_t *src, unsigned int stride, const BayerFormat &format,
+		unsigned int width)
+		: src_(src), stride_(stride), format_(format), width_(width)
+	{
+	}
+
+	const uint8_t *row(unsigned int y)
+	{
+		const uint8_t *s = src_ + static_cast<size_t>(y) * stride_;
+		if (format_.bits == 8)
+			return s;
+
+		std::vector<uint8_t> &line = scratch[y % 3];
+		if (line.size() < width_)
+			line.resize(width_);
+
+		if (rows_[y % 3] != static_cast<int>(y)) {
+			convertUnpack(s, format_, line.data(), width_);
+			rows_[y % 3] = y;
+		}
+
+		return line.data();
+	}
+
+private:
+	const uint8_t *src_;
+	unsigned int stride_;
+	const BayerFormat &format_;
+	unsigned int width_;
+	int rows_[3] = { -1, -1, -1 };
+};
+
+} /* namespace */
+
+bool BayerFormat::fromPixelFormat(const PixelFormat &format, BayerFormat *bayer)
+{
+	for (const auto &entry : bayerFormats) {
+		if (entry.format == format) {
+			*bayer = entry.bayer;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+unsigned int BayerFormat::bytesPerLine(unsigned int width) const
+{
+	if (packed)
+		return (width * bits + 7) / 8;
+
+	return bits > 8 ? width * 2 : width;
+}
+
+void BayertoGRAY8Binned(const uint8_t *src, unsigned int srcStride,
+			const BayerFormat &format,
+			uint8_t *dst, unsigned int dstStride,
+			unsigned int width, unsigned int height, ThreadPool *pool)
+{
+	forEachBand(height / 2, 1, pool, [&](unsigned int y0, unsigned int y1) {
+		RawRows rows(src, srcStride, format, width);
+
+		for (unsigned int y = y0; y < y1; ++y)
+			convertBin(rows.row(2 * y), rows.row(2 * y + 1),
+				   dst + y * dstStride, width / 2);
+	});
+}
+
+void BayertoXRGB8888(const uint8_t *src, unsigned int srcStride,
+		     const BayerFormat &format,
+		     uint8_t *dst, unsigned int dstStride,
+		     unsigned int width, unsigned int height, ThreadPool *pool)
+{
+	forEachBand(height, 2, pool, [&](unsigned int y0, unsigned int y1) {
+		RawRows rows(src, srcStride, format, width);
+
+		/* Rows beyond the borders are mirrored, keeping their colours */
+		for (unsigned int y = y0; y < y1; ++y) {
+			const uint8_t *p = rows.row(y ? y - 1 : 1);
+			const uint8_t *c = rows.row(y);
+			const uint8_t *n = rows.row(y + 1 < height ? y + 1 : height - 2);
+
+			convertBilinear(p, c, n, dst + y * dstStride,
+					rowColors(format.order, y), width);
+		}
+	});
+}
@@ -0,0 +1,58 @@
+/*
+ * Raw Bayer frames to grayscale and RGB
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <libcamera/pixel_format.h>
+
+class ThreadPool;
+
+/*
+ * Sample layout of a raw Bayer format: the colours of the top-left 2x2
+ * quad, and how samples are stored. Unpacked samples of more than 8 bits
+ * are little-endian 16-bit words with \a bits significant bits; MIPI CSI-2
+ * packed ones store the most significant bytes of 4 (10-bit) or 2 (12-bit)
+ * samples followed by a byte of their low bits.
+ */
+struct BayerFormat {
+	enum class Order {
+		RGGB,
+		GRBG,
+		GBRG,
+		BGGR,
+	};
+
+	Order order;
+	unsigned int bits;
+	bool packed;
+
+	/* Bytes of sample data in a row of \a width samples */
+	unsigned int bytesPerLine(unsigned int width) const;
+
+	/* Returns false for anything but a raw Bayer format */
+	static bool fromPixelFormat(const libcamera::PixelFormat &format, BayerFormat *bayer);
+};
+
+/*
+ * Both kernels keep the 8 most significant bits of every sample, run the
+ * NEON rows when convertKernel() selects them and split work in bands of
+ * rows across \a pool when one is given. \a width and \a height are those of
+ * the raw frame, which has to be at least 4x4 with even dimensions.
+ */
+
+/* Average of every 2x2 quad, a GRAY8 frame of half the width and height */
+void BayertoGRAY8Binned(const uint8_t *src, unsigned int srcStride,
+			const BayerFormat &format,
+			uint8_t *dst, unsigned int dstStride,
+			unsigned int width, unsigned int height,
+			ThreadPool *pool = nullptr);
+
+/* Bilinear interpolation of the two missing colours at every pixel */
+void BayertoXRGB8888(const uint8_t *src, unsigned int srcStride,
+		     const BayerFormat &format,
+		     uint8_t *dst, unsigned int dstStride,
+		     unsigned int width, unsigned int height,
+		     ThreadPool *pool = nullptr);
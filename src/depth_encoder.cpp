@@ -0,0 +1,217 @@
+/*
+ * Compact encoding of disparity maps for the network
+ */
+
+#include "depth_encoder.h"
+
+#include <string.h>
+
+#include "disparity.h"
+
+using namespace libcamera;
+
+namespace {
+
+constexpr uint8_t Magic[4] = { 'D', 'S', 'P', '1' };
+
+/* Tokens of the delta codec */
+constexpr unsigned int MaxRun = 0x80;
+constexpr unsigned int MaxShort = 0xfe - 0x7f;
+constexpr uint8_t Escape = 0xff;
+
+void put16(uint8_t *dst, uint16_t value)
+{
+	dst[0] = value;
+	dst[1] = value >> 8;
+}
+
+uint16_t get16(const uint8_t *src)
+{
+	return src[0] | src[1] << 8;
+}
+
+uint16_t zigzag(uint16_t delta)
+{
+	const int16_t d = static_cast<int16_t>(delta);
+	return static_cast<uint16_t>(delta << 1) ^ static_cast<uint16_t>(d >> 15);
+}
+
+uint16_t unzigzag(uint16_t value)
+{
+	return (value >> 1) ^ static_cast<uint16_t>(-(value & 1));
+}
+
+} /* namespace */
+
+DepthEncoder::DepthEncoder(const Config &config, const Size &size)
+	: config_(config)
+{
+	if (!config.scale || config.bits > DisparityEngine::SubpixelBits)
+		return;
+
+	const Size scaled(size.width / config.scale, size.height / config.scale);
+	if (scaled.isNull() || scaled.width > 0xffff || scaled.height > 0xffff)
+		return;
+
+	size_ = scaled;
+}
+
+size_t DepthEncoder::maxEncodedSize() const
+{
+	/* An escape per sample at worst */
+	const size_t samples = static_cast<size_t>(size_.width) * size_.height;
+	return HeaderSize + samples * (config_.codec == Codec::Raw ? 2 : 3);
+}
+
+/* Largest valid disparity of a block, nearest to the cameras, quantised */
+uint16_t DepthEncoder::sample(const uint16_t *disparity, unsigned int stride,
+			      unsigned int x, unsigned int y) const
+{
+	const unsigned int scale = config_.scale;
+	uint16_t best = Invalid;
+
+	for (unsigned int j = 0; j < scale; ++j) {
+		const uint16_t *row = disparity + static_cast<size_t>(y * scale + j) * stride;
+
+		for (unsigned int i = 0; i < scale; ++i) {
+			const uint16_t value = row[x * scale + i];
+			if (value != DisparityEngine::Invalid &&
+			    (best == Invalid || value > best))
+				best = value;
+		}
+	}
+
+	if (best == Invalid)
+		return Invalid;
+
+	return best >> (DisparityEngine::SubpixelBits - config_.bits);
+}
+
+size_t DepthEncoder::encode(const uint16_t *disparity, unsigned int stride,
+			    uint64_t timestamp, uint8_t *dst) const
+{
+	memcpy(dst, Magic, sizeof(Magic));
+	dst[4] = static_cast<uint8_t>(config_.codec);
+	dst[5] = config_.bits;
+	dst[6] = config_.scale;
+	dst[7] = 0;
+	put16(dst + 8, size_.width);
+	put16(dst + 10, size_.height);
+	for (unsigned int i = 0; i < 8; ++i)
+		dst[12 + i] = timestamp >> (8 * i);
+
+	uint8_t *out = dst + HeaderSize;
+
+	if (config_.codec == Codec::Raw) {
+		for (unsigned int y = 0; y < size_.height; ++y) {
+			for (unsigned int x = 0; x < size_.width; ++x, out += 2)
+				put16(out, sample(disparity, stride, x, y));
+		}
+
+		return out - dst;
+	}
+
+	unsigned int run = 0;
+	uint16_t above = 0;
+
+	for (unsigned int y = 0; y < size_.height; ++y) {
+		uint16_t previous = above;
+
+		for (unsigned int x = 0; x < size_.width; ++x) {
+			const uint16_t value = sample(disparity, stride, x, y);
+			const uint16_t delta = zigzag(value - previous);
+			previous = value;
+			if (!x)
+				above = value;
+
+			if (!delta) {
+				if (++run == MaxRun) {
+					*out++ = run - 1;
+					run = 0;
+				}
+				continue;
+			}
+
+			if (run) {
+				*out++ = run - 1;
+				run = 0;
+			}
+
+			if (delta <= MaxShort) {
+				*out++ = delta + 0x7f;
+			} else {
+				*out++ = Escape;
+				put16(out, delta);
+				out += 2;
+			}
+		}
+	}
+
+	if (run)
+		*out++ = run - 1;
+
+	return out - dst;
+}
+
+bool DepthEncoder::decode(const uint8_t *data, size_t size, Header *header,
+			  uint16_t *dst, size_t samples)
+{
+	if (size < HeaderSize || memcmp(data, Magic, sizeof(Magic)) ||
+	    data[4] > static_cast<uint8_t>(Codec::Delta))
+		return false;
+
+	header->codec = static_cast<Codec>(data[4]);
+	header->bits = data[5];
+	header->scale = data[6];
+	header->size = Size(get16(data + 8), get16(data + 10));
+	header->timestamp = 0;
+	for (unsigned int i = 0; i < 8; ++i)
+		header->timestamp |= static_cast<uint64_t>(data[12 + i]) << (8 * i);
+
+	const unsigned int width = header->size.width;
+	const size_t count = static_cast<size_t>(width) * header->size.height;
+	if (count > samples)
+		return false;
+
+	const uint8_t *in = data + HeaderSize;
+	const uint8_t *end = data + size;
+
+	if (header->codec == Codec::Raw) {
+		if (static_cast<size_t>(end - in) < 2 * count)
+			return false;
+
+		for (size_t i = 0; i < count; ++i)
+			dst[i] = get16(in + 2 * i);
+		return true;
+	}
+
+	/* Differences are taken as in encode(), runs may cross rows */
+	size_t i = 0;
+	while (i < count) {
+		if (in == end)
+			return false;
+
+		const uint8_t token = *in++;
+		unsigned int repeat = 1;
+		uint16_t delta = 0;
+
+		if (token < MaxRun) {
+			repeat = token + 1;
+		} else if (token != Escape) {
+			delta = token - 0x7f;
+		} else {
+			if (end - in < 2)
+				return false;
+			delta = get16(in);
+			in += 2;
+		}
+
+		for (; repeat && i < count; --repeat, ++i) {
+			const size_t x = i % width;
+			const uint16_t previous = x ? dst[i - 1] : i ? dst[i - width] : 0;
+			dst[i] = previous + unzigzag(delta);
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,88 @@
+/*
+ * Compact encoding of disparity maps for the network
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcamera/geometry.h>
+
+/*
+ * Every encoded map starts with a HeaderSize byte header: "DSP1", codec,
+ * fractional bits, scale, a reserved byte, then the width, height (16-bit)
+ * and sensor timestamp (64-bit) in little-endian. The width x height samples
+ * follow in raster order. Invalid samples are 0xffff, valid ones are
+ * disparities with that many fractional bits, in pixels of the full map.
+ *
+ * Raw maps store the samples as 16-bit words. Delta maps store the
+ * difference (modulo 2^16) of each sample to its left neighbour or, at the
+ * start of a row, to the first sample of the row above (0 for the first
+ * row), zigzag-mapped to unsigned (0, -1, 1, -2...) and coded byte-wise:
+ *
+ *   0x00-0x7f  (byte + 1) zero differences
+ *   0x80-0xfe  one zigzagged difference of (byte - 0x7f)
+ *   0xff       one zigzagged difference in the next two bytes
+ *
+ * Surfaces and invalid areas are mostly runs and small steps, which this
+ * codes in a few bits per sample without losing any.
+ */
+class DepthEncoder
+{
+public:
+	enum class Codec : uint8_t {
+		Raw = 0,
+		Delta = 1,
+	};
+
+	struct Config {
+		Codec codec = Codec::Delta;
+		/* Keep the largest valid disparity of every scale x scale block */
+		unsigned int scale = 1;
+		/* Fractional bits kept, at most DisparityEngine::SubpixelBits */
+		unsigned int bits = 4;
+	};
+
+	struct Header {
+		Codec codec;
+		unsigned int bits;
+		unsigned int scale;
+		libcamera::Size size;
+		/* Sensor timestamp of the left frame, as in the video stream */
+		uint64_t timestamp;
+	};
+
+	static constexpr size_t HeaderSize = 20;
+	static constexpr uint16_t Invalid = 0xffff;
+
+	/* \a size is that of the disparity maps, before scaling */
+	DepthEncoder(const Config &config, const libcamera::Size &size);
+
+	bool isValid() const { return !size_.isNull(); }
+
+	/* Size of the encoded maps, and the largest encoding of one */
+	const libcamera::Size &size() const { return size_; }
+	size_t maxEncodedSize() const;
+
+	/*
+	 * Encode \a disparity (\a stride elements per row) into \a dst, which
+	 * holds maxEncodedSize() bytes. Returns the number of bytes written.
+	 */
+	size_t encode(const uint16_t *disparity, unsigned int stride,
+		      uint64_t timestamp, uint8_t *dst) const;
+
+	/*
+	 * Decode an encoded map into \a dst, width x height samples, for
+	 * receivers. Returns false if \a data is not a valid encoding.
+	 */
+	static bool decode(const uint8_t *data, size_t size, Header *header,
+			   uint16_t *dst, size_t samples);
+
+private:
+	uint16_t sample(const uint16_t *disparity, unsigned int stride,
+			unsigned int x, unsigned int y) const;
+
+	Config config_;
+	libcamera::Size size_;
+};
@@ -0,0 +1,107 @@
+/*
+ * Disparity computation off the capture path
+ */
+
+#include "depth_worker.h"
+
+#include <chrono>
+
+#include "frame_arena.h"
+
+using namespace libcamera;
+
+DepthWorker::DepthWorker(const DisparityEngine::Config &config, const Size &size,
+			 unsigned int threads, Handler handler, FrameArena *arena)
+	: engine_(config, size), pool_(threads), handler_(std::move(handler))
+{
+	if (!engine_.isValid())
+		return;
+
+	/* Both inputs, then the map, 16 bits per pixel */
+	const size_t pixels = static_cast<size_t>(size.width) * size.height;
+	uint8_t *memory = arena ? arena->allocate(4 * pixels) : nullptr;
+	if (!memory) {
+		storage_ = std::make_unique<uint8_t[]>(4 * pixels);
+		memory = storage_.get();
+	}
+
+	input_[0] = memory;
+	input_[1] = memory + pixels;
+	disparity_ = reinterpret_cast<uint16_t *>(memory + 2 * pixels);
+
+	thread_ = std::thread(&DepthWorker::run, this);
+}
+
+DepthWorker::~DepthWorker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+
+	if (thread_.joinable())
+		thread_.join();
+}
+
+bool DepthWorker::begin()
+{
+	if (!thread_.joinable() || busy_.load(std::memory_order_acquire)) {
+		skipped_.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	return true;
+}
+
+void DepthWorker::commit(uint64_t timestamp)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		timestamp_ = timestamp;
+		pending_ = true;
+		busy_.store(true, std::memory_order_relaxed);
+	}
+	wake_.notify_one();
+}
+
+DepthWorker::Stats DepthWorker::stats() const
+{
+	return { computed_.load(std::memory_order_relaxed),
+		 skipped_.load(std::memory_order_relaxed),
+		 lastDuration_.load(std::memory_order_relaxed) };
+}
+
+void DepthWorker::run()
+{
+	for (;;) {
+		uint64_t timestamp;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [this] { return pending_ || stop_; });
+			if (stop_)
+				return;
+			timestamp = timestamp_;
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		engine_.compute(input_[0], stride(), input_[1], stride(),
+				disparity_, engine_.size().width, &pool_);
+		const auto end = std::chrono::steady_clock::now();
+
+		lastDuration_.store(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+				    std::memory_order_relaxed);
+		computed_.fetch_add(1, std::memory_order_relaxed);
+
+		if (handler_)
+			handler_(disparity_, engine_.size().width, timestamp);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_ = false;
+		}
+		/* Inputs may be overwritten from here on */
+		busy_.store(false, std::memory_order_release);
+	}
+}
@@ -0,0 +1,93 @@
+/*
+ * Disparity computation off the capture path
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/geometry.h>
+
+#include "disparity.h"
+#include "thread_pool.h"
+
+class FrameArena;
+
+/*
+ * Runs a DisparityEngine on its own thread and pool, so that matching never
+ * holds up the camera. The capture side offers every rectified pair; pairs
+ * arriving while the previous one is still being matched are skipped, and
+ * the disparity rate settles at whatever the engine sustains.
+ */
+class DepthWorker
+{
+public:
+	/* Called on the worker thread, the map is valid until it returns */
+	using Handler = std::function<void(const uint16_t *disparity, unsigned int stride,
+					   uint64_t timestamp)>;
+
+	struct Stats {
+		uint64_t computed;
+		uint64_t skipped;
+		/* Duration of the last computation, in microseconds */
+		uint64_t lastDuration;
+	};
+
+	/* The inputs and the disparity map come from \a arena when given */
+	DepthWorker(const DisparityEngine::Config &config, const libcamera::Size &size,
+		    unsigned int threads, Handler handler, FrameArena *arena = nullptr);
+	~DepthWorker();
+
+	bool isValid() const { return engine_.isValid(); }
+	const libcamera::Size &size() const { return engine_.size(); }
+
+	/*
+	 * Producer side: begin() returns false while a pair is in flight.
+	 * Otherwise fill both GRAY8 inputs (stride() bytes per row) and
+	 * commit().
+	 */
+	bool begin();
+	uint8_t *input(unsigned int eye) { return input_[eye]; }
+	unsigned int stride() const { return engine_.size().width; }
+	void commit(uint64_t timestamp);
+
+	Stats stats() const;
+
+	/* The matching thread, and the workers of its pool */
+	std::thread &thread() { return thread_; }
+	ThreadPool &pool() { return pool_; }
+
+private:
+	LIBCAMERA_DISABLE_COPY(DepthWorker)
+
+	void run();
+
+	DisparityEngine engine_;
+	ThreadPool pool_;
+	Handler handler_;
+
+	std::unique_ptr<uint8_t[]> storage_;
+	uint8_t *input_[2] = {};
+	uint16_t *disparity_ = nullptr;
+	uint64_t timestamp_ = 0;
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	bool pending_ = false;
+	bool stop_ = false;
+	std::atomic<bool> busy_{ false };
+
+	std::atomic<uint64_t> computed_{ 0 };
+	std::atomic<uint64_t> skipped_{ 0 };
+	std::atomic<uint64_t> lastDuration_{ 0 };
+
+	std::thread thread_;
+};
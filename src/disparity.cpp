@@ -0,0 +1,457 @@
+/*
+ * Disparity from rectified grayscale stereo pairs
+ */
+
+#include "disparity.h"
+
+#include <algorithm>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "thread_pool.h"
+
+using namespace libcamera;
+
+namespace {
+
+constexpr int CensusRadiusX = 4;
+constexpr int CensusRadiusY = 3;
+/* 9x7 window less the centre pixel */
+constexpr unsigned int MaxCost = 62;
+
+/*
+ * Per-thread work buffers, sized on first use. Every band is processed by a
+ * single thread, so nothing here is shared.
+ */
+struct Scratch {
+	std::vector<uint8_t> cost;
+	/* Block matching: ring of cost rows, column sums and window sums */
+	std::vector<uint8_t> ring;
+	std::vector<uint16_t> columns;
+	std::vector<uint16_t> window;
+	/* SGM: previous and current row of the three paths from above */
+	std::vector<uint16_t> paths[2][3];
+	std::vector<uint16_t> mins[2][3];
+	/* SGM: left and right paths at the previous and current pixel */
+	std::vector<uint16_t> along;
+	std::vector<uint16_t> sums;
+};
+
+thread_local Scratch scratch;
+
+template<typename T>
+T *resized(std::vector<T> &buffer, size_t size)
+{
+	if (buffer.size() < size)
+		buffer.resize(size);
+	return buffer.data();
+}
+
+/*
+ * One step of the SGM recurrence along a path:
+ *
+ *   L(d) = C(d) + min(P(d), P(d - 1) + p1, P(d + 1) + p1, min(P) + p2) - min(P)
+ *
+ * with P the path's costs at the previous pixel. Returns min(L). Without a
+ * previous pixel (prev == nullptr) the path starts over at L = C.
+ */
+uint16_t aggregateScalar(const uint8_t *cost, const uint16_t *prev, uint16_t prevMin,
+			 uint16_t *out, unsigned int disparities,
+			 unsigned int p1, unsigned int p2)
+{
+	uint16_t min = 0xffff;
+
+	for (unsigned int d = 0; d < disparities; ++d) {
+		unsigned int l = cost[d];
+
+		if (prev) {
+			unsigned int best = std::min<unsigned int>(prev[d], prevMin + p2);
+			if (d > 0)
+				best = std::min(best, prev[d - 1] + p1);
+			if (d + 1 < disparities)
+				best = std::min(best, prev[d + 1] + p1);
+			l += best - prevMin;
+		}
+
+		out[d] = l;
+		min = std::min<uint16_t>(min, l);
+	}
+
+	return min;
+}
+
+#if defined(__ARM_NEON)
+
+/* Eight disparities per vector, neighbours come from the adjacent vectors */
+uint16_t aggregateNeon(const uint8_t *cost, const uint16_t *prev, uint16_t prevMin,
+		       uint16_t *out, unsigned int disparities,
+		       unsigned int p1, unsigned int p2)
+{
+	uint16x8_t min = vdupq_n_u16(0xffff);
+
+	if (!prev) {
+		for (unsigned int d = 0; d < disparities; d += 8) {
+			uint16x8_t l = vmovl_u8(vld1_u8(cost + d));
+			vst1q_u16(out + d, l);
+			min = vminq_u16(min, l);
+		}
+	} else {
+		const uint16x8_t inf = vdupq_n_u16(0xffff);
+		const uint16x8_t penalty1 = vdupq_n_u16(p1);
+		const uint16x8_t minPrev = vdupq_n_u16(prevMin);
+		const uint16x8_t jump = vdupq_n_u16(prevMin + p2);
+
+		uint16x8_t before = inf;
+		uint16x8_t current = vld1q_u16(prev);
+
+		for (unsigned int d = 0; d < disparities; d += 8) {
+			uint16x8_t after = d + 8 < disparities ? vld1q_u16(prev + d + 8) : inf;
+
+			uint16x8_t lower = vextq_u16(before, current, 7);
+			uint16x8_t upper = vextq_u16(current, after, 1);
+			uint16x8_t best = vqaddq_u16(vminq_u16(lower, upper), penalty1);
+			best = vminq_u16(vminq_u16(best, current), jump);
+
+			uint16x8_t l = vaddq_u16(vmovl_u8(vld1_u8(cost + d)),
+						 vsubq_u16(best, minPrev));
+			vst1q_u16(out + d, l);
+			min = vminq_u16(min, l);
+
+			before = current;
+			current = after;
+		}
+	}
+
+	uint16x4_t m = vmin_u16(vget_low_u16(min), vget_high_u16(min));
+	m = vpmin_u16(m, m);
+	m = vpmin_u16(m, m);
+	return vget_lane_u16(m, 0);
+}
+
+#endif /* __ARM_NEON */
+
+inline uint16_t aggregate(const uint8_t *cost, const uint16_t *prev, uint16_t prevMin,
+			  uint16_t *out, unsigned int disparities,
+			  unsigned int p1, unsigned int p2)
+{
+#if defined(__ARM_NEON)
+	return aggregateNeon(cost, prev, prevMin, out, disparities, p1, p2);
+#else
+	return aggregateScalar(cost, prev, prevMin, out, disparities, p1, p2);
+#endif
+}
+
+inline void accumulate(uint16_t *sum, const uint16_t *values, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+		sum[i] += values[i];
+}
+
+} /* namespace */
+
+DisparityEngine::DisparityEngine(const Config &config, const Size &size)
+	: config_(config), size_(size)
+{
+	valid_ = config.maxDisparity >= 16 && config.maxDisparity % 16 == 0 &&
+		 config.blockSize % 2 == 1 && config.blockSize <= 31 &&
+		 config.p1 < config.p2 && config.p2 <= 1000 &&
+		 size.width > config.maxDisparity &&
+		 size.height > 2 * CensusRadiusY;
+	if (!valid_)
+		return;
+
+	for (std::vector<uint64_t> &census : census_)
+		census.resize(static_cast<size_t>(size.width) * size.height);
+}
+
+/*
+ * Bit set for every neighbour darker than the centre, coordinates clamped
+ * at the image edges.
+ */
+void DisparityEngine::census(const uint8_t *src, unsigned int stride,
+			     uint64_t *dst, unsigned int y0, unsigned int y1) const
+{
+	const int width = size_.width;
+	const int height = size_.height;
+
+	for (int y = y0; y < static_cast<int>(y1); ++y) {
+		const uint8_t *rows[2 * CensusRadiusY + 1];
+		for (int dy = -CensusRadiusY; dy <= CensusRadiusY; ++dy)
+			rows[dy + CensusRadiusY] = src + std::clamp(y + dy, 0, height - 1) *
+							 static_cast<size_t>(stride);
+
+		uint64_t *out = dst + static_cast<size_t>(y) * width;
+		const uint8_t *centre = rows[CensusRadiusY];
+
+		for (int x = 0; x < width; ++x) {
+			const uint8_t c = centre[x];
+			uint64_t bits = 0;
+
+			/* Only the edge columns need clamping */
+			if (x >= CensusRadiusX && x < width - CensusRadiusX) {
+				for (int dy = 0; dy < 2 * CensusRadiusY + 1; ++dy) {
+					const uint8_t *row = rows[dy] + x - CensusRadiusX;
+
+					for (int dx = 0; dx < 2 * CensusRadiusX + 1; ++dx) {
+						if (dy != CensusRadiusY || dx != CensusRadiusX)
+							bits = bits << 1 | (row[dx] < c);
+					}
+				}
+
+				out[x] = bits;
+				continue;
+			}
+
+			for (int dy = 0; dy < 2 * CensusRadiusY + 1; ++dy) {
+				const uint8_t *row = rows[dy];
+
+				for (int dx = -CensusRadiusX; dx <= CensusRadiusX; ++dx) {
+					if (dy == CensusRadiusY && dx == 0)
+						continue;
+
+					const int nx = std::clamp(x + dx, 0, width - 1);
+					bits = bits << 1 | (row[nx] < c);
+				}
+			}
+
+			out[x] = bits;
+		}
+	}
+}
+
+/*
+ * Costs of row y laid out disparity-major per pixel. Disparities reaching
+ * beyond the left edge of the right image get the maximum cost.
+ */
+void DisparityEngine::costRow(unsigned int y, uint8_t *cost) const
+{
+	const unsigned int width = size_.width;
+	const unsigned int disparities = config_.maxDisparity;
+	const uint64_t *left = census_[0].data() + static_cast<size_t>(y) * width;
+	const uint64_t *right = census_[1].data() + static_cast<size_t>(y) * width;
+
+	for (unsigned int x = 0; x < width; ++x) {
+		uint8_t *c = cost + static_cast<size_t>(x) * disparities;
+		const unsigned int valid = std::min(x + 1, disparities);
+		unsigned int d = 0;
+
+		for (; d < valid; ++d)
+			c[d] = __builtin_popcountll(left[x] ^ right[x - d]);
+		for (; d < disparities; ++d)
+			c[d] = MaxCost;
+	}
+}
+
+/*
+ * Winner takes all, refused when another disparity (other than the direct
+ * neighbours) comes within the uniqueness margin. The minimum is refined
+ * by fitting a parabola through its neighbours.
+ */
+void DisparityEngine::selectRow(const uint16_t *costs, uint16_t *out) const
+{
+	const unsigned int disparities = config_.maxDisparity;
+	const unsigned int margin = 100 + config_.uniqueness;
+
+	for (unsigned int x = 0; x < size_.width; ++x) {
+		const uint16_t *c = costs + static_cast<size_t>(x) * disparities;
+		const unsigned int range = std::min(x + 1, disparities);
+
+		unsigned int best = 0;
+		for (unsigned int d = 1; d < range; ++d) {
+			if (c[d] < c[best])
+				best = d;
+		}
+
+		bool unique = true;
+		for (unsigned int d = 0; d < range && unique; ++d) {
+			if (d + 1 < best || d > best + 1)
+				unique = c[d] * 100 > c[best] * margin;
+		}
+
+		if (!unique) {
+			out[x] = Invalid;
+			continue;
+		}
+
+		int value = best << SubpixelBits;
+		if (best > 0 && best + 1 < range) {
+			const int before = c[best - 1];
+			const int after = c[best + 1];
+			const int denominator = 2 * (before + after - 2 * c[best]);
+			if (denominator > 0)
+				value += (before - after) * (1 << SubpixelBits) / denominator;
+		}
+
+		out[x] = value;
+	}
+}
+
+void DisparityEngine::matchBand(unsigned int band, uint16_t *disparity,
+				unsigned int stride) const
+{
+	const unsigned int width = size_.width;
+	const int height = size_.height;
+	const unsigned int disparities = config_.maxDisparity;
+	const size_t rowCosts = static_cast<size_t>(width) * disparities;
+	const int radius = config_.blockSize / 2;
+	const int y0 = band * BandRows;
+	const int y1 = std::min<int>(y0 + BandRows, height);
+
+	uint8_t *ring = resized(scratch.ring, rowCosts * config_.blockSize);
+	uint16_t *columns = resized(scratch.columns, rowCosts);
+	uint16_t *window = resized(scratch.window, rowCosts);
+
+	/*
+	 * Column sums over the window rows, edge rows repeated. The ring keeps
+	 * the cost rows of the window so that each one is computed once.
+	 */
+	std::fill(columns, columns + rowCosts, 0);
+	for (int k = -radius; k <= radius; ++k) {
+		uint8_t *cost = ring + (k + radius) * rowCosts;
+		costRow(std::clamp(y0 + k, 0, height - 1), cost);
+		for (size_t i = 0; i < rowCosts; ++i)
+			columns[i] += cost[i];
+	}
+
+	for (int y = y0; y < y1; ++y) {
+		if (y > y0) {
+			/* The slot of row y - radius - 1 takes row y + radius */
+			uint8_t *cost = ring + ((y - y0 + 2 * radius) % config_.blockSize) * rowCosts;
+			for (size_t i = 0; i < rowCosts; ++i)
+				columns[i] -= cost[i];
+			costRow(std::clamp(y + radius, 0, height - 1), cost);
+			for (size_t i = 0; i < rowCosts; ++i)
+				columns[i] += cost[i];
+		}
+
+		/* Sliding window along the row, edge columns repeated */
+		uint16_t *sum = window;
+		std::fill(sum, sum + disparities, 0);
+		for (int k = -radius; k <= radius; ++k)
+			accumulate(sum, columns + std::clamp<int>(k, 0, width - 1) * disparities,
+				   disparities);
+
+		for (unsigned int x = 1; x < width; ++x) {
+			const uint16_t *in = columns + std::min<int>(x + radius, width - 1) * disparities;
+			const uint16_t *out = columns + std::max<int>(x - radius - 1, 0) * disparities;
+			const uint16_t *prev = window + (x - 1) * disparities;
+			uint16_t *next = window + x * disparities;
+
+			for (unsigned int d = 0; d < disparities; ++d)
+				next[d] = prev[d] + in[d] - out[d];
+		}
+
+		selectRow(window, disparity + static_cast<size_t>(y) * stride);
+	}
+}
+
+void DisparityEngine::sgmBand(unsigned int band, uint16_t *disparity,
+			      unsigned int stride) const
+{
+	const unsigned int width = size_.width;
+	const unsigned int disparities = config_.maxDisparity;
+	const size_t rowCosts = static_cast<size_t>(width) * disparities;
+	const unsigned int p1 = config_.p1;
+	const unsigned int p2 = config_.p2;
+	const unsigned int y0 = band * BandRows;
+	const unsigned int y1 = std::min(y0 + BandRows, size_.height);
+	const unsigned int start = y0 > SgmMargin ? y0 - SgmMargin : 0;
+
+	uint8_t *cost = resized(scratch.cost, rowCosts);
+	uint16_t *along[2];
+	along[0] = resized(scratch.along, 2 * disparities);
+	along[1] = along[0] + disparities;
+	uint16_t *sums = resized(scratch.sums, rowCosts);
+	uint16_t *paths[2][3];
+	uint16_t *mins[2][3];
+	for (unsigned int r = 0; r < 2; ++r) {
+		for (unsigned int p = 0; p < 3; ++p) {
+			paths[r][p] = resized(scratch.paths[r][p], rowCosts);
+			mins[r][p] = resized(scratch.mins[r][p], width);
+		}
+	}
+
+	for (unsigned int y = start; y < y1; ++y) {
+		const unsigned int cur = (y - start) & 1;
+		const unsigned int prv = cur ^ 1;
+		const bool first = y == start;
+
+		costRow(y, cost);
+
+		/* Left to right, with the three paths from the row above */
+		uint16_t alongMin = 0;
+		for (unsigned int x = 0; x < width; ++x) {
+			const uint8_t *c = cost + static_cast<size_t>(x) * disparities;
+			uint16_t *sum = sums + static_cast<size_t>(x) * disparities;
+
+			uint16_t *l = along[x & 1];
+			alongMin = aggregate(c, x ? along[~x & 1] : nullptr, alongMin, l,
+					     disparities, p1, p2);
+			std::copy(l, l + disparities, sum);
+
+			/* Up-left, up and up-right neighbours on the previous row */
+			for (unsigned int p = 0; p < 3; ++p) {
+				const int px = static_cast<int>(x) + static_cast<int>(p) - 1;
+				const bool inside = !first && px >= 0 && px < static_cast<int>(width);
+				uint16_t *out = paths[cur][p] + static_cast<size_t>(x) * disparities;
+
+				mins[cur][p][x] = aggregate(c,
+					inside ? paths[prv][p] + static_cast<size_t>(px) * disparities : nullptr,
+					inside ? mins[prv][p][px] : 0, out, disparities, p1, p2);
+				accumulate(sum, out, disparities);
+			}
+		}
+
+		/* Right to left */
+		for (unsigned int x = width; x-- > 0;) {
+			const uint8_t *c = cost + static_cast<size_t>(x) * disparities;
+
+			uint16_t *l = along[x & 1];
+			alongMin = aggregate(c, x + 1 < width ? along[~x & 1] : nullptr,
+					     alongMin, l, disparities, p1, p2);
+			accumulate(sums + static_cast<size_t>(x) * disparities, l,
+				   disparities);
+		}
+
+		if (y >= y0)
+			selectRow(sums, disparity + static_cast<size_t>(y) * stride);
+	}
+}
+
+void DisparityEngine::compute(const uint8_t *left, unsigned int leftStride,
+			      const uint8_t *right, unsigned int rightStride,
+			      uint16_t *disparity, unsigned int disparityStride,
+			      ThreadPool *pool)
+{
+	if (!valid_)
+		return;
+
+	const unsigned int bands = (size_.height + BandRows - 1) / BandRows;
+	auto run = [&](unsigned int tasks, const ThreadPool::Task &task) {
+		if (pool) {
+			pool->run(tasks, task);
+			return;
+		}
+		for (unsigned int i = 0; i < tasks; ++i)
+			task(i);
+	};
+
+	/* Census of both images first, matching reads rows across bands */
+	run(2 * bands, [&](unsigned int task) {
+		const unsigned int eye = task / bands;
+		const unsigned int y0 = (task % bands) * BandRows;
+		const unsigned int y1 = std::min(y0 + BandRows, size_.height);
+
+		census(eye ? right : left, eye ? rightStride : leftStride,
+		       census_[eye].data(), y0, y1);
+	});
+
+	run(bands, [&](unsigned int band) {
+		if (config_.mode == Mode::BlockMatching)
+			matchBand(band, disparity, disparityStride);
+		else
+			sgmBand(band, disparity, disparityStride);
+	});
+}
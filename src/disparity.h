@@ -0,0 +1,88 @@
+/*
+ * Disparity from rectified grayscale stereo pairs
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/geometry.h>
+
+class ThreadPool;
+
+/*
+ * Matching costs are Hamming distances between 9x7 census transforms, which
+ * are robust to the gain and exposure differences of two sensors. Block
+ * matching sums them over a square window; semi-global matching aggregates
+ * them along five paths (left, right, and the three from the row above).
+ *
+ * Both modes work on bands of rows, one ThreadPool task each. The SGM paths
+ * coming from above restart at every band after SgmMargin rows of warm-up,
+ * which keeps bands independent at a small cost in accuracy.
+ */
+class DisparityEngine
+{
+public:
+	enum class Mode {
+		BlockMatching,
+		SemiGlobal,
+	};
+
+	struct Config {
+		Mode mode = Mode::SemiGlobal;
+		/* Disparities searched, a multiple of 16 */
+		unsigned int maxDisparity = 64;
+		/* Odd window size of block matching */
+		unsigned int blockSize = 7;
+		/* SGM penalties for disparity changes of one and of more */
+		unsigned int p1 = 10;
+		unsigned int p2 = 120;
+		/* Margin in percent by which the best cost must win */
+		unsigned int uniqueness = 10;
+	};
+
+	/* Disparities are stored with 4 fractional bits */
+	static constexpr unsigned int SubpixelBits = 4;
+	static constexpr uint16_t Invalid = 0xffff;
+
+	static constexpr unsigned int BandRows = 64;
+	static constexpr unsigned int SgmMargin = 16;
+
+	DisparityEngine(const Config &config, const libcamera::Size &size);
+
+	bool isValid() const { return valid_; }
+
+	const Config &config() const { return config_; }
+	const libcamera::Size &size() const { return size_; }
+
+	/*
+	 * Disparity of every left image pixel. Strides are in bytes for the
+	 * images and in elements for the disparity map.
+	 */
+	void compute(const uint8_t *left, unsigned int leftStride,
+		     const uint8_t *right, unsigned int rightStride,
+		     uint16_t *disparity, unsigned int disparityStride,
+		     ThreadPool *pool = nullptr);
+
+private:
+	LIBCAMERA_DISABLE_COPY(DisparityEngine)
+
+	void census(const uint8_t *src, unsigned int stride, uint64_t *dst,
+		    unsigned int y0, unsigned int y1) const;
+	void costRow(unsigned int y, uint8_t *cost) const;
+	void selectRow(const uint16_t *costs, uint16_t *out) const;
+
+	void matchBand(unsigned int band, uint16_t *disparity,
+		       unsigned int stride) const;
+	void sgmBand(unsigned int band, uint16_t *disparity,
+		     unsigned int stride) const;
+
+	Config config_;
+	libcamera::Size size_;
+	bool valid_;
+
+	std::vector<uint64_t> census_[2];
+};
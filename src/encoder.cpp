@@ -0,0 +1,163 @@
+/*
+ * H.264 encoder backends of the streaming pipeline
+ */
+
+#include "encoder.h"
+
+#include <iostream>
+#include <string.h>
+
+namespace {
+
+const char *factoryName(EncoderBackend backend)
+{
+	switch (backend) {
+	case EncoderBackend::V4l2:
+		return "v4l2h264enc";
+	case EncoderBackend::V4l2Stateless:
+		return "v4l2slh264enc";
+	case EncoderBackend::X264:
+	case EncoderBackend::Auto:
+		break;
+	}
+
+	return "x264enc";
+}
+
+/*
+ * The V4L2 elements register whenever the plugin is installed, so only
+ * reaching READY (which opens the device) proves the encoder is usable.
+ */
+bool isAvailable(EncoderBackend backend)
+{
+	GstElement *element = gst_element_factory_make(factoryName(backend), nullptr);
+	if (!element)
+		return false;
+
+	GstStateChangeReturn ret = gst_element_set_state(element, GST_STATE_READY);
+	gst_element_set_state(element, GST_STATE_NULL);
+	gst_object_unref(element);
+
+	return ret != GST_STATE_CHANGE_FAILURE;
+}
+
+const char *const x264Formats[] = { "I420", "YV12", "NV12", nullptr };
+const char *const v4l2Formats[] = { "I420", "YV12", "NV12", "NV21", nullptr };
+
+} /* namespace */
+
+const char *encoderName(EncoderBackend backend)
+{
+	if (backend == EncoderBackend::Auto)
+		return "auto";
+
+	return factoryName(backend);
+}
+
+EncoderBackend probeEncoder(EncoderBackend requested)
+{
+	if (requested != EncoderBackend::Auto) {
+		if (isAvailable(requested))
+			return requested;
+
+		std::cerr << "Encoder " << encoderName(requested)
+			  << " is not available, falling back" << std::endl;
+	}
+
+	for (EncoderBackend backend : { EncoderBackend::V4l2,
+					EncoderBackend::V4l2Stateless }) {
+		if (backend != requested && isAvailable(backend))
+			return backend;
+	}
+
+	return EncoderBackend::X264;
+}
+
+bool encoderAccepts(EncoderBackend backend, const char *gstFormat)
+{
+	if (!gstFormat)
+		return false;
+
+	const char *const *formats = backend == EncoderBackend::V4l2
+				   ? v4l2Formats : x264Formats;
+	for (; *formats; ++formats) {
+		if (!strcmp(*formats, gstFormat))
+			return true;
+	}
+
+	return false;
+}
+
+std::string encoderPipeline(EncoderBackend backend, const EncoderConfig &config,
+			    bool dmabufInput, const char *name)
+{
+	const std::string element = std::string(factoryName(backend)) + " name=" + name;
+	std::string desc;
+
+	switch (backend) {
+	case EncoderBackend::V4l2:
+		desc = element + " extra-controls=\"controls"
+		       ",repeat_sequence_header=1"
+		       ",video_bitrate=" + std::to_string(config.bitrate * 1000);
+		if (config.gop)
+			desc += ",h264_i_frame_period=" + std::to_string(config.gop);
+		desc += "\"";
+		if (dmabufInput)
+			desc += " output-io-mode=dmabuf-import";
+		break;
+
+	case EncoderBackend::V4l2Stateless:
+		/* Rate control of stateless encoders is left at its defaults */
+		desc = element;
+		break;
+
+	case EncoderBackend::X264:
+	case EncoderBackend::Auto:
+		desc = element + " tune=zerolatency speed-preset=ultrafast"
+		       " bitrate=" + std::to_string(config.bitrate);
+		if (config.gop)
+			desc += " key-int-max=" + std::to_string(config.gop);
+		if (config.threads)
+			desc += " threads=" + std::to_string(config.threads);
+		break;
+	}
+
+	/* Every backend negotiates its profile from the downstream caps */
+	desc += " ! video/x-h264";
+	if (!config.profile.empty())
+		desc += ",profile=" + config.profile;
+	/* The Raspberry Pi encoder fails to negotiate without a level */
+	if (backend == EncoderBackend::V4l2)
+		desc += ",level=(string)4";
+
+	return desc;
+}
+
+bool setEncoderBitrate(GstElement *encoder, EncoderBackend backend, unsigned int bitrate)
+{
+	switch (backend) {
+	case EncoderBackend::V4l2: {
+		/* The element applies its extra controls as soon as they are set */
+		GstStructure *controls = nullptr;
+		g_object_get(encoder, "extra-controls", &controls, NULL);
+		if (!controls)
+			controls = gst_structure_new_empty("controls");
+		gst_structure_set(controls, "video_bitrate", G_TYPE_INT,
+				  static_cast<gint>(bitrate * 1000), NULL);
+		g_object_set(encoder, "extra-controls", controls, NULL);
+		gst_structure_free(controls);
+		return true;
+	}
+
+	case EncoderBackend::V4l2Stateless:
+		return false;
+
+	case EncoderBackend::X264:
+	case EncoderBackend::Auto:
+		/* x264enc reconfigures for the new bitrate on the next frame */
+		g_object_set(encoder, "bitrate", static_cast<guint>(bitrate), NULL);
+		return true;
+	}
+
+	return false;
+}
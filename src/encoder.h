@@ -0,0 +1,55 @@
+/*
+ * H.264 encoder backends of the streaming pipeline
+ */
+
+#pragma once
+
+#include <string>
+
+#include <gst/gst.h>
+
+enum class EncoderBackend {
+	/* First available of V4l2, V4l2Stateless and X264 */
+	Auto,
+	V4l2,
+	V4l2Stateless,
+	X264,
+};
+
+struct EncoderConfig {
+	EncoderBackend backend = EncoderBackend::Auto;
+	/* kbit/s */
+	unsigned int bitrate = 2048;
+	/* Frames between IDR frames, 0 for the encoder default */
+	unsigned int gop = 0;
+	/* H.264 profile (baseline, main, high), empty for the encoder default */
+	std::string profile;
+	/* Encoder threads of x264, 0 for one and a half per allowed CPU */
+	unsigned int threads = 0;
+};
+
+const char *encoderName(EncoderBackend backend);
+
+/*
+ * Return the requested backend if it can be instantiated, otherwise the
+ * first one that can, falling back to X264. Needs gst_init().
+ */
+EncoderBackend probeEncoder(EncoderBackend requested);
+
+/* Whether the encoder takes raw video of the GStreamer format directly */
+bool encoderAccepts(EncoderBackend backend, const char *gstFormat);
+
+/*
+ * Pipeline fragment from encoder to H.264 caps, taking raw video in and
+ * producing a stream ready for rtph264pay. The encoder element is named
+ * \a name. \a dmabufInput tells that raw buffers arrive as camera dmabufs
+ * with nothing in between, which hardware encoders can import.
+ */
+std::string encoderPipeline(EncoderBackend backend, const EncoderConfig &config,
+			    bool dmabufInput, const char *name = "encoder");
+
+/*
+ * Change the bitrate of a running "encoder" element, in kbit/s. Returns
+ * false for backends without rate control.
+ */
+bool setEncoderBitrate(GstElement *encoder, EncoderBackend backend, unsigned int bitrate);
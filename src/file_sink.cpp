@@ -0,0 +1,260 @@
+/*
+ * Raw frame recording to disk off the capture path
+ */
+
+#include "file_sink.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+
+size_t alignUp(size_t value)
+{
+	return (value + FileSink::Alignment - 1) & ~(FileSink::Alignment - 1);
+}
+
+} /* namespace */
+
+FileSink::FileSink(unsigned int slots, size_t slotSize, FrameArena *arena)
+	: ring_(slots, slotSize, FrameRing::DropPolicy::DropNewest, arena)
+{
+}
+
+FileSink::~FileSink()
+{
+	close();
+}
+
+int FileSink::open(const std::string &path, const FrameLayout &layout,
+		   const FrameLayout *right)
+{
+	if (fd_ >= 0)
+		return -EBUSY;
+
+	/* Not every filesystem takes O_DIRECT, tmpfs for instance */
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+	if (fd_ < 0 && errno == EINVAL)
+		fd_ = ::open(path.c_str(), flags, 0644);
+	if (fd_ < 0) {
+		int ret = -errno;
+		std::cerr << "Failed to open " << path << ": " << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	const std::string indexPath = path + ".idx";
+	index_ = fopen(indexPath.c_str(), "wbe");
+	if (!index_) {
+		int ret = -errno;
+		std::cerr << "Failed to open " << indexPath << ": " << strerror(-ret) << std::endl;
+		::close(fd_);
+		fd_ = -1;
+		return ret;
+	}
+
+	RecordingHeader header = {};
+	memcpy(header.magic, RecordingMagic, sizeof(header.magic));
+	header.version = RecordingVersion;
+	header.alignment = Alignment;
+	header.layout[0] = recordingLayout(&layout);
+	header.layout[1] = recordingLayout(right);
+	fwrite(&header, sizeof(header), 1, index_);
+
+	if (posix_memalign(reinterpret_cast<void **>(&chunk_), Alignment, ChunkSize)) {
+		fclose(index_);
+		index_ = nullptr;
+		::close(fd_);
+		fd_ = -1;
+		return -ENOMEM;
+	}
+
+	fourcc_ = layout.format.fourcc();
+	fill_ = 0;
+	written_ = 0;
+	allocated_ = 0;
+	preallocate_ = true;
+	stop_ = false;
+	pending_ = false;
+	failed_.store(false, std::memory_order_relaxed);
+
+	thread_ = std::thread(&FileSink::run, this);
+	return 0;
+}
+
+/* Writes out every frame still queued before closing the files */
+void FileSink::close()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_one();
+	thread_.join();
+
+	flushChunk();
+
+	/* Give back what fallocate() reserved beyond the last frame */
+	if (ftruncate(fd_, written_) < 0)
+		std::cerr << "Failed to truncate recording: " << strerror(errno) << std::endl;
+
+	::close(fd_);
+	fd_ = -1;
+	fclose(index_);
+	index_ = nullptr;
+	free(chunk_);
+	chunk_ = nullptr;
+}
+
+FrameSlot *FileSink::begin()
+{
+	if (fd_ < 0 || failed_.load(std::memory_order_relaxed)) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	return ring_.beginWrite();
+}
+
+void FileSink::commit(FrameSlot *slot)
+{
+	ring_.commitWrite(slot);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		pending_ = true;
+	}
+	wake_.notify_one();
+}
+
+void FileSink::abort(FrameSlot *slot)
+{
+	ring_.abortWrite(slot);
+}
+
+FileSink::Stats FileSink::stats() const
+{
+	return { frames_.load(std::memory_order_relaxed),
+		 ring_.stats().dropped + dropped_.load(std::memory_order_relaxed),
+		 bytes_.load(std::memory_order_relaxed) };
+}
+
+void FileSink::run()
+{
+	for (;;) {
+		bool stop;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait(lock, [this] { return pending_ || stop_; });
+			pending_ = false;
+			stop = stop_;
+		}
+
+		while (FrameSlot *slot = ring_.beginRead()) {
+			if (!failed_.load(std::memory_order_relaxed))
+				writeFrame(*slot);
+			ring_.endRead(slot);
+		}
+
+		if (stop)
+			return;
+	}
+}
+
+void FileSink::writeFrame(const FrameSlot &slot)
+{
+	RecordingEntry entry;
+	entry.timestamp = slot.timestamp;
+	entry.offset = written_ + fill_;
+	entry.size = slot.bytesused;
+	entry.rightOffset = slot.rightOffset;
+	entry.sequence = slot.sequence;
+	entry.fourcc = fourcc_;
+
+	append(slot.data.data(), slot.bytesused);
+
+	/* Pad to the next frame, chunks are a multiple of the alignment */
+	const size_t padded = alignUp(fill_);
+	memset(chunk_ + fill_, 0, padded - fill_);
+	fill_ = padded;
+	if (fill_ == ChunkSize)
+		flushChunk();
+
+	if (failed_.load(std::memory_order_relaxed))
+		return;
+
+	fwrite(&entry, sizeof(entry), 1, index_);
+	frames_.fetch_add(1, std::memory_order_relaxed);
+	bytes_.fetch_add(slot.bytesused, std::memory_order_relaxed);
+}
+
+void FileSink::append(const uint8_t *data, size_t size)
+{
+	while (size) {
+		const size_t length = std::min(size, ChunkSize - fill_);
+
+		memcpy(chunk_ + fill_, data, length);
+		fill_ += length;
+		data += length;
+		size -= length;
+
+		if (fill_ == ChunkSize)
+			flushChunk();
+	}
+}
+
+/* Only ever called with whole alignment units in the chunk */
+void FileSink::flushChunk()
+{
+	if (!fill_ || failed_.load(std::memory_order_relaxed)) {
+		fill_ = 0;
+		return;
+	}
+
+	/*
+	 * Reserve space well ahead of the writes, so that block allocation
+	 * stays out of the write path. Filesystems without fallocate() (FAT
+	 * on removable media) just allocate as they go.
+	 */
+	if (preallocate_ && written_ + static_cast<off_t>(fill_) > allocated_) {
+		if (fallocate(fd_, 0, allocated_, PreallocateStep) == 0)
+			allocated_ += PreallocateStep;
+		else if (errno == EOPNOTSUPP)
+			preallocate_ = false;
+		else
+			return fail(errno);
+	}
+
+	size_t done = 0;
+	while (done < fill_) {
+		ssize_t ret = pwrite(fd_, chunk_ + done, fill_ - done, written_ + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return fail(errno);
+		}
+		done += ret;
+	}
+
+	written_ += fill_;
+	fill_ = 0;
+
+	/* Keep the index on disk in step with the data it describes */
+	fflush(index_);
+}
+
+void FileSink::fail(int error)
+{
+	std::cerr << "Recording stopped: " << strerror(error) << std::endl;
+	failed_.store(true, std::memory_order_relaxed);
+	fill_ = 0;
+}
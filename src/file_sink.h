@@ -0,0 +1,96 @@
+/*
+ * Raw frame recording to disk off the capture path
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+#include <libcamera/base/class.h>
+
+#include "frame_layout.h"
+#include "frame_ring.h"
+#include "recording.h"
+
+/*
+ * Frames are copied into a ring of their own on the capture side and written
+ * by a dedicated thread, so that disk I/O never holds up the camera. The
+ * writer gathers frames into large aligned chunks written with O_DIRECT
+ * where the filesystem supports it, and extends the file with fallocate()
+ * ahead of the writes. When the disk falls behind, the ring fills up and new
+ * frames are dropped rather than queued frames.
+ */
+class FileSink
+{
+public:
+	struct Stats {
+		uint64_t written;
+		uint64_t dropped;
+		uint64_t bytes;
+	};
+
+	/* Slots come from \a arena, or from the heap when nullptr */
+	FileSink(unsigned int slots, size_t slotSize, FrameArena *arena = nullptr);
+	~FileSink();
+
+	/* \a right is the layout of the right eye of pairs, nullptr if none */
+	int open(const std::string &path, const FrameLayout &layout,
+		 const FrameLayout *right);
+	void close();
+
+	/*
+	 * Producer side: fill the slot (data, bytesused, rightOffset,
+	 * timestamp, sequence) and commit() it. Returns nullptr when the
+	 * frame has to be dropped.
+	 */
+	FrameSlot *begin();
+	void commit(FrameSlot *slot);
+	void abort(FrameSlot *slot);
+
+	Stats stats() const;
+
+	static constexpr size_t Alignment = 4096;
+	static constexpr size_t ChunkSize = 4 << 20;
+	static constexpr off_t PreallocateStep = 256 << 20;
+
+private:
+	LIBCAMERA_DISABLE_COPY(FileSink)
+
+	void run();
+	void writeFrame(const FrameSlot &slot);
+	void append(const uint8_t *data, size_t size);
+	void flushChunk();
+	void fail(int error);
+
+	FrameRing ring_;
+	uint32_t fourcc_ = 0;
+
+	int fd_ = -1;
+	FILE *index_ = nullptr;
+
+	uint8_t *chunk_ = nullptr;
+	size_t fill_ = 0;
+	/* Bytes written to the data file, and reserved with fallocate() */
+	off_t written_ = 0;
+	off_t allocated_ = 0;
+	bool preallocate_ = true;
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	bool pending_ = false;
+	bool stop_ = false;
+	std::atomic<bool> failed_{ false };
+
+	std::atomic<uint64_t> frames_{ 0 };
+	std::atomic<uint64_t> dropped_{ 0 };
+	std::atomic<uint64_t> bytes_{ 0 };
+
+	std::thread thread_;
+};
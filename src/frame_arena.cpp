@@ -0,0 +1,95 @@
+/*
+ * Preallocated, optionally huge-page backed memory for frame buffers
+ */
+
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <sys/mman.h>
+
+namespace {
+
+/* The default huge page size on arm64 and x86-64 */
+constexpr size_t HugePageSize = 2 << 20;
+
+size_t alignUp(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} /* namespace */
+
+FrameArena::FrameArena(bool hugePages)
+	: hugePages_(hugePages)
+{
+}
+
+FrameArena::~FrameArena()
+{
+	for (const Chunk &chunk : chunks_)
+		munmap(chunk.base, chunk.size);
+}
+
+uint8_t *FrameArena::allocate(size_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	size = alignUp(std::max<size_t>(size, 1), Alignment);
+
+	if (chunks_.empty() || chunks_.back().size - used_ < size) {
+		if (!map(std::max(size, ChunkSize)))
+			return nullptr;
+	}
+
+	uint8_t *block = chunks_.back().base + used_;
+	used_ += size;
+	allocated_ += size;
+	return block;
+}
+
+FrameArena::Stats FrameArena::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	Stats stats = { 0, allocated_, !chunks_.empty() };
+	for (const Chunk &chunk : chunks_) {
+		stats.mapped += chunk.size;
+		stats.hugePages = stats.hugePages && chunk.hugePages;
+	}
+
+	return stats;
+}
+
+/*
+ * The rest of the current chunk is abandoned, frame buffers are few and
+ * large so little is lost that way.
+ */
+bool FrameArena::map(size_t size)
+{
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *base = MAP_FAILED;
+	bool huge = false;
+
+	size = alignUp(size, HugePageSize);
+
+	if (hugePages_) {
+		base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			    flags | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+		huge = base != MAP_FAILED;
+	}
+
+	if (base == MAP_FAILED) {
+		base = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (base == MAP_FAILED)
+			return false;
+
+		/* Advise before faulting in, so that the faults take huge pages */
+		madvise(base, size, MADV_HUGEPAGE);
+		for (size_t offset = 0; offset < size; offset += Alignment)
+			static_cast<volatile uint8_t *>(base)[offset] = 0;
+	}
+
+	chunks_.push_back({ static_cast<uint8_t *>(base), size, huge });
+	used_ = 0;
+	return true;
+}
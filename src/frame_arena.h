@@ -0,0 +1,68 @@
+/*
+ * Preallocated, optionally huge-page backed memory for frame buffers
+ */
+
+#pragma once
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+/*
+ * Large buffers that live as long as the stream (ring slots, conversion and
+ * stereo intermediates, the GstBuffers of the arena pool) are carved out of
+ * a few big mappings instead of the heap. The mappings are faulted in when
+ * they are created, so no page fault or allocation is left for the frame
+ * path, and with hugePages they come from the hugetlbfs pool, which cuts TLB
+ * misses on full-frame copies. Without enough reserved huge pages (see
+ * /proc/sys/vm/nr_hugepages) the arena falls back to normal pages and asks
+ * for transparent huge pages instead.
+ *
+ * Blocks are never given back individually, only with the arena: owners that
+ * recycle memory (the arena allocator) keep their own free list. allocate()
+ * is thread-safe but meant for setup, it may map a new chunk.
+ */
+class FrameArena
+{
+public:
+	struct Stats {
+		/* Bytes mapped, and handed out (rounded up to Alignment) */
+		size_t mapped;
+		size_t allocated;
+		/* Every chunk is backed by hugetlbfs pages */
+		bool hugePages;
+	};
+
+	static constexpr size_t Alignment = 4096;
+	static constexpr size_t ChunkSize = 16 << 20;
+
+	explicit FrameArena(bool hugePages);
+	~FrameArena();
+
+	/* Returns nullptr when the memory cannot be mapped */
+	uint8_t *allocate(size_t size);
+
+	Stats stats() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY(FrameArena)
+
+	struct Chunk {
+		uint8_t *base;
+		size_t size;
+		bool hugePages;
+	};
+
+	bool map(size_t size);
+
+	const bool hugePages_;
+
+	mutable std::mutex mutex_;
+	std::vector<Chunk> chunks_;
+	/* Bytes used in the last chunk, and in all of them */
+	size_t used_ = 0;
+	size_t allocated_ = 0;
+};
@@ -0,0 +1,907 @@
+// frame_bench.cpp
+//
+// Offline benchmark of the frame handling path, no camera needed. Frames come
+// from memfd-backed libcamera FrameBuffers, filled with a synthetic pattern or
+// with raw frames recorded from the camera (--input), and go through the same
+// code as in udp_cam_libcamera_gst:
+//
+//   map        Image::fromFrameBuffer() and a copy per frame, the path before
+//              mappings were cached
+//   copy       cached Image, copy into a FrameRing slot and back out
+//   push       copy path plus a copy into an arena pool buffer pushed into appsrc
+//   zero-copy  FrameBuffer planes wrapped as dmabuf memories into appsrc
+//   convert    XRGB8888 to I420, every kernel and thread count
+//   rectify    both eyes through the Rectifier, every thread count
+//   depth      DepthEncoder on a synthetic disparity map, every codec; the
+//              map is decoded again and checked against the input once per
+//              size, a mismatch fails the run
+//
+// appsrc feeds a fakesink; push timings include draining the pipeline.
+// Each case prints one JSON object per line on stdout with ns/frame, MB/s of
+// frame data and heap allocations per frame (malloc calls from any thread,
+// counted on glibc builds only).
+//
+// Build:
+// g++ allocation_counter.cpp arena_pool.cpp convert.cpp depth_encoder.cpp frame_arena.cpp frame_bench.cpp frame_layout.cpp frame_ring.cpp image.cpp rectifier.cpp stereo_calibration.cpp thread_pool.cpp -o frame_bench -O2 \
+//   $(pkg-config --cflags --libs libcamera gstreamer-1.0 gstreamer-app-1.0 gstreamer-allocators-1.0 gstreamer-video-1.0) -pthread
+//
+// Run:
+// ./frame_bench [--formats=XRGB8888,YUV420] [--sizes=1280x720] [--cases=copy,push] [--input=FILE]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/shared_fd.h>
+#include <libcamera/formats.h>
+#include <libcamera/framebuffer.h>
+
+#include "allocation_counter.h"
+#include "arena_pool.h"
+#include "convert.h"
+#include "depth_encoder.h"
+#include "disparity.h"
+#include "frame_arena.h"
+#include "frame_layout.h"
+#include "frame_ring.h"
+#include "image.h"
+#include "rectifier.h"
+#include "stereo_calibration.h"
+#include "thread_pool.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/allocators/allocators.h>
+#include <gst/video/video.h>
+
+using namespace libcamera;
+
+// ************ Arguments ************************************************
+struct BenchOptions {
+    std::vector<PixelFormat> formats{ formats::XRGB8888, formats::YUV420, formats::NV12 };
+    std::vector<Size> sizes{ Size(640, 480), Size(1280, 720), Size(1920, 1080) };
+    std::vector<unsigned int> threads;
+    std::vector<std::string> cases{ "map", "copy", "push", "zero-copy", "convert", "rectify", "depth" };
+    unsigned int frames = 100;
+    std::string input;
+};
+
+static BenchOptions g_options;
+
+// Same number of buffers as the camera allocates, so that frames do not all
+// come from the cache
+static constexpr unsigned int NumBuffers = 4;
+
+enum {
+    OptFormats = 256,
+    OptSizes,
+    OptThreads,
+    OptCases,
+    OptFrames,
+    OptInput,
+};
+
+static const struct option longOptions[] = {
+    { "help", no_argument, nullptr, 'h' },
+    { "formats", required_argument, nullptr, OptFormats },
+    { "sizes", required_argument, nullptr, OptSizes },
+    { "threads", required_argument, nullptr, OptThreads },
+    { "cases", required_argument, nullptr, OptCases },
+    { "frames", required_argument, nullptr, OptFrames },
+    { "input", required_argument, nullptr, OptInput },
+    { nullptr, 0, nullptr, 0 },
+};
+
+static void print_usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  -h, --help           Show this help\n"
+              << "      --formats=LIST   Pixel formats (default XRGB8888,YUV420,NV12)\n"
+              << "      --sizes=LIST     Frame sizes (default 640x480,1280x720,1920x1080)\n"
+              << "      --threads=LIST   Thread counts of convert and rectify (default 1 and all cores)\n"
+              << "      --cases=LIST     map, copy, push, zero-copy, convert, rectify, depth\n"
+              << "                       (default all)\n"
+              << "      --frames=N       Frames timed per case (default 100)\n"
+              << "      --input=FILE     Raw frames in the layout of the single format and size\n"
+              << "                       given, instead of a synthetic pattern\n";
+}
+
+static std::vector<std::string> split_list(const char *arg)
+{
+    std::vector<std::string> items;
+    std::istringstream list(arg);
+    std::string item;
+
+    while (std::getline(list, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+
+    return items;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "h", longOptions, nullptr)) != -1) {
+        switch (opt) {
+        case OptFormats:
+            g_options.formats.clear();
+            for (const std::string &name : split_list(optarg)) {
+                PixelFormat format = PixelFormat::fromString(name);
+                if (!format.isValid() || !gstFormatName(format)) {
+                    std::cerr << "Unsupported pixel format '" << name << "'\n";
+                    return -EINVAL;
+                }
+                g_options.formats.push_back(format);
+            }
+            break;
+        case OptSizes:
+            g_options.sizes.clear();
+            for (const std::string &item : split_list(optarg)) {
+                unsigned int width, height;
+                char end;
+
+                if (sscanf(item.c_str(), "%ux%u%c", &width, &height, &end) != 2 ||
+                    !width || !height) {
+                    std::cerr << "Invalid size '" << item << "'\n";
+                    return -EINVAL;
+                }
+                g_options.sizes.emplace_back(width, height);
+            }
+            break;
+        case OptThreads:
+            for (const std::string &item : split_list(optarg)) {
+                unsigned int threads = strtoul(item.c_str(), nullptr, 10);
+                if (!threads) {
+                    std::cerr << "Invalid thread count '" << item << "'\n";
+                    return -EINVAL;
+                }
+                g_options.threads.push_back(threads);
+            }
+            break;
+        case OptCases:
+            g_options.cases = split_list(optarg);
+            break;
+        case OptFrames:
+            g_options.frames = strtoul(optarg, nullptr, 10);
+            if (!g_options.frames) {
+                std::cerr << "Invalid frame count '" << optarg << "'\n";
+                return -EINVAL;
+            }
+            break;
+        case OptInput:
+            g_options.input = optarg;
+            break;
+        case 'h':
+        default:
+            return -EINVAL;
+        }
+    }
+
+    if (g_options.threads.empty()) {
+        g_options.threads.push_back(1);
+        unsigned int cores = std::thread::hardware_concurrency();
+        if (cores > 1)
+            g_options.threads.push_back(cores);
+    }
+
+    if (!g_options.input.empty() &&
+        (g_options.formats.size() != 1 || g_options.sizes.size() != 1)) {
+        std::cerr << "--input needs exactly one format and one size\n";
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static bool run_case(const char *name)
+{
+    for (const std::string &c : g_options.cases)
+        if (c == name)
+            return true;
+    return false;
+}
+// ************ Arguments ************************************************
+
+// ************ Frame source ************************************************
+// FrameBuffers of one memfd each, planes back to back as the camera
+// allocates them, and their cached mappings
+struct FrameSource {
+    FrameLayout layout;
+    std::vector<std::unique_ptr<FrameBuffer>> buffers;
+    ImageCache images;
+};
+
+static void fill_pattern(uint8_t *data, const FrameLayout &layout, unsigned int index)
+{
+    for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+        const PlaneLayout &plane = layout.planes[i];
+        uint8_t *row = data + plane.offset;
+
+        // Gradients with some texture, different for every buffer
+        for (unsigned int y = 0; y < plane.rows; ++y, row += plane.stride) {
+            for (unsigned int x = 0; x < plane.bytesPerLine; ++x) {
+                uint32_t hash = (x * 2654435761U) ^ (y * 40503U) ^ (index * 97U);
+                row[x] = (x + y + i * 64 + index * 8 + ((hash >> 24) & 15)) & 0xff;
+            }
+        }
+    }
+}
+
+static int create_source(const FrameLayout &layout, const std::vector<uint8_t> &recorded,
+                         FrameSource *source)
+{
+    source->layout = layout;
+
+    for (unsigned int index = 0; index < NumBuffers; ++index) {
+        int fd = memfd_create("frame_bench", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, layout.frameSize) < 0) {
+            int ret = -errno;
+            std::cerr << "Failed to create frame buffer: " << strerror(-ret) << "\n";
+            if (fd >= 0)
+                close(fd);
+            return ret;
+        }
+
+        void *data = mmap(nullptr, layout.frameSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            int ret = -errno;
+            close(fd);
+            return ret;
+        }
+
+        if (recorded.empty()) {
+            fill_pattern(static_cast<uint8_t *>(data), layout, index);
+        } else {
+            const size_t frames = recorded.size() / layout.frameSize;
+            memcpy(data, recorded.data() + (index % frames) * layout.frameSize,
+                   layout.frameSize);
+        }
+        munmap(data, layout.frameSize);
+
+        SharedFD shared(std::move(fd));
+        std::vector<FrameBuffer::Plane> planes;
+        for (const PlaneLayout &plane : layout.planes) {
+            FrameBuffer::Plane p;
+            p.fd = shared;
+            p.offset = plane.offset;
+            p.length = plane.stride * plane.rows;
+            planes.push_back(p);
+        }
+        source->buffers.push_back(std::make_unique<FrameBuffer>(planes, index));
+    }
+
+    return source->images.map(source->buffers, Image::MapMode::ReadOnly, layout);
+}
+
+static int load_recording(const FrameLayout &layout, std::vector<uint8_t> *recorded)
+{
+    std::ifstream file(g_options.input, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open " << g_options.input << "\n";
+        return -ENOENT;
+    }
+
+    recorded->assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (recorded->size() < layout.frameSize) {
+        std::cerr << g_options.input << " holds no complete " << layout.format.toString()
+                  << " " << layout.size.toString() << " frame\n";
+        return -EINVAL;
+    }
+
+    return 0;
+}
+// ************ Frame source ************************************************
+
+// ************ Measurement ************************************************
+struct Result {
+    const char *name;
+    const char *kernel = nullptr;
+    unsigned int threads = 0;
+    // depth maps: codec, scale and size of the encoded map
+    const char *codec = nullptr;
+    unsigned int scale = 0;
+    size_t encoded = 0;
+    uint64_t ns = 0;
+    uint64_t allocations = 0;
+    // frame data read per frame
+    size_t bytes = 0;
+};
+
+// Run a few untimed frames first so that caches, page tables and pipeline
+// state are warm. The optional finish step, such as draining a pipeline,
+// is part of the timed run.
+static Result measure(const char *name, size_t bytes,
+                      const std::function<void(unsigned int)> &frame,
+                      const std::function<void()> &finish = nullptr)
+{
+    const unsigned int warmup = std::min(g_options.frames, 10U);
+    for (unsigned int i = 0; i < warmup; ++i)
+        frame(i);
+
+    const uint64_t allocations = allocationCount();
+    const auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < g_options.frames; ++i)
+        frame(warmup + i);
+    if (finish)
+        finish();
+
+    const auto end = std::chrono::steady_clock::now();
+
+    Result result;
+    result.name = name;
+    result.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    result.allocations = allocationCount() - allocations;
+    result.bytes = bytes;
+    return result;
+}
+
+static void report(const FrameLayout &layout, const Result &result)
+{
+    const double frames = g_options.frames;
+    const double nsPerFrame = result.ns / frames;
+    char line[512];
+    int len;
+
+    len = snprintf(line, sizeof(line),
+                   "{\"case\":\"%s\",\"format\":\"%s\",\"width\":%u,\"height\":%u",
+                   result.name, layout.format.toString().c_str(),
+                   layout.size.width, layout.size.height);
+    if (result.kernel)
+        len += snprintf(line + len, sizeof(line) - len, ",\"kernel\":\"%s\"", result.kernel);
+    if (result.threads)
+        len += snprintf(line + len, sizeof(line) - len, ",\"threads\":%u", result.threads);
+    if (result.codec)
+        len += snprintf(line + len, sizeof(line) - len,
+                        ",\"codec\":\"%s\",\"scale\":%u,\"encoded_bytes\":%zu",
+                        result.codec, result.scale, result.encoded);
+    len += snprintf(line + len, sizeof(line) - len,
+                    ",\"frames\":%u,\"ns_per_frame\":%.0f,\"mb_per_s\":%.1f",
+                    g_options.frames, nsPerFrame,
+                    nsPerFrame > 0 ? result.bytes * 1000.0 / nsPerFrame : 0.0);
+    if (countingAllocations())
+        snprintf(line + len, sizeof(line) - len, ",\"allocs_per_frame\":%.2f}",
+                 result.allocations / frames);
+    else
+        snprintf(line + len, sizeof(line) - len, ",\"allocs_per_frame\":null}");
+
+    std::cout << line << std::endl;
+}
+// ************ Measurement ************************************************
+
+// ************ Copy path ************************************************
+// copy_request() of the application: all planes at their layout offsets
+static size_t copy_image(const Image &image, const FrameLayout &layout, uint8_t *dst)
+{
+    ImageAccess access(image, Image::AllPlanes, Image::MapMode::ReadOnly);
+    size_t end = 0;
+
+    for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+        const PlaneLayout &plane = layout.planes[i];
+        const size_t length = static_cast<size_t>(plane.stride) * plane.rows;
+
+        memcpy(dst + plane.offset, image.plane(i).data, length);
+        end = plane.offset + length;
+    }
+
+    return end;
+}
+
+static Result bench_map(FrameSource &source)
+{
+    std::vector<uint8_t> dst(source.layout.frameSize);
+
+    return measure("map", source.layout.frameSize, [&](unsigned int i) {
+        std::unique_ptr<Image> image =
+            Image::fromFrameBuffer(source.buffers[i % NumBuffers].get(),
+                                   Image::MapMode::ReadOnly);
+        if (image && !image->setLayout(source.layout))
+            copy_image(*image, source.layout, dst.data());
+    });
+}
+
+// Capture side writes a slot, push side takes it, as with --push=event
+static void ring_frame(FrameSource &source, FrameRing &ring, unsigned int i,
+                       const std::function<void(FrameSlot *)> &consume = nullptr)
+{
+    FrameSlot *slot = ring.beginWrite();
+    if (!slot)
+        return;
+
+    const Image *image = source.images.find(source.buffers[i % NumBuffers].get());
+    slot->bytesused = copy_image(*image, source.layout, slot->data.data());
+    slot->sequence = i;
+    ring.commitWrite(slot);
+
+    slot = ring.beginRead();
+    if (!slot)
+        return;
+
+    if (consume)
+        consume(slot);
+    ring.endRead(slot);
+}
+
+static Result bench_copy(FrameSource &source)
+{
+    FrameRing ring(4, source.layout.frameSize, FrameRing::DropPolicy::DropOldest);
+
+    return measure("copy", source.layout.frameSize, [&](unsigned int i) {
+        ring_frame(source, ring, i);
+    });
+}
+// ************ Copy path ************************************************
+
+// ************ Gstreamer ************************************************
+struct PushPipeline {
+    GstElement *pipeline = nullptr;
+    GstElement *appsrc = nullptr;
+
+    ~PushPipeline()
+    {
+        if (!pipeline)
+            return;
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(appsrc);
+        gst_object_unref(pipeline);
+    }
+};
+
+// appsrc blocks once two frames are queued, so pushing runs at the pace of
+// the streaming thread as it does with a real encoder behind it
+static bool create_pipeline(const FrameLayout &layout, PushPipeline *push)
+{
+    GError *error = nullptr;
+    push->pipeline = gst_parse_launch(
+        "appsrc name=src format=time block=true ! fakesink sync=false", &error);
+    if (!push->pipeline) {
+        std::cerr << "Failed to create pipeline: " << error->message << "\n";
+        g_error_free(error);
+        return false;
+    }
+
+    push->appsrc = gst_bin_get_by_name(GST_BIN(push->pipeline), "src");
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+        "format", G_TYPE_STRING, gstFormatName(layout.format),
+        "width", G_TYPE_INT, layout.size.width,
+        "height", G_TYPE_INT, layout.size.height,
+        "framerate", GST_TYPE_FRACTION, 30, 1,
+        NULL);
+    g_object_set(G_OBJECT(push->appsrc), "caps", caps,
+                 "max-bytes", static_cast<guint64>(2 * layout.frameSize), NULL);
+    gst_caps_unref(caps);
+
+    gst_element_set_state(push->pipeline, GST_STATE_PLAYING);
+    gst_element_get_state(push->pipeline, nullptr, nullptr, GST_CLOCK_TIME_NONE);
+    return true;
+}
+
+// Wait until fakesink has consumed every buffer pushed
+static void drain_pipeline(PushPipeline &push)
+{
+    gst_app_src_end_of_stream(GST_APP_SRC(push.appsrc));
+
+    GstBus *bus = gst_element_get_bus(push.pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        static_cast<GstMessageType>(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    if (msg)
+        gst_message_unref(msg);
+    gst_object_unref(bus);
+}
+
+static GstVideoMeta *add_video_meta(GstBuffer *buffer, const FrameLayout &layout)
+{
+    gsize offset[GST_VIDEO_MAX_PLANES] = {};
+    gint stride[GST_VIDEO_MAX_PLANES] = {};
+
+    for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+        offset[i] = layout.planes[i].offset;
+        stride[i] = layout.planes[i].stride;
+    }
+
+    return gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+                                          gst_video_format_from_string(gstFormatName(layout.format)),
+                                          layout.size.width, layout.size.height,
+                                          layout.planes.size(), offset, stride);
+}
+
+static void stamp(GstBuffer *buffer, unsigned int i)
+{
+    GST_BUFFER_PTS(buffer) = i * GST_SECOND / 30;
+    GST_BUFFER_DURATION(buffer) = GST_SECOND / 30;
+}
+
+// The arena ring followed by push_slot() of the application
+static Result bench_push(FrameSource &source)
+{
+    FrameArena arena(false);
+    FrameRing ring(4, source.layout.frameSize, FrameRing::DropPolicy::DropOldest, &arena);
+    PushPipeline push;
+    if (!create_pipeline(source.layout, &push))
+        return {};
+
+    GstBufferPool *pool = arenaBufferPoolNew(&arena, source.layout.frameSize, 4, 0);
+    if (!pool)
+        return {};
+
+    Result result = measure("push", source.layout.frameSize, [&](unsigned int i) {
+        ring_frame(source, ring, i, [&](FrameSlot *slot) {
+            GstBuffer *buffer = nullptr;
+            GstMapInfo map;
+
+            if (gst_buffer_pool_acquire_buffer(pool, &buffer, nullptr) != GST_FLOW_OK)
+                return;
+
+            gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+            memcpy(map.data, slot->data.data(), slot->bytesused);
+            gst_buffer_unmap(buffer, &map);
+
+            // The meta stays with the buffer as in add_pooled_video_meta()
+            stamp(buffer, i);
+            if (!gst_buffer_get_video_meta(buffer)) {
+                GstVideoMeta *meta = add_video_meta(buffer, source.layout);
+                GST_META_FLAG_SET(&meta->meta, GST_META_FLAG_POOLED);
+            }
+            gst_app_src_push_buffer(GST_APP_SRC(push.appsrc), buffer);
+        });
+    }, [&]() { drain_pipeline(push); });
+
+    // Buffers still downstream go back to the pool before it is freed
+    gst_element_set_state(push.pipeline, GST_STATE_NULL);
+    gst_buffer_pool_set_active(pool, FALSE);
+    gst_object_unref(pool);
+    return result;
+}
+
+// push_request() of the application, without the requeueing
+static Result bench_zero_copy(FrameSource &source)
+{
+    GstAllocator *allocator = gst_dmabuf_allocator_new();
+    PushPipeline push;
+    if (!create_pipeline(source.layout, &push)) {
+        gst_object_unref(allocator);
+        return {};
+    }
+
+    Result result = measure("zero-copy", source.layout.frameSize, [&](unsigned int i) {
+        const FrameBuffer *fb = source.buffers[i % NumBuffers].get();
+        GstBuffer *buffer = gst_buffer_new();
+
+        for (const FrameBuffer::Plane &plane : fb->planes()) {
+            GstMemory *mem = gst_dmabuf_allocator_alloc_with_flags(
+                allocator, plane.fd.get(), plane.offset + plane.length,
+                GST_FD_MEMORY_FLAG_DONT_CLOSE);
+            gst_memory_resize(mem, plane.offset, plane.length);
+            gst_buffer_append_memory(buffer, mem);
+        }
+
+        stamp(buffer, i);
+        add_video_meta(buffer, source.layout);
+        gst_app_src_push_buffer(GST_APP_SRC(push.appsrc), buffer);
+    }, [&]() { drain_pipeline(push); });
+
+    gst_object_unref(allocator);
+    return result;
+}
+// ************ Gstreamer ************************************************
+
+// ************ Processing ************************************************
+static const char *kernel_name(ConvertKernel kernel)
+{
+    return kernel == ConvertKernel::Neon ? "neon" : "scalar";
+}
+
+static std::vector<Result> bench_convert(FrameSource &source)
+{
+    const FrameLayout out = FrameLayout::create(formats::YUV420, source.layout.size, 0);
+    std::vector<uint8_t> dst(out.frameSize);
+    std::vector<Result> results;
+
+    uint8_t *y = dst.data() + out.planes[0].offset;
+    uint8_t *u = dst.data() + out.planes[1].offset;
+    uint8_t *v = dst.data() + out.planes[2].offset;
+
+    for (ConvertKernel kernel : { ConvertKernel::Scalar, ConvertKernel::Neon }) {
+        if (!setConvertKernel(kernel))
+            continue;
+
+        for (unsigned int threads : g_options.threads) {
+            ThreadPool pool(threads);
+
+            Result result = measure("convert", source.layout.frameSize, [&](unsigned int i) {
+                const Image *image = source.images.find(source.buffers[i % NumBuffers].get());
+                const PlaneView<const uint8_t> src = image->plane(0);
+                XRGB8888toI420(src.data, src.stride,
+                               y, out.planes[0].stride, u, out.planes[1].stride,
+                               v, out.planes[2].stride,
+                               out.size.width, out.size.height, &pool);
+            });
+            result.kernel = kernel_name(kernel);
+            result.threads = threads;
+            results.push_back(result);
+        }
+    }
+
+    setConvertKernel(defaultConvertKernel());
+    return results;
+}
+
+// A plausible IMX219 pair: 0.5 degree of yaw between the eyes, 60 mm
+// baseline and some barrel distortion
+static StereoCalibration synthetic_calibration(const Size &size)
+{
+    StereoCalibration calibration;
+    const double f = 0.8 * size.width;
+    const double s = 0.0087265, c = 0.9999619;
+
+    calibration.size = size;
+    for (CameraCalibration &eye : calibration.eye) {
+        const double K[9] = { f, 0, size.width / 2.0, 0, f, size.height / 2.0, 0, 0, 1 };
+        const double D[5] = { -0.1, 0.02, 0, 0, 0 };
+        std::copy(std::begin(K), std::end(K), eye.K);
+        std::copy(std::begin(D), std::end(D), eye.D);
+    }
+
+    const double R[9] = { c, 0, s, 0, 1, 0, -s, 0, c };
+    std::copy(std::begin(R), std::end(R), calibration.R);
+    calibration.T[0] = -60;
+
+    return calibration;
+}
+
+static std::vector<Result> bench_rectify(FrameSource &source)
+{
+    const FrameLayout &layout = source.layout;
+    std::vector<Result> results;
+
+    Rectifier rectifier(synthetic_calibration(layout.size), layout);
+    if (!rectifier.isValid()) {
+        std::cerr << "Cannot rectify " << layout.format.toString() << "\n";
+        return results;
+    }
+
+    std::vector<uint8_t> dst[2] = { std::vector<uint8_t>(layout.frameSize),
+                                    std::vector<uint8_t>(layout.frameSize) };
+    uint8_t *planes[2][3] = {};
+    unsigned int strides[3] = {};
+
+    for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+        for (unsigned int eye = 0; eye < 2; ++eye)
+            planes[eye][i] = dst[eye].data() + layout.planes[i].offset;
+        strides[i] = layout.planes[i].stride;
+    }
+
+    for (unsigned int threads : g_options.threads) {
+        ThreadPool pool(threads);
+
+        Result result = measure("rectify", 2 * layout.frameSize, [&](unsigned int i) {
+            for (unsigned int eye = 0; eye < 2; ++eye) {
+                const Image *image =
+                    source.images.find(source.buffers[(i + eye) % NumBuffers].get());
+                rectifier.process(eye, *image, planes[eye], strides, &pool);
+            }
+        });
+        result.threads = threads;
+        results.push_back(result);
+    }
+
+    return results;
+}
+// ************ Processing ************************************************
+
+// ************ Depth ************************************************
+// Sloped surfaces with long runs, invalid areas, object edges far beyond a
+// short difference, differences on either side of the short code limit and
+// a patch of noise. The padding at the end of the rows must not leak into
+// the encoding.
+static std::vector<uint16_t> synthetic_disparity(const Size &size, unsigned int stride)
+{
+    const uint16_t scale = 1 << DisparityEngine::SubpixelBits;
+    std::vector<uint16_t> map(static_cast<size_t>(stride) * size.height, 0x1234);
+
+    for (unsigned int y = 0; y < size.height; ++y) {
+        uint16_t *row = map.data() + static_cast<size_t>(y) * stride;
+
+        for (unsigned int x = 0; x < size.width; ++x) {
+            uint16_t value = 4 * scale + x / 4;
+
+            if (y % 16 == 5)
+                value += x % 2 * 63;
+            else if (y % 16 == 6)
+                value += x % 2 * 64;
+            if (x >= size.width / 3 && x < size.width / 2 &&
+                y >= size.height / 4 && y < size.height * 3 / 4)
+                value = 60 * scale;
+            if (x >= size.width * 2 / 3 && x < size.width * 2 / 3 + 64 && y < 64)
+                value = (x * 37 + y * 101) % (64 * scale);
+            if (y >= size.height - 8)
+                value = 30 * scale;
+            if (x < 8 || (x / 32 + y / 32) % 7 == 3)
+                value = DisparityEngine::Invalid;
+
+            row[x] = value;
+        }
+    }
+
+    return map;
+}
+
+// What a receiver decodes: the largest valid disparity of every block, with
+// the fractional bits kept
+static std::vector<uint16_t> expected_disparity(const std::vector<uint16_t> &map,
+                                                unsigned int stride,
+                                                const DepthEncoder::Config &config,
+                                                const Size &size)
+{
+    std::vector<uint16_t> expected;
+
+    for (unsigned int y = 0; y < size.height; ++y) {
+        for (unsigned int x = 0; x < size.width; ++x) {
+            uint16_t best = DepthEncoder::Invalid;
+
+            for (unsigned int j = 0; j < config.scale; ++j) {
+                for (unsigned int i = 0; i < config.scale; ++i) {
+                    const uint16_t value = map[static_cast<size_t>(y * config.scale + j) * stride +
+                                               x * config.scale + i];
+                    if (value != DisparityEngine::Invalid &&
+                        (best == DepthEncoder::Invalid || value > best))
+                        best = value;
+                }
+            }
+
+            if (best != DepthEncoder::Invalid)
+                best >>= DisparityEngine::SubpixelBits - config.bits;
+            expected.push_back(best);
+        }
+    }
+
+    return expected;
+}
+
+// Encode, decode and compare once, then time the encoding. Sets \a failed
+// when the decoded map differs from the input.
+static std::vector<Result> bench_depth(const Size &size, bool *failed)
+{
+    const unsigned int stride = size.width + 16;
+    const std::vector<uint16_t> map = synthetic_disparity(size, stride);
+    const uint64_t timestamp = 0x0123456789abcdefULL;
+    std::vector<Result> results;
+
+    const DepthEncoder::Config configs[] = {
+        { DepthEncoder::Codec::Raw, 1, DisparityEngine::SubpixelBits },
+        { DepthEncoder::Codec::Delta, 1, DisparityEngine::SubpixelBits },
+        { DepthEncoder::Codec::Delta, 2, 2 },
+    };
+
+    for (const DepthEncoder::Config &config : configs) {
+        const char *codec = config.codec == DepthEncoder::Codec::Raw ? "raw" : "delta";
+        DepthEncoder encoder(config, size);
+        if (!encoder.isValid()) {
+            std::cerr << "Cannot encode " << size.toString() << " depth maps\n";
+            continue;
+        }
+
+        const Size &scaled = encoder.size();
+        const size_t samples = static_cast<size_t>(scaled.width) * scaled.height;
+        std::vector<uint8_t> encoded(encoder.maxEncodedSize());
+        std::vector<uint16_t> decoded(samples);
+        DepthEncoder::Header header;
+
+        const size_t length = encoder.encode(map.data(), stride, timestamp, encoded.data());
+        const std::vector<uint16_t> expected = expected_disparity(map, stride, config, scaled);
+        if (!DepthEncoder::decode(encoded.data(), length, &header, decoded.data(), samples) ||
+            header.codec != config.codec || header.bits != config.bits ||
+            header.scale != config.scale || header.size != scaled ||
+            header.timestamp != timestamp) {
+            std::cerr << "Depth " << codec << " x" << config.scale
+                      << ": encoded map does not decode\n";
+            *failed = true;
+            continue;
+        }
+
+        auto mismatch = std::mismatch(expected.begin(), expected.end(), decoded.begin());
+        if (mismatch.first != expected.end()) {
+            const size_t i = mismatch.first - expected.begin();
+            std::cerr << "Depth " << codec << " x" << config.scale << ": sample ("
+                      << i % scaled.width << ", " << i / scaled.width << ") decodes to "
+                      << *mismatch.second << " instead of " << *mismatch.first << "\n";
+            *failed = true;
+            continue;
+        }
+
+        Result result = measure("depth", map.size() * sizeof(uint16_t), [&](unsigned int i) {
+            encoder.encode(map.data(), stride, timestamp + i, encoded.data());
+        });
+        result.codec = codec;
+        result.scale = config.scale;
+        result.encoded = length;
+        results.push_back(result);
+    }
+
+    return results;
+}
+// ************ Depth ************************************************
+
+int main(int argc, char *argv[])
+{
+    if (parse_options(argc, argv) < 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    gst_init(nullptr, nullptr);
+
+    bool failed = false;
+    for (const PixelFormat &format : g_options.formats) {
+        for (const Size &size : g_options.sizes) {
+            const FrameLayout layout = FrameLayout::create(format, size, 0);
+            if (!layout.isValid()) {
+                std::cerr << "No layout for " << format.toString() << "\n";
+                continue;
+            }
+
+            std::vector<uint8_t> recorded;
+            if (!g_options.input.empty() && load_recording(layout, &recorded) < 0)
+                return EXIT_FAILURE;
+
+            FrameSource source;
+            if (create_source(layout, recorded, &source) < 0) {
+                std::cerr << "Failed to create frame buffers\n";
+                return EXIT_FAILURE;
+            }
+
+            std::vector<Result> results;
+            if (run_case("map"))
+                results.push_back(bench_map(source));
+            if (run_case("copy"))
+                results.push_back(bench_copy(source));
+            if (run_case("push"))
+                results.push_back(bench_push(source));
+            if (run_case("zero-copy"))
+                results.push_back(bench_zero_copy(source));
+            if (run_case("convert") && format == formats::XRGB8888) {
+                std::vector<Result> convert = bench_convert(source);
+                results.insert(results.end(), convert.begin(), convert.end());
+            }
+            if (run_case("rectify")) {
+                std::vector<Result> rectify = bench_rectify(source);
+                results.insert(results.end(), rectify.begin(), rectify.end());
+            }
+            // Disparity maps do not depend on the frame format
+            if (run_case("depth") && format == g_options.formats.front()) {
+                std::vector<Result> depth = bench_depth(size, &failed);
+                results.insert(results.end(), depth.begin(), depth.end());
+            }
+
+            for (const Result &result : results)
+                if (result.name)
+                    report(layout, result);
+        }
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
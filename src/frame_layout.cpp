@@ -0,0 +1,103 @@
+/*
+ * Plane geometry of the pixel formats handled by the application
+ */
+
+#include "frame_layout.h"
+
+#include <libcamera/formats.h>
+
+using namespace libcamera;
+
+namespace {
+
+struct FormatInfo {
+	PixelFormat format;
+	/* libcamera formats are named after their little-endian words */
+	const char *gstFormat;
+	unsigned int bytesPerPixel;
+	/* Chroma planes, with their horizontal and vertical subsampling */
+	unsigned int chromaPlanes;
+	unsigned int hSub;
+	unsigned int vSub;
+};
+
+const FormatInfo formatInfo[] = {
+	{ formats::XRGB8888, "BGRx", 4, 0, 1, 1 },
+	{ formats::XBGR8888, "RGBx", 4, 0, 1, 1 },
+	{ formats::RGB888, "BGR", 3, 0, 1, 1 },
+	{ formats::BGR888, "RGB", 3, 0, 1, 1 },
+	{ formats::YUYV, "YUY2", 2, 0, 1, 1 },
+	{ formats::R8, "GRAY8", 1, 0, 1, 1 },
+	{ formats::YUV420, "I420", 1, 2, 2, 2 },
+	{ formats::YVU420, "YV12", 1, 2, 2, 2 },
+	/* The interleaved CbCr plane has a full-width row of 2-byte samples */
+	{ formats::NV12, "NV12", 1, 1, 1, 2 },
+	{ formats::NV21, "NV21", 1, 1, 1, 2 },
+};
+
+const FormatInfo *findFormat(const PixelFormat &format)
+{
+	for (const FormatInfo &info : formatInfo) {
+		if (info.format == format)
+			return &info;
+	}
+
+	return nullptr;
+}
+
+unsigned int alignUp4(unsigned int value)
+{
+	return (value + 3) & ~3U;
+}
+
+} /* namespace */
+
+FrameLayout FrameLayout::create(const PixelFormat &format, const Size &size,
+				unsigned int stride)
+{
+	FrameLayout layout;
+	layout.format = format;
+	layout.size = size;
+
+	const FormatInfo *info = findFormat(format);
+	if (!info)
+		return layout;
+
+	PlaneLayout luma;
+	luma.width = size.width;
+	luma.bytesPerLine = size.width * info->bytesPerPixel;
+	luma.stride = stride ? stride : alignUp4(luma.bytesPerLine);
+	luma.rows = size.height;
+	luma.offset = 0;
+	layout.planes.push_back(luma);
+
+	for (unsigned int i = 0; i < info->chromaPlanes; ++i) {
+		PlaneLayout chroma;
+		chroma.width = (size.width + info->hSub - 1) / info->hSub;
+		chroma.bytesPerLine = chroma.width;
+		chroma.stride = stride ? stride / info->hSub : alignUp4(chroma.bytesPerLine);
+		chroma.rows = (size.height + info->vSub - 1) / info->vSub;
+		chroma.offset = 0;
+		layout.planes.push_back(chroma);
+	}
+
+	size_t offset = 0;
+	for (PlaneLayout &plane : layout.planes) {
+		plane.offset = offset;
+		offset += static_cast<size_t>(plane.stride) * plane.rows;
+	}
+	layout.frameSize = offset;
+
+	return layout;
+}
+
+FrameLayout FrameLayout::fromStream(const StreamConfiguration &cfg)
+{
+	return create(cfg.pixelFormat, cfg.size, cfg.stride);
+}
+
+const char *gstFormatName(const PixelFormat &format)
+{
+	const FormatInfo *info = findFormat(format);
+	return info ? info->gstFormat : nullptr;
+}
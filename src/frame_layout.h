@@ -0,0 +1,42 @@
+/*
+ * Plane geometry of the pixel formats handled by the application
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+#include <libcamera/stream.h>
+
+struct PlaneLayout {
+	/* Pixels per row of the plane, fewer than the frame's in chroma planes */
+	unsigned int width;
+	unsigned int bytesPerLine;
+	unsigned int stride;
+	unsigned int rows;
+	size_t offset;
+};
+
+/*
+ * Planes are laid out back to back, as libcamera does for multi-planar formats
+ * allocated in a single dmabuf and as GStreamer expects without a video meta.
+ */
+struct FrameLayout {
+	libcamera::PixelFormat format;
+	libcamera::Size size;
+	std::vector<PlaneLayout> planes;
+	size_t frameSize = 0;
+
+	bool isValid() const { return !planes.empty(); }
+
+	/* A zero stride selects the GStreamer default of 4-byte aligned rows */
+	static FrameLayout create(const libcamera::PixelFormat &format,
+				  const libcamera::Size &size, unsigned int stride);
+	static FrameLayout fromStream(const libcamera::StreamConfiguration &cfg);
+};
+
+/* GStreamer video format name of a pixel format, nullptr if there is none */
+const char *gstFormatName(const libcamera::PixelFormat &format);
@@ -0,0 +1,164 @@
+/*
+ * Bounded lock-free frame ring between the capture and the push side
+ */
+
+#include "frame_ring.h"
+
+#include <assert.h>
+
+#include "frame_arena.h"
+
+/*
+ * Bounded queue of slot indices with per-cell sequence numbers. The ready
+ * queue is popped by the consumer and, with DropOldest, by the producer, so
+ * both ends are safe against concurrent callers.
+ */
+FrameRing::IndexQueue::IndexQueue(unsigned int capacity)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+
+	cells_ = std::make_unique<Cell[]>(size);
+	for (size_t i = 0; i < size; ++i)
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+
+	mask_ = size - 1;
+	head_.store(0, std::memory_order_relaxed);
+	tail_.store(0, std::memory_order_relaxed);
+}
+
+bool FrameRing::IndexQueue::push(unsigned int index)
+{
+	size_t pos = head_.load(std::memory_order_relaxed);
+	Cell *cell;
+
+	for (;;) {
+		cell = &cells_[pos & mask_];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+		if (diff == 0) {
+			if (head_.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = head_.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->index = index;
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+bool FrameRing::IndexQueue::pop(unsigned int *index)
+{
+	size_t pos = tail_.load(std::memory_order_relaxed);
+	Cell *cell;
+
+	for (;;) {
+		cell = &cells_[pos & mask_];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+		if (diff == 0) {
+			if (tail_.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = tail_.load(std::memory_order_relaxed);
+		}
+	}
+
+	*index = cell->index;
+	cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+	return true;
+}
+
+FrameRing::FrameRing(unsigned int slots, size_t slotSize, DropPolicy policy,
+		     FrameArena *arena)
+	: slots_(slots), slotSize_(slotSize), policy_(policy),
+	  free_(slots), ready_(slots), produced_(0), consumed_(0), dropped_(0)
+{
+	assert(slots >= 2);
+
+	for (unsigned int i = 0; i < slots; ++i) {
+		uint8_t *memory = arena ? arena->allocate(slotSize) : nullptr;
+		if (!memory) {
+			if (!storage_)
+				storage_ = std::make_unique<uint8_t[]>(slots * slotSize);
+			memory = storage_.get() + i * slotSize;
+		}
+
+		slots_[i].data = { memory, slotSize };
+		free_.push(i);
+	}
+}
+
+FrameRing::~FrameRing() = default;
+
+unsigned int FrameRing::indexOf(const FrameSlot *slot) const
+{
+	assert(slot >= slots_.data() && slot < slots_.data() + slots_.size());
+	return slot - slots_.data();
+}
+
+/*
+ * Return a slot for the producer to fill, or nullptr if the frame has to be
+ * dropped. Never blocks.
+ */
+FrameSlot *FrameRing::beginWrite()
+{
+	unsigned int index;
+
+	if (free_.pop(&index))
+		return &slots_[index];
+
+	dropped_.fetch_add(1, std::memory_order_relaxed);
+
+	if (policy_ == DropPolicy::DropOldest && ready_.pop(&index))
+		return &slots_[index];
+
+	return nullptr;
+}
+
+void FrameRing::commitWrite(FrameSlot *slot)
+{
+	ready_.push(indexOf(slot));
+	produced_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameRing::abortWrite(FrameSlot *slot)
+{
+	free_.push(indexOf(slot));
+}
+
+FrameSlot *FrameRing::beginRead()
+{
+	unsigned int index;
+
+	if (!ready_.pop(&index))
+		return nullptr;
+
+	return &slots_[index];
+}
+
+void FrameRing::endRead(FrameSlot *slot)
+{
+	free_.push(indexOf(slot));
+	consumed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+FrameRing::Stats FrameRing::stats() const
+{
+	return {
+		produced_.load(std::memory_order_relaxed),
+		consumed_.load(std::memory_order_relaxed),
+		dropped_.load(std::memory_order_relaxed),
+	};
+}
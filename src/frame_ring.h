@@ -0,0 +1,105 @@
+/*
+ * Bounded lock-free frame ring between the capture and the push side
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+#include <libcamera/base/span.h>
+
+class FrameArena;
+
+struct FrameSlot {
+	libcamera::Span<uint8_t> data;
+	size_t bytesused = 0;
+	/* Sensor timestamp and frame duration in nanoseconds, 0 if unknown */
+	uint64_t timestamp = 0;
+	uint64_t duration = 0;
+	uint32_t sequence = 0;
+
+	/* Stereo pairs store the right eye at this offset, 0 for mono frames */
+	size_t rightOffset = 0;
+};
+
+/*
+ * Slots are preallocated and circulate between a free and a ready queue, so
+ * that neither side ever touches a slot owned by the other. When the producer
+ * finds no free slot the drop policy decides whether the oldest ready frame is
+ * recycled or the incoming frame is discarded. Slot memory comes from the
+ * arena when one is given, from the heap otherwise.
+ */
+class FrameRing
+{
+public:
+	enum class DropPolicy {
+		DropOldest,
+		DropNewest,
+	};
+
+	struct Stats {
+		uint64_t produced;
+		uint64_t consumed;
+		uint64_t dropped;
+	};
+
+	FrameRing(unsigned int slots, size_t slotSize, DropPolicy policy,
+		  FrameArena *arena = nullptr);
+	~FrameRing();
+
+	/* Producer side */
+	FrameSlot *beginWrite();
+	void commitWrite(FrameSlot *slot);
+	void abortWrite(FrameSlot *slot);
+
+	/* Consumer side */
+	FrameSlot *beginRead();
+	void endRead(FrameSlot *slot);
+
+	unsigned int size() const { return slots_.size(); }
+	size_t slotSize() const { return slotSize_; }
+	Stats stats() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY(FrameRing)
+
+	class IndexQueue
+	{
+	public:
+		explicit IndexQueue(unsigned int capacity);
+
+		bool push(unsigned int index);
+		bool pop(unsigned int *index);
+
+	private:
+		struct Cell {
+			std::atomic<size_t> sequence;
+			unsigned int index;
+		};
+
+		std::unique_ptr<Cell[]> cells_;
+		size_t mask_;
+
+		alignas(64) std::atomic<size_t> head_;
+		alignas(64) std::atomic<size_t> tail_;
+	};
+
+	unsigned int indexOf(const FrameSlot *slot) const;
+
+	std::vector<FrameSlot> slots_;
+	std::unique_ptr<uint8_t[]> storage_;
+	size_t slotSize_;
+	DropPolicy policy_;
+
+	IndexQueue free_;
+	IndexQueue ready_;
+
+	std::atomic<uint64_t> produced_;
+	std::atomic<uint64_t> consumed_;
+	std::atomic<uint64_t> dropped_;
+};
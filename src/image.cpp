@@ -10,13 +10,45 @@
 #include <assert.h>
 #include <errno.h>
 #include <iostream>
+#include <linux/dma-buf.h>
 #include <map>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 using namespace libcamera;
 
+namespace {
+
+int dmabufSync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = {};
+	sync.flags = flags;
+
+	int ret;
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+
+	return ret < 0 ? -errno : 0;
+}
+
+uint64_t syncFlags(Image::MapMode mode)
+{
+	uint64_t flags = 0;
+
+	if (mode & Image::MapMode::ReadOnly)
+		flags |= DMA_BUF_SYNC_READ;
+
+	if (mode & Image::MapMode::WriteOnly)
+		flags |= DMA_BUF_SYNC_WRITE;
+
+	return flags;
+}
+
+} /* namespace */
+
 std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode mode)
 {
 	std::unique_ptr<Image> image{ new Image() };
@@ -37,6 +69,8 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 		size_t dmabufLength = 0;
 	};
 	std::map<int, MappedBufferInfo> mappedBuffers;
+	/* Files the sync ioctl works on, memfds and the like have no caches to flush */
+	std::map<int, bool> dmabufs;
 
 	for (const FrameBuffer::Plane &plane : buffer->planes()) {
 		const int fd = plane.fd.get();
@@ -78,11 +112,27 @@ std::unique_ptr<Image> Image::fromFrameBuffer(const FrameBuffer *buffer, MapMode
 		}
 
 		image->planes_.emplace_back(info.address + plane.offset, plane.length);
+
+		if (dmabufs.find(fd) == dmabufs.end())
+			dmabufs[fd] = !dmabufSync(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ) &&
+				      !dmabufSync(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+		image->fds_.push_back(dmabufs[fd] ? fd : -1);
 	}
 
 	return image;
 }
 
+std::unique_ptr<Image> Image::fromPlanes(const std::vector<Span<uint8_t>> &planes)
+{
+	std::unique_ptr<Image> image{ new Image() };
+
+	assert(!planes.empty());
+
+	image->planes_ = planes;
+	image->fds_.assign(planes.size(), -1);
+	return image;
+}
+
 Image::Image() = default;
 
 Image::~Image()
@@ -107,3 +157,123 @@ Span<const uint8_t> Image::data(unsigned int plane) const
 	assert(plane <= planes_.size());
 	return planes_[plane];
 }
+
+int Image::setLayout(const FrameLayout &layout)
+{
+	if (!layout.isValid() || layout.planes.size() > planes_.size()) {
+		std::cerr << "image has " << planes_.size() << " planes, layout "
+			  << layout.planes.size() << std::endl;
+		return -EINVAL;
+	}
+
+	for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+		const PlaneLayout &plane = layout.planes[i];
+		const size_t length = static_cast<size_t>(plane.stride) * (plane.rows - 1) +
+				      plane.bytesPerLine;
+		if (plane.bytesPerLine > plane.stride || length > planes_[i].size()) {
+			std::cerr << "plane " << i << " size " << planes_[i].size()
+				  << " smaller than layout size " << length << std::endl;
+			return -EINVAL;
+		}
+	}
+
+	layout_ = layout;
+	return 0;
+}
+
+PlaneView<uint8_t> Image::plane(unsigned int plane)
+{
+	assert(plane < layout_.planes.size());
+
+	const PlaneLayout &geometry = layout_.planes[plane];
+	PlaneView<uint8_t> view;
+	view.data = planes_[plane].data();
+	view.format = layout_.format;
+	view.width = geometry.width;
+	view.height = geometry.rows;
+	view.bytesPerLine = geometry.bytesPerLine;
+	view.stride = geometry.stride;
+	return view;
+}
+
+PlaneView<const uint8_t> Image::plane(unsigned int plane) const
+{
+	const PlaneView<uint8_t> view = const_cast<Image *>(this)->plane(plane);
+	return { view.data, view.format, view.width, view.height,
+		 view.bytesPerLine, view.stride };
+}
+
+void Image::sync(unsigned int planes, uint64_t flags) const
+{
+	for (unsigned int i = 0; i < fds_.size(); ++i) {
+		const int fd = fds_[i];
+		if (!(planes & (1U << i)) || fd < 0)
+			continue;
+
+		/* Planes sharing a dmabuf are synchronised with the first */
+		bool done = false;
+		for (unsigned int j = 0; j < i && !done; ++j)
+			done = (planes & (1U << j)) && fds_[j] == fd;
+		if (done)
+			continue;
+
+		int ret = dmabufSync(fd, flags);
+		if (ret < 0)
+			std::cerr << "Failed to sync plane " << i << ": "
+				  << strerror(-ret) << std::endl;
+	}
+}
+
+void Image::beginAccess(unsigned int planes, MapMode mode) const
+{
+	sync(planes, DMA_BUF_SYNC_START | syncFlags(mode));
+}
+
+void Image::endAccess(unsigned int planes, MapMode mode) const
+{
+	sync(planes, DMA_BUF_SYNC_END | syncFlags(mode));
+}
+
+ImageCache::ImageCache() = default;
+
+ImageCache::~ImageCache() = default;
+
+int ImageCache::map(const std::vector<std::unique_ptr<FrameBuffer>> &buffers,
+		    Image::MapMode mode, const FrameLayout &layout)
+{
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		if (images_.find(buffer.get()) != images_.end())
+			continue;
+
+		std::unique_ptr<Image> image = Image::fromFrameBuffer(buffer.get(), mode);
+		if (!image)
+			return -ENOMEM;
+
+		int ret = image->setLayout(layout);
+		if (ret < 0)
+			return ret;
+
+		images_[buffer.get()] = std::move(image);
+	}
+
+	return 0;
+}
+
+void ImageCache::clear()
+{
+	images_.clear();
+}
+
+Image *ImageCache::find(const FrameBuffer *buffer) const
+{
+	auto it = images_.find(buffer);
+	if (it == images_.end())
+		return nullptr;
+
+	return it->second.get();
+}
+
+unsigned int ImageCache::size() const
+{
+	return images_.size();
+}
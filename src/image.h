@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <stdint.h>
 #include <vector>
@@ -16,6 +17,27 @@
 #include <libcamera/base/span.h>
 
 #include <libcamera/framebuffer.h>
+#include <libcamera/pixel_format.h>
+
+#include "frame_layout.h"
+
+/*
+ * One plane of an image: height rows of width pixels, bytesPerLine bytes
+ * of pixel data each, stride bytes apart. Rows may be padded, and the last
+ * one need not be.
+ */
+template<typename T>
+struct PlaneView {
+	T *data = nullptr;
+	libcamera::PixelFormat format;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int bytesPerLine = 0;
+	unsigned int stride = 0;
+
+	bool isValid() const { return data != nullptr; }
+	T *row(unsigned int y) const { return data + static_cast<size_t>(y) * stride; }
+};
 
 class Image
 {
@@ -26,8 +48,13 @@ public:
 		ReadWrite = ReadOnly | WriteOnly,
 	};
 
+	/* Plane masks of beginAccess(), bit n for plane n */
+	static constexpr unsigned int AllPlanes = ~0U;
+
 	static std::unique_ptr<Image> fromFrameBuffer(const libcamera::FrameBuffer *buffer,
 						      MapMode mode);
+	/* Planes of memory owned by the caller, which outlives the image */
+	static std::unique_ptr<Image> fromPlanes(const std::vector<libcamera::Span<uint8_t>> &planes);
 
 	~Image();
 
@@ -36,13 +63,85 @@ public:
 	libcamera::Span<uint8_t> data(unsigned int plane);
 	libcamera::Span<const uint8_t> data(unsigned int plane) const;
 
+	/*
+	 * Describe the planes with \a layout, plane n of the layout being plane
+	 * n of the image whatever its offset. Fails if a plane is too small.
+	 */
+	int setLayout(const FrameLayout &layout);
+	const FrameLayout &layout() const { return layout_; }
+
+	/* Views of the planes of the layout */
+	PlaneView<uint8_t> plane(unsigned int plane);
+	PlaneView<const uint8_t> plane(unsigned int plane) const;
+
+	/*
+	 * Bracket CPU access to the planes in \a planes with DMA_BUF_IOCTL_SYNC,
+	 * so that a cached mapping reads what the device wrote and the device
+	 * reads what the CPU wrote. Only the dmabufs holding those planes are
+	 * synchronised, once each. Planes not backed by a dmabuf need nothing.
+	 */
+	void beginAccess(unsigned int planes, MapMode mode) const;
+	void endAccess(unsigned int planes, MapMode mode) const;
+
 private:
 	LIBCAMERA_DISABLE_COPY(Image)
 
 	Image();
 
+	void sync(unsigned int planes, uint64_t flags) const;
+
 	std::vector<libcamera::Span<uint8_t>> maps_;
 	std::vector<libcamera::Span<uint8_t>> planes_;
+	/* The dmabuf of every plane, -1 for memory and other files */
+	std::vector<int> fds_;
+	FrameLayout layout_;
+};
+
+/* Image::beginAccess() and endAccess() for the lifetime of the scope */
+class ImageAccess
+{
+public:
+	ImageAccess(const Image &image, unsigned int planes, Image::MapMode mode)
+		: image_(image), planes_(planes), mode_(mode)
+	{
+		image_.beginAccess(planes_, mode_);
+	}
+
+	~ImageAccess()
+	{
+		image_.endAccess(planes_, mode_);
+	}
+
+private:
+	LIBCAMERA_DISABLE_COPY(ImageAccess)
+
+	const Image &image_;
+	unsigned int planes_;
+	Image::MapMode mode_;
+};
+
+/*
+ * Keeps one mapping per FrameBuffer for the lifetime of the allocation, so
+ * that the capture path can look images up instead of mapping them per frame.
+ */
+class ImageCache
+{
+public:
+	ImageCache();
+	~ImageCache();
+
+	/* Map \a buffers, described by \a layout */
+	int map(const std::vector<std::unique_ptr<libcamera::FrameBuffer>> &buffers,
+		Image::MapMode mode, const FrameLayout &layout);
+	void clear();
+
+	Image *find(const libcamera::FrameBuffer *buffer) const;
+	unsigned int size() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY(ImageCache)
+
+	std::map<const libcamera::FrameBuffer *, std::unique_ptr<Image>> images_;
 };
 
 namespace libcamera {
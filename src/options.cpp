@@ -0,0 +1,709 @@
+/*
+ * Command line options of the streaming application
+ */
+
+#include "options.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <getopt.h>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+int parseDestination(const char *arg, Destination *dest)
+{
+	const char *colon = strrchr(arg, ':');
+	unsigned long port = colon ? strtoul(colon + 1, nullptr, 10) : 0;
+	if (!colon || colon == arg || !port || port > 65535) {
+		std::cerr << "Invalid destination '" << arg << "'\n";
+		return -EINVAL;
+	}
+
+	dest->host = std::string(arg, colon - arg);
+	dest->port = port;
+	return 0;
+}
+
+/* "ROLE:VALUE" of the placement options, VALUE is returned */
+ThreadPlacement *parsePlacement(const char *arg, Options *options, const char **value)
+{
+	const char *colon = strchr(arg, ':');
+	ThreadRole role;
+
+	if (!colon || parseThreadRole(std::string(arg, colon - arg), &role) < 0) {
+		std::cerr << "Expected capture, push, encode, workers or depth in '"
+			  << arg << "'\n";
+		return nullptr;
+	}
+
+	*value = colon + 1;
+	return &options->placement[static_cast<unsigned int>(role)];
+}
+
+int parseSize(const char *arg, libcamera::Size *size)
+{
+	unsigned int width, height;
+	char end;
+
+	if (sscanf(arg, "%ux%u%c", &width, &height, &end) != 2 || !width || !height) {
+		std::cerr << "Invalid size '" << arg << "'\n";
+		return -EINVAL;
+	}
+
+	*size = libcamera::Size(width, height);
+	return 0;
+}
+
+enum {
+	OptZeroCopy = 256,
+	OptFormat,
+	OptSize,
+	OptRoi,
+	OptRaw,
+	OptFps,
+	OptBuffers,
+	OptRingSlots,
+	OptDropPolicy,
+	OptHugePages,
+	OptPush,
+	OptStereo,
+	OptPairTolerance,
+	OptStereoLayout,
+	OptEncoder,
+	OptBitrate,
+	OptGop,
+	OptProfile,
+	OptRectify,
+	OptDisparity,
+	OptMaxDisparity,
+	OptDepthStream,
+	OptDepthCodec,
+	OptDepthScale,
+	OptDepthBits,
+	OptCpuConvert,
+	OptChangeGate,
+	OptHeartbeat,
+	OptThreads,
+	OptStatsPort,
+	OptRecord,
+	OptRecordSlots,
+	OptShm,
+	OptShmSlots,
+	OptShmFrames,
+	OptReplay,
+	OptReplayPace,
+	OptReplayLoop,
+	OptDest,
+	OptMulticastTtl,
+	OptControl,
+	OptAdaptive,
+	OptMinBitrate,
+	OptRtcpPort,
+	OptPreview,
+	OptPreviewSize,
+	OptPreviewBitrate,
+	OptCpus,
+	OptPriority,
+	OptEncoderThreads,
+};
+
+const struct option longOptions[] = {
+	{ "help", no_argument, nullptr, 'h' },
+	{ "format", required_argument, nullptr, OptFormat },
+	{ "size", required_argument, nullptr, OptSize },
+	{ "roi", required_argument, nullptr, OptRoi },
+	{ "raw", optional_argument, nullptr, OptRaw },
+	{ "fps", required_argument, nullptr, OptFps },
+	{ "buffers", required_argument, nullptr, OptBuffers },
+	{ "zero-copy", no_argument, nullptr, OptZeroCopy },
+	{ "ring-slots", required_argument, nullptr, OptRingSlots },
+	{ "drop-policy", required_argument, nullptr, OptDropPolicy },
+	{ "hugepages", no_argument, nullptr, OptHugePages },
+	{ "push", required_argument, nullptr, OptPush },
+	{ "stereo", no_argument, nullptr, OptStereo },
+	{ "pair-tolerance", required_argument, nullptr, OptPairTolerance },
+	{ "stereo-layout", required_argument, nullptr, OptStereoLayout },
+	{ "encoder", required_argument, nullptr, OptEncoder },
+	{ "bitrate", required_argument, nullptr, OptBitrate },
+	{ "gop", required_argument, nullptr, OptGop },
+	{ "profile", required_argument, nullptr, OptProfile },
+	{ "rectify", required_argument, nullptr, OptRectify },
+	{ "disparity", required_argument, nullptr, OptDisparity },
+	{ "max-disparity", required_argument, nullptr, OptMaxDisparity },
+	{ "depth-stream", required_argument, nullptr, OptDepthStream },
+	{ "depth-codec", required_argument, nullptr, OptDepthCodec },
+	{ "depth-scale", required_argument, nullptr, OptDepthScale },
+	{ "depth-bits", required_argument, nullptr, OptDepthBits },
+	{ "cpu-convert", no_argument, nullptr, OptCpuConvert },
+	{ "change-gate", required_argument, nullptr, OptChangeGate },
+	{ "heartbeat", required_argument, nullptr, OptHeartbeat },
+	{ "threads", required_argument, nullptr, OptThreads },
+	{ "stats-port", required_argument, nullptr, OptStatsPort },
+	{ "record", required_argument, nullptr, OptRecord },
+	{ "record-slots", required_argument, nullptr, OptRecordSlots },
+	{ "shm", required_argument, nullptr, OptShm },
+	{ "shm-slots", required_argument, nullptr, OptShmSlots },
+	{ "shm-frames", required_argument, nullptr, OptShmFrames },
+	{ "replay", required_argument, nullptr, OptReplay },
+	{ "replay-pace", required_argument, nullptr, OptReplayPace },
+	{ "replay-loop", no_argument, nullptr, OptReplayLoop },
+	{ "dest", required_argument, nullptr, OptDest },
+	{ "multicast-ttl", required_argument, nullptr, OptMulticastTtl },
+	{ "control", required_argument, nullptr, OptControl },
+	{ "adaptive", optional_argument, nullptr, OptAdaptive },
+	{ "min-bitrate", required_argument, nullptr, OptMinBitrate },
+	{ "rtcp-port", required_argument, nullptr, OptRtcpPort },
+	{ "preview", required_argument, nullptr, OptPreview },
+	{ "preview-size", required_argument, nullptr, OptPreviewSize },
+	{ "preview-bitrate", required_argument, nullptr, OptPreviewBitrate },
+	{ "cpus", required_argument, nullptr, OptCpus },
+	{ "priority", required_argument, nullptr, OptPriority },
+	{ "encoder-threads", required_argument, nullptr, OptEncoderThreads },
+	{ nullptr, 0, nullptr, 0 },
+};
+
+} /* namespace */
+
+void printUsage(const char *argv0)
+{
+	std::cerr << "Usage: " << argv0 << " [options] <destination-ip> <port>\n"
+		  << "\n"
+		  << "Options:\n"
+		  << "  -h, --help                Show this help\n"
+		  << "      --format=FORMAT       Capture pixel format, e.g. YUV420, NV12 or XRGB8888\n"
+		  << "      --size=WxH            Capture size, e.g. 1640x1232 for 2x2 binning\n"
+		  << "      --roi=X,Y,WxH         Stream this area of the sensor, at its native size\n"
+		  << "                            unless --size is given\n"
+		  << "      --raw[=OUTPUT]        Capture raw Bayer frames (--format picks the packing)\n"
+		  << "                            and debayer them to half size gray (gray, default)\n"
+		  << "                            or full size XRGB8888 (rgb)\n"
+		  << "      --fps=N               Frame rate (default 30)\n"
+		  << "      --buffers=N|auto      Requests per camera (default: camera default), or\n"
+		  << "                            sized at runtime from the downstream hold time\n"
+		  << "      --zero-copy           Push FrameBuffer dmabufs to GStreamer without copying\n"
+		  << "      --ring-slots=N        Frames buffered between camera and GStreamer (default 4)\n"
+		  << "      --drop-policy=POLICY  Frame dropped when the ring is full: oldest (default) or newest\n"
+		  << "      --hugepages           Back frame buffers with reserved huge pages (vm.nr_hugepages)\n"
+		  << "      --push=MODE           Push frames on completion (event, default) or from a 1/FPS timer\n"
+		  << "      --stereo              Capture from both sensors of the stereo camera\n"
+		  << "      --pair-tolerance=US   Maximum sensor timestamp difference of a stereo pair (default 5000)\n"
+		  << "      --stereo-layout=L     Stream the left eye (left, default) or pack both eyes\n"
+		  << "                            side-by-side or top-bottom\n"
+		  << "      --encoder=NAME        H.264 encoder: auto (default), v4l2, v4l2sl or x264\n"
+		  << "      --bitrate=KBPS        Encoder bitrate in kbit/s (default 2048)\n"
+		  << "      --gop=N               Frames between IDR frames (default: encoder default)\n"
+		  << "      --profile=NAME        H.264 profile: baseline, main or high\n"
+		  << "      --adaptive[=MODE]     Adapt the bitrate (bitrate, default) and the frame\n"
+		  << "                            rate (framerate) to RTCP receiver reports\n"
+		  << "      --min-bitrate=KBPS    Lowest adaptive bitrate (default bitrate / 4)\n"
+		  << "      --rtcp-port=PORT      Port receiving RTCP reports (default port + 1)\n"
+		  << "      --cpu-convert         Convert XRGB8888 frames to I420 on the CPU instead of\n"
+		  << "                            with videoconvert\n"
+		  << "      --change-gate=LEVELS  Skip frames whose luma changed by LEVELS or less\n"
+		  << "                            (mean of a block, 0-255) since the last one streamed\n"
+		  << "      --heartbeat=MS        Stream a keyframe at least every MS while frames are\n"
+		  << "                            skipped (default 1000)\n"
+		  << "      --rectify=FILE        Rectify stereo pairs with the calibration in FILE\n"
+		  << "      --disparity=MODE      Compute disparity of rectified pairs by block\n"
+		  << "                            matching (bm) or semi-global matching (sgm)\n"
+		  << "      --max-disparity=N     Disparities searched, a multiple of 16 (default 64)\n"
+		  << "      --depth-stream=HOST:PORT\n"
+		  << "                            Send the disparity maps as RTP to HOST:PORT\n"
+		  << "      --depth-codec=CODEC   Lossless delta run-length coding (delta, default)\n"
+		  << "                            or 16-bit samples as they are (raw)\n"
+		  << "      --depth-scale=N       Send the largest disparity of each NxN block (default 1)\n"
+		  << "      --depth-bits=N        Fractional disparity bits sent, 0 to 4 (default 4)\n"
+		  << "      --threads=N           Threads for CPU conversion and rectification (default 2)\n"
+		  << "      --encoder-threads=N   x264 threads (default 1.5 per CPU allowed)\n"
+		  << "      --cpus=ROLE:LIST      Run the capture, push, encode, workers or depth\n"
+		  << "                            threads on the CPUs in LIST, e.g. encode:2-3\n"
+		  << "      --priority=ROLE:N     Run the threads of ROLE with SCHED_FIFO priority N\n"
+		  << "      --stats-port=PORT     Serve statistics as JSON over HTTP and UDP on PORT\n"
+		  << "      --record=FILE         Record raw frames to FILE, with an index in FILE.idx\n"
+		  << "      --record-slots=N      Frames buffered for the disk writer (default 8)\n"
+		  << "      --shm=PATH            Share raw frames with local consumers connecting to\n"
+		  << "                            the Unix socket PATH\n"
+		  << "      --shm-slots=N         Frames in the shared memory (default 8)\n"
+		  << "      --shm-frames=N        Frames a consumer may hold at once (default 2)\n"
+		  << "      --replay=FILE         Stream a recording instead of the cameras\n"
+		  << "      --replay-pace=PACE    Replay at the recorded rate (recorded, default) or\n"
+		  << "                            as fast as the pipeline goes (max)\n"
+		  << "      --replay-loop         Restart the recording when it ends\n"
+		  << "      --dest=HOST:PORT      Also send the stream to HOST:PORT, unicast or\n"
+		  << "                            multicast; may be repeated\n"
+		  << "      --multicast-ttl=N     Time to live of multicast packets (default 1)\n"
+		  << "      --control=PATH        Accept commands, such as adding destinations,\n"
+		  << "                            on the Unix socket PATH\n"
+		  << "      --preview=HOST:PORT   Send a second, ISP-scaled stream to HOST:PORT\n"
+		  << "      --preview-size=WxH    Size of the preview stream (default 320x240)\n"
+		  << "      --preview-bitrate=KBPS\n"
+		  << "                            Bitrate of the preview stream (default 256)\n";
+}
+
+int parseOptions(int argc, char *argv[], Options *options)
+{
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "h", longOptions, nullptr)) != -1) {
+		switch (opt) {
+		case OptFormat:
+			options->pixelFormat = libcamera::PixelFormat::fromString(optarg);
+			if (!options->pixelFormat.isValid()) {
+				std::cerr << "Unknown pixel format '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptSize:
+			if (parseSize(optarg, &options->size) < 0)
+				return -EINVAL;
+			break;
+		case OptRoi: {
+			int x, y;
+			unsigned int width, height;
+			char end;
+
+			if (sscanf(optarg, "%d,%d,%ux%u%c", &x, &y, &width, &height, &end) != 4 ||
+			    x < 0 || y < 0 || !width || !height) {
+				std::cerr << "Invalid region of interest '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			options->roi = libcamera::Rectangle(x, y, width, height);
+			break;
+		}
+		case OptRaw:
+			if (!optarg || !strcmp(optarg, "gray")) {
+				options->raw = RawOutput::Gray;
+			} else if (!strcmp(optarg, "rgb")) {
+				options->raw = RawOutput::Rgb;
+			} else {
+				std::cerr << "Unknown raw output '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptFps:
+			options->fps = strtoul(optarg, nullptr, 10);
+			if (!options->fps) {
+				std::cerr << "Invalid frame rate '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptZeroCopy:
+			options->zeroCopy = true;
+			break;
+		case OptBuffers:
+			if (!strcmp(optarg, "auto")) {
+				options->tuneBuffers = true;
+				break;
+			}
+			options->buffers = strtoul(optarg, nullptr, 10);
+			if (!options->buffers) {
+				std::cerr << "Invalid buffer count '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptHugePages:
+			options->hugePages = true;
+			break;
+		case OptRingSlots:
+			options->ringSlots = strtoul(optarg, nullptr, 10);
+			if (options->ringSlots < 2) {
+				std::cerr << "The frame ring needs at least 2 slots\n";
+				return -EINVAL;
+			}
+			break;
+		case OptDropPolicy:
+			if (!strcmp(optarg, "oldest")) {
+				options->dropPolicy = FrameRing::DropPolicy::DropOldest;
+			} else if (!strcmp(optarg, "newest")) {
+				options->dropPolicy = FrameRing::DropPolicy::DropNewest;
+			} else {
+				std::cerr << "Unknown drop policy '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptPush:
+			if (!strcmp(optarg, "event")) {
+				options->pushMode = PushMode::Event;
+			} else if (!strcmp(optarg, "timer")) {
+				options->pushMode = PushMode::Timer;
+			} else {
+				std::cerr << "Unknown push mode '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptStereo:
+			options->stereo = true;
+			break;
+		case OptPairTolerance: {
+			char *end;
+			long long tolerance = strtoll(optarg, &end, 10);
+			if (end == optarg || *end || tolerance <= 0 ||
+			    tolerance > INT64_MAX / 1000) {
+				std::cerr << "Invalid pair tolerance '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			options->pairTolerance = tolerance * 1000;
+			break;
+		}
+		case OptStereoLayout:
+			if (!strcmp(optarg, "left")) {
+				options->stereoOutput = StereoOutput::Left;
+			} else if (!strcmp(optarg, "side-by-side")) {
+				options->stereoOutput = StereoOutput::SideBySide;
+			} else if (!strcmp(optarg, "top-bottom")) {
+				options->stereoOutput = StereoOutput::TopBottom;
+			} else {
+				std::cerr << "Unknown stereo layout '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptEncoder:
+			if (!strcmp(optarg, "auto")) {
+				options->encoder.backend = EncoderBackend::Auto;
+			} else if (!strcmp(optarg, "v4l2")) {
+				options->encoder.backend = EncoderBackend::V4l2;
+			} else if (!strcmp(optarg, "v4l2sl")) {
+				options->encoder.backend = EncoderBackend::V4l2Stateless;
+			} else if (!strcmp(optarg, "x264")) {
+				options->encoder.backend = EncoderBackend::X264;
+			} else {
+				std::cerr << "Unknown encoder '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptBitrate:
+			options->encoder.bitrate = strtoul(optarg, nullptr, 10);
+			if (!options->encoder.bitrate) {
+				std::cerr << "Invalid bitrate '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptAdaptive:
+			if (!optarg || !strcmp(optarg, "bitrate")) {
+				options->adaptation = Adaptation::Bitrate;
+			} else if (!strcmp(optarg, "framerate")) {
+				options->adaptation = Adaptation::FrameRate;
+			} else {
+				std::cerr << "Unknown adaptation '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptMinBitrate:
+			options->minBitrate = strtoul(optarg, nullptr, 10);
+			if (!options->minBitrate) {
+				std::cerr << "Invalid bitrate '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptRtcpPort: {
+			unsigned long port = strtoul(optarg, nullptr, 10);
+			if (!port || port > 65535) {
+				std::cerr << "Invalid RTCP port '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			options->rtcpPort = port;
+			break;
+		}
+		case OptGop:
+			options->encoder.gop = strtoul(optarg, nullptr, 10);
+			break;
+		case OptProfile:
+			if (strcmp(optarg, "baseline") && strcmp(optarg, "main") &&
+			    strcmp(optarg, "high")) {
+				std::cerr << "Unknown H.264 profile '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			options->encoder.profile = optarg;
+			break;
+		case OptCpuConvert:
+			options->cpuConvert = true;
+			break;
+		case OptChangeGate:
+			options->changeThreshold = strtoul(optarg, nullptr, 10);
+			if (!options->changeThreshold || options->changeThreshold > 255) {
+				std::cerr << "Invalid change threshold '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptHeartbeat:
+			options->heartbeat = strtoul(optarg, nullptr, 10);
+			if (!options->heartbeat) {
+				std::cerr << "Invalid heartbeat interval '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptRectify:
+			options->calibration = optarg;
+			break;
+		case OptDisparity:
+			if (!strcmp(optarg, "bm")) {
+				options->disparity.mode = DisparityEngine::Mode::BlockMatching;
+			} else if (!strcmp(optarg, "sgm")) {
+				options->disparity.mode = DisparityEngine::Mode::SemiGlobal;
+			} else {
+				std::cerr << "Unknown disparity mode '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			options->depth = true;
+			break;
+		case OptMaxDisparity:
+			options->disparity.maxDisparity = strtoul(optarg, nullptr, 10);
+			if (!options->disparity.maxDisparity ||
+			    options->disparity.maxDisparity % 16) {
+				std::cerr << "Maximum disparity must be a multiple of 16\n";
+				return -EINVAL;
+			}
+			break;
+		case OptDepthStream:
+			if (parseDestination(optarg, &options->depthStream) < 0)
+				return -EINVAL;
+			break;
+		case OptDepthCodec:
+			if (!strcmp(optarg, "delta")) {
+				options->depthEncoding.codec = DepthEncoder::Codec::Delta;
+			} else if (!strcmp(optarg, "raw")) {
+				options->depthEncoding.codec = DepthEncoder::Codec::Raw;
+			} else {
+				std::cerr << "Unknown depth codec '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptDepthScale:
+			options->depthEncoding.scale = strtoul(optarg, nullptr, 10);
+			if (!options->depthEncoding.scale || options->depthEncoding.scale > 16) {
+				std::cerr << "Invalid depth scale '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptDepthBits:
+			options->depthEncoding.bits = strtoul(optarg, nullptr, 10);
+			if (options->depthEncoding.bits > DisparityEngine::SubpixelBits) {
+				std::cerr << "At most " << DisparityEngine::SubpixelBits
+					  << " fractional disparity bits can be sent\n";
+				return -EINVAL;
+			}
+			break;
+		case OptThreads:
+			options->threads = strtoul(optarg, nullptr, 10);
+			if (!options->threads) {
+				std::cerr << "At least one thread is needed\n";
+				return -EINVAL;
+			}
+			break;
+		case OptEncoderThreads:
+			options->encoder.threads = strtoul(optarg, nullptr, 10);
+			break;
+		case OptCpus: {
+			const char *list;
+			ThreadPlacement *placement = parsePlacement(optarg, options, &list);
+			if (!placement)
+				return -EINVAL;
+			if (parseCpuList(list, &placement->cpus) < 0 || !placement->cpus) {
+				std::cerr << "Invalid CPU list '" << list << "'\n";
+				return -EINVAL;
+			}
+			break;
+		}
+		case OptPriority: {
+			const char *value;
+			ThreadPlacement *placement = parsePlacement(optarg, options, &value);
+			if (!placement)
+				return -EINVAL;
+			placement->priority = strtol(value, nullptr, 10);
+			if (placement->priority < 1 || placement->priority > 99) {
+				std::cerr << "SCHED_FIFO priorities range from 1 to 99\n";
+				return -EINVAL;
+			}
+			break;
+		}
+		case OptStatsPort: {
+			unsigned long port = strtoul(optarg, nullptr, 10);
+			if (!port || port > 65535) {
+				std::cerr << "Invalid statistics port '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			options->statsPort = port;
+			break;
+		}
+		case OptRecord:
+			options->recordPath = optarg;
+			break;
+		case OptRecordSlots:
+			options->recordSlots = strtoul(optarg, nullptr, 10);
+			if (options->recordSlots < 2) {
+				std::cerr << "The recording ring needs at least 2 slots\n";
+				return -EINVAL;
+			}
+			break;
+		case OptShm:
+			options->shmPath = optarg;
+			break;
+		case OptShmSlots:
+			options->shmSlots = strtoul(optarg, nullptr, 10);
+			if (options->shmSlots < 2) {
+				std::cerr << "The shared memory needs at least 2 slots\n";
+				return -EINVAL;
+			}
+			break;
+		case OptShmFrames:
+			options->shmFrames = strtoul(optarg, nullptr, 10);
+			if (!options->shmFrames) {
+				std::cerr << "Invalid number of frames '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptReplay:
+			options->replayPath = optarg;
+			break;
+		case OptReplayPace:
+			if (!strcmp(optarg, "recorded")) {
+				options->replayPace = ReplayPace::Recorded;
+			} else if (!strcmp(optarg, "max")) {
+				options->replayPace = ReplayPace::Max;
+			} else {
+				std::cerr << "Unknown replay pace '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptReplayLoop:
+			options->replayLoop = true;
+			break;
+		case OptDest: {
+			Destination dest;
+			if (parseDestination(optarg, &dest) < 0)
+				return -EINVAL;
+			options->destinations.push_back(dest);
+			break;
+		}
+		case OptMulticastTtl:
+			options->multicastTtl = strtoul(optarg, nullptr, 10);
+			if (!options->multicastTtl || options->multicastTtl > 255) {
+				std::cerr << "Invalid multicast TTL '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case OptControl:
+			options->controlPath = optarg;
+			break;
+		case OptPreview:
+			if (parseDestination(optarg, &options->preview) < 0)
+				return -EINVAL;
+			break;
+		case OptPreviewSize:
+			if (parseSize(optarg, &options->previewSize) < 0)
+				return -EINVAL;
+			break;
+		case OptPreviewBitrate:
+			options->previewBitrate = strtoul(optarg, nullptr, 10);
+			if (!options->previewBitrate) {
+				std::cerr << "Invalid bitrate '" << optarg << "'\n";
+				return -EINVAL;
+			}
+			break;
+		case 'h':
+		default:
+			return -EINVAL;
+		}
+	}
+
+	if (argc - optind < 2)
+		return -EINVAL;
+
+	/*
+	 * Top-bottom pairs are the two dmabufs one after the other, side-by-side
+	 * interleaves rows and always needs the eyes copied into place.
+	 */
+	if (options->zeroCopy && options->stereoOutput == StereoOutput::SideBySide) {
+		std::cerr << "Side-by-side packing is not available with --zero-copy\n";
+		return -EINVAL;
+	}
+
+	/* The converter writes into ring slots, packed pairs are copied as is */
+	if (options->cpuConvert &&
+	    (options->zeroCopy || options->stereoOutput != StereoOutput::Left)) {
+		std::cerr << "--cpu-convert needs the copy path and a single stream\n";
+		return -EINVAL;
+	}
+
+	/* Rectified eyes are written into ring slots from the camera mappings */
+	if (!options->calibration.empty() &&
+	    (!options->stereo || options->zeroCopy || options->cpuConvert)) {
+		std::cerr << "--rectify needs --stereo and the copy path, without --cpu-convert\n";
+		return -EINVAL;
+	}
+
+	if (options->depth && options->calibration.empty()) {
+		std::cerr << "--disparity needs rectified pairs from --rectify\n";
+		return -EINVAL;
+	}
+
+	if (options->depthStream.port && !options->depth) {
+		std::cerr << "--depth-stream needs disparity maps from --disparity\n";
+		return -EINVAL;
+	}
+
+	/* Recordings are streamed as they were recorded, processing included */
+	if (!options->replayPath.empty() &&
+	    (options->stereo || options->zeroCopy || options->cpuConvert ||
+	     !options->recordPath.empty())) {
+		std::cerr << "--replay cannot be combined with capture options\n";
+		return -EINVAL;
+	}
+
+	/* The preview and the region of interest are applied by the camera */
+	if ((options->preview.port || !options->roi.isNull()) && !options->replayPath.empty()) {
+		std::cerr << "--preview and --roi need the cameras\n";
+		return -EINVAL;
+	}
+
+	/*
+	 * Raw frames are debayered into ring slots, the ISP that scales,
+	 * crops and converts is out of the path.
+	 */
+	if (options->raw != RawOutput::Off &&
+	    (options->zeroCopy || options->cpuConvert || options->preview.port ||
+	     !options->roi.isNull() || !options->replayPath.empty())) {
+		std::cerr << "--raw needs the cameras and the copy path, without --cpu-convert,\n"
+			  << "--preview or --roi\n";
+		return -EINVAL;
+	}
+
+	/* Shared frames come out of the ring of the copy path */
+	if (!options->shmPath.empty() &&
+	    (options->zeroCopy || !options->replayPath.empty())) {
+		std::cerr << "--shm needs the cameras and the copy path\n";
+		return -EINVAL;
+	}
+
+	/* A consumer holding every slot would starve the others */
+	if (!options->shmPath.empty() && options->shmFrames >= options->shmSlots) {
+		std::cerr << "--shm-frames has to be less than --shm-slots\n";
+		return -EINVAL;
+	}
+
+	/* Recordings are streamed as recorded, gated or not */
+	if (options->changeThreshold && !options->replayPath.empty()) {
+		std::cerr << "--change-gate needs the cameras\n";
+		return -EINVAL;
+	}
+
+	/* A recording has no capture frame rate to lower */
+	if (options->adaptation == Adaptation::FrameRate && !options->replayPath.empty()) {
+		std::cerr << "--adaptive=framerate needs the cameras\n";
+		return -EINVAL;
+	}
+
+	options->destIp = argv[optind];
+	options->destPort = atoi(argv[optind + 1]);
+
+	if (!options->minBitrate)
+		options->minBitrate = std::max(1u, options->encoder.bitrate / 4);
+	if (!options->rtcpPort)
+		options->rtcpPort = options->destPort + 1;
+
+	return 0;
+}
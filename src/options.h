@@ -0,0 +1,168 @@
+/*
+ * Command line options of the streaming application
+ */
+
+#pragma once
+
+#include <array>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/pixel_format.h>
+
+#include "depth_encoder.h"
+#include "disparity.h"
+#include "encoder.h"
+#include "frame_ring.h"
+#include "thread_placement.h"
+
+enum class PushMode {
+	/* Push from the GLib main loop as soon as the camera signals a frame */
+	Event,
+	/* Poll the ring from a 1/FPS GLib timer */
+	Timer,
+};
+
+enum class StereoOutput {
+	/* Stream the left eye only */
+	Left,
+	SideBySide,
+	TopBottom,
+};
+
+enum class ReplayPace {
+	/* Keep the recorded distance between frames */
+	Recorded,
+	/* As fast as the pipeline takes frames */
+	Max,
+};
+
+enum class RawOutput {
+	/* Capture the ISP output */
+	Off,
+	/* Average 2x2 Bayer quads into a gray frame of half the size */
+	Gray,
+	/* Interpolate the missing colours into a full size XRGB8888 frame */
+	Rgb,
+};
+
+enum class Adaptation {
+	/* Constant bitrate */
+	Off,
+	/* Follow RTCP receiver reports with the encoder bitrate */
+	Bitrate,
+	/* Lower the capture frame rate too once the bitrate is at its minimum */
+	FrameRate,
+};
+
+struct Destination {
+	std::string host;
+	uint16_t port;
+};
+
+struct Options {
+	std::string destIp;
+	int destPort = 0;
+	/* More unicast or multicast receivers of the same encoded stream */
+	std::vector<Destination> destinations;
+	/* Time to live of multicast packets, 0 for the GStreamer default */
+	unsigned int multicastTtl = 0;
+	/* Unix socket accepting runtime commands, none if empty */
+	std::string controlPath;
+
+	/* ISP-scaled second stream of the (left) camera, none if the port is 0 */
+	Destination preview = { "", 0 };
+	libcamera::Size previewSize = { 320, 240 };
+	unsigned int previewBitrate = 256; /* kbit/s */
+
+	/* Capture format and size, invalid or null to keep the camera's default */
+	libcamera::PixelFormat pixelFormat;
+	libcamera::Size size;
+	/* Sensor area streamed through ScalerCrop, null for the full field of view */
+	libcamera::Rectangle roi;
+	/* Debayer raw sensor frames on the CPU instead of using the ISP output */
+	RawOutput raw = RawOutput::Off;
+	/* Requested frame rate, clamped to the sensor mode's limits */
+	unsigned int fps = 30;
+
+	/* Requests per camera, 0 for the camera's default */
+	unsigned int buffers = 0;
+	/* Keep only as many requests in circulation as downstream needs */
+	bool tuneBuffers = false;
+
+	/* Hand FrameBuffer dmabufs to appsrc instead of copying frames */
+	bool zeroCopy = false;
+
+	/* Frame ring between the camera thread and the GStreamer side */
+	unsigned int ringSlots = 4;
+	FrameRing::DropPolicy dropPolicy = FrameRing::DropPolicy::DropOldest;
+
+	/* Map the frame arena from hugetlbfs pages */
+	bool hugePages = false;
+
+	PushMode pushMode = PushMode::Event;
+
+	/* Capture from both sensors and pair frames by sensor timestamp */
+	bool stereo = false;
+	int64_t pairTolerance = 5000000; /* ns */
+	StereoOutput stereoOutput = StereoOutput::Left;
+
+	/* Rectify stereo pairs with the calibration in this file */
+	std::string calibration;
+
+	/* Compute disparity maps from the rectified pairs */
+	bool depth = false;
+	DisparityEngine::Config disparity;
+	/* RTP stream of the disparity maps, none if the port is 0 */
+	Destination depthStream = { "", 0 };
+	DepthEncoder::Config depthEncoding;
+
+	/*
+	 * Stream only frames whose luma changed by more than this many levels
+	 * in a block, 0 streams every frame. A keyframe goes out at least every
+	 * heartbeat ms all the same.
+	 */
+	unsigned int changeThreshold = 0;
+	unsigned int heartbeat = 1000;
+
+	/* Convert XRGB8888 to I420 in the camera thread instead of videoconvert */
+	bool cpuConvert = false;
+
+	/* Threads splitting per-frame CPU work, including the camera thread */
+	unsigned int threads = 2;
+
+	/* CPUs and real-time priority of each group of threads */
+	std::array<ThreadPlacement, static_cast<unsigned int>(ThreadRole::Count)> placement;
+
+	EncoderConfig encoder;
+
+	/* Rate adaptation, from receiver reports sent to rtcpPort */
+	Adaptation adaptation = Adaptation::Off;
+	unsigned int minBitrate = 0; /* kbit/s, 0 for a quarter of the bitrate */
+	uint16_t rtcpPort = 0; /* 0 for the destination port + 1 */
+
+	/* Serve the statistics report on this TCP (HTTP) and UDP port, 0 for none */
+	uint16_t statsPort = 0;
+
+	/* Record raw frames to this file, with a ring of its own */
+	std::string recordPath;
+	unsigned int recordSlots = 8;
+
+	/*
+	 * Publish the frames of the ring to local consumers through shared
+	 * memory on this Unix socket, each holding at most shmFrames slots
+	 */
+	std::string shmPath;
+	unsigned int shmSlots = 8;
+	unsigned int shmFrames = 2;
+
+	/* Stream a recording instead of the cameras */
+	std::string replayPath;
+	ReplayPace replayPace = ReplayPace::Recorded;
+	bool replayLoop = false;
+};
+
+int parseOptions(int argc, char *argv[], Options *options);
+void printUsage(const char *argv0);
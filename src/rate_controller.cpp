@@ -0,0 +1,123 @@
+/*
+ * Encoder bitrate and frame rate adaptation from RTCP receiver reports
+ */
+
+#include "rate_controller.h"
+
+#include <algorithm>
+
+namespace {
+
+/* Loss above which the link is congested, and below which it is clean */
+constexpr double LossHigh = 0.05;
+constexpr double LossLow = 0.01;
+
+/* Round trip time above the base one, in microseconds */
+constexpr uint64_t QueueHigh = 50000;
+constexpr uint64_t QueueLow = 15000;
+
+constexpr uint64_t JitterLow = 20000;
+
+/* Cut to 3/4 when congested, grow by 1/10 when clean */
+constexpr unsigned int DecreaseNum = 3;
+constexpr unsigned int DecreaseDen = 4;
+constexpr unsigned int IncreaseDen = 10;
+
+constexpr unsigned int CleanReports = 3;
+
+/* Receivers tracked at most, the one silent the longest makes room */
+constexpr unsigned int MaxReceivers = 16;
+
+/* Nanoseconds before acting again after a decrease, or an increase */
+constexpr int64_t HoldDecrease = 1000000000;
+constexpr int64_t HoldIncrease = 3000000000;
+
+} /* namespace */
+
+RateController::RateController(const Config &config)
+	: config_(config)
+{
+	config_.minBitrate = std::min(config_.minBitrate, config_.maxBitrate);
+	target_ = { config_.maxBitrate, 0 };
+}
+
+bool RateController::update(uint32_t ssrc, const Report &report, int64_t now)
+{
+	auto it = receivers_.find(ssrc);
+	if (it == receivers_.end()) {
+		if (receivers_.size() >= MaxReceivers) {
+			auto oldest = std::min_element(receivers_.begin(), receivers_.end(),
+						       [](const auto &a, const auto &b) {
+							       return a.second.lastReport < b.second.lastReport;
+						       });
+			receivers_.erase(oldest);
+		}
+		it = receivers_.emplace(ssrc, Receiver{ 0, now }).first;
+	}
+
+	Receiver &receiver = it->second;
+	receiver.lastReport = now;
+
+	/*
+	 * The base drifts up slowly, so that a longer route after a handover
+	 * is not taken for queueing forever.
+	 */
+	if (report.rtt) {
+		receiver.baseRtt = receiver.baseRtt
+				 ? std::min(report.rtt, receiver.baseRtt + receiver.baseRtt / 64)
+				 : report.rtt;
+	}
+
+	const Target previous = target_;
+
+	if (congested(report, receiver.baseRtt)) {
+		cleanReports_ = 0;
+		if (lastChange_ && now - lastChange_ < HoldDecrease)
+			return false;
+
+		if (target_.bitrate > config_.minBitrate)
+			target_.bitrate = std::max(config_.minBitrate,
+						   target_.bitrate * DecreaseNum / DecreaseDen);
+		else if (config_.frameRate && target_.tier < MaxTier)
+			target_.tier++;
+	} else if (clean(report, receiver.baseRtt)) {
+		if (++cleanReports_ < CleanReports ||
+		    (lastChange_ && now - lastChange_ < HoldIncrease))
+			return false;
+
+		cleanReports_ = 0;
+		if (target_.tier)
+			target_.tier--;
+		else
+			target_.bitrate = std::min(config_.maxBitrate,
+						   target_.bitrate + std::max(1u, target_.bitrate / IncreaseDen));
+	} else {
+		cleanReports_ = 0;
+	}
+
+	if (target_.bitrate == previous.bitrate && target_.tier == previous.tier)
+		return false;
+
+	lastChange_ = now;
+	return true;
+}
+
+uint64_t RateController::baseRtt(uint32_t ssrc) const
+{
+	auto it = receivers_.find(ssrc);
+	return it != receivers_.end() ? it->second.baseRtt : 0;
+}
+
+bool RateController::congested(const Report &report, uint64_t baseRtt) const
+{
+	if (report.loss > LossHigh)
+		return true;
+
+	return report.rtt && report.rtt > baseRtt + QueueHigh;
+}
+
+bool RateController::clean(const Report &report, uint64_t baseRtt) const
+{
+	return report.loss < LossLow && report.jitter < JitterLow &&
+	       (!report.rtt || report.rtt < baseRtt + QueueLow);
+}
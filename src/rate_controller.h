@@ -0,0 +1,83 @@
+/*
+ * Encoder bitrate and frame rate adaptation from RTCP receiver reports
+ */
+
+#pragma once
+
+#include <map>
+#include <stdint.h>
+
+/*
+ * Turns the loss, jitter and round trip time of receiver reports into a
+ * target bitrate and frame rate tier. Congestion (loss, or a round trip time
+ * growing well past the lowest one seen, which is queueing in the network)
+ * cuts the bitrate multiplicatively at once; it only grows back in small
+ * steps after several clean reports in a row, and neither direction acts
+ * again before a hold time has passed. Reports between the two thresholds
+ * change nothing, which keeps the target from oscillating.
+ *
+ * Once the bitrate is at its minimum, further congestion halves the frame
+ * rate, up to MaxTier times. Recovery restores the frame rate first.
+ *
+ * Every receiver reports on its own, so the worst one drives the target.
+ * Each one is measured against its own base round trip time, a receiver
+ * far away is not queueing just because another one is close. Receivers
+ * are told apart by their SSRC. Not thread-safe, the caller serialises
+ * update().
+ */
+class RateController
+{
+public:
+	struct Config {
+		/* kbit/s */
+		unsigned int minBitrate;
+		unsigned int maxBitrate;
+		/* Allow lowering the frame rate below the minimum bitrate */
+		bool frameRate;
+	};
+
+	struct Report {
+		/* Fraction of packets lost since the previous report */
+		double loss;
+		/* Interarrival jitter and round trip time, in microseconds */
+		uint64_t jitter;
+		uint64_t rtt;
+	};
+
+	struct Target {
+		unsigned int bitrate;
+		/* Frame rate divided by 1 << tier */
+		unsigned int tier;
+	};
+
+	static constexpr unsigned int MaxTier = 2;
+
+	RateController(const Config &config);
+
+	/*
+	 * Returns true when the target changed. \a ssrc is the receiver the
+	 * report comes from, \a now is in nanoseconds.
+	 */
+	bool update(uint32_t ssrc, const Report &report, int64_t now);
+
+	const Target &target() const { return target_; }
+	/* Base round trip time of receiver \a ssrc, 0 if unknown */
+	uint64_t baseRtt(uint32_t ssrc) const;
+
+private:
+	struct Receiver {
+		/* Lowest round trip time seen, the path without queueing */
+		uint64_t baseRtt;
+		int64_t lastReport;
+	};
+
+	bool congested(const Report &report, uint64_t baseRtt) const;
+	bool clean(const Report &report, uint64_t baseRtt) const;
+
+	Config config_;
+	Target target_;
+
+	std::map<uint32_t, Receiver> receivers_;
+	unsigned int cleanReports_ = 0;
+	int64_t lastChange_ = 0;
+};
@@ -0,0 +1,162 @@
+/*
+ * On-disk format of raw frame recordings, and their playback
+ */
+
+#include "recording.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace libcamera;
+
+namespace {
+
+FrameLayout frameLayout(const RecordingLayout &recorded)
+{
+	if (!recorded.planes)
+		return {};
+
+	const PixelFormat format(recorded.fourcc);
+	FrameLayout layout = FrameLayout::create(format, Size(recorded.width, recorded.height),
+						 recorded.stride[0]);
+	if (layout.planes.size() != recorded.planes)
+		return {};
+
+	/* The camera's plane placement wins over the default one */
+	layout.frameSize = 0;
+	for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+		PlaneLayout &plane = layout.planes[i];
+		plane.offset = recorded.offset[i];
+		plane.stride = recorded.stride[i];
+		layout.frameSize = std::max(layout.frameSize,
+					    plane.offset + static_cast<size_t>(plane.stride) * plane.rows);
+	}
+
+	return layout;
+}
+
+} /* namespace */
+
+RecordingLayout recordingLayout(const FrameLayout *layout)
+{
+	RecordingLayout out = {};
+
+	if (!layout)
+		return out;
+
+	out.fourcc = layout->format.fourcc();
+	out.width = layout->size.width;
+	out.height = layout->size.height;
+	out.planes = std::min<size_t>(layout->planes.size(), 3);
+	for (unsigned int i = 0; i < out.planes; ++i) {
+		out.offset[i] = layout->planes[i].offset;
+		out.stride[i] = layout->planes[i].stride;
+	}
+
+	return out;
+}
+
+RecordingReader::RecordingReader()
+{
+}
+
+RecordingReader::~RecordingReader()
+{
+	if (data_)
+		munmap(data_, size_);
+}
+
+int RecordingReader::open(const std::string &path)
+{
+	const std::string indexPath = path + ".idx";
+	FILE *index = fopen(indexPath.c_str(), "rbe");
+	if (!index) {
+		int ret = -errno;
+		std::cerr << "Failed to open " << indexPath << ": " << strerror(-ret) << std::endl;
+		return ret;
+	}
+
+	RecordingHeader header;
+	if (fread(&header, sizeof(header), 1, index) != 1 ||
+	    memcmp(header.magic, RecordingMagic, sizeof(header.magic)) ||
+	    header.version != RecordingVersion) {
+		std::cerr << indexPath << " is not a recording index" << std::endl;
+		fclose(index);
+		return -EINVAL;
+	}
+
+	for (unsigned int eye = 0; eye < 2; ++eye)
+		layouts_[eye] = frameLayout(header.layout[eye]);
+	if (!layouts_[0].isValid()) {
+		std::cerr << "Unsupported frame layout in " << indexPath << std::endl;
+		fclose(index);
+		return -EINVAL;
+	}
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		int ret = -errno;
+		std::cerr << "Failed to open " << path << ": " << strerror(-ret) << std::endl;
+		if (fd >= 0)
+			::close(fd);
+		fclose(index);
+		return ret;
+	}
+
+	size_ = st.st_size;
+	void *data = size_ ? mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	::close(fd);
+	if (data == MAP_FAILED) {
+		std::cerr << "Failed to map " << path << std::endl;
+		fclose(index);
+		size_ = 0;
+		return -EINVAL;
+	}
+
+	data_ = static_cast<uint8_t *>(data);
+	/* Playback reads the file front to back */
+	madvise(data_, size_, MADV_SEQUENTIAL);
+
+	RecordingEntry entry;
+	while (fread(&entry, sizeof(entry), 1, index) == 1) {
+		if (entry.offset > size_ || entry.size > size_ - entry.offset)
+			break;
+		const uint32_t size = entry.rightOffset ? entry.rightOffset : entry.size;
+		if (size < layouts_[0].frameSize)
+			continue;
+		entries_.push_back(entry);
+	}
+	fclose(index);
+
+	if (entries_.empty()) {
+		std::cerr << path << " holds no complete frame" << std::endl;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+uint64_t RecordingReader::frameDuration() const
+{
+	std::vector<uint64_t> durations;
+
+	for (unsigned int i = 1; i < entries_.size(); ++i) {
+		if (entries_[i].timestamp > entries_[i - 1].timestamp)
+			durations.push_back(entries_[i].timestamp - entries_[i - 1].timestamp);
+	}
+
+	if (durations.empty())
+		return 0;
+
+	std::nth_element(durations.begin(), durations.begin() + durations.size() / 2,
+			 durations.end());
+	return durations[durations.size() / 2];
+}
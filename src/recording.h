@@ -0,0 +1,91 @@
+/*
+ * On-disk format of raw frame recordings, and their playback
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include "frame_layout.h"
+
+/*
+ * A recording is a data file of frames, each aligned to the header's
+ * alignment, and an index file (data file name + ".idx")
+ * holding a RecordingHeader followed by one RecordingEntry per frame. All
+ * fields are little-endian, as written by the device.
+ */
+struct RecordingLayout {
+	uint32_t fourcc;
+	uint32_t width;
+	uint32_t height;
+	/* 0 when the recording has no such image */
+	uint32_t planes;
+	uint32_t offset[3];
+	uint32_t stride[3];
+};
+
+struct RecordingHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t alignment;
+	/* Frame at offset 0 of an entry, and right eye at its rightOffset */
+	RecordingLayout layout[2];
+};
+
+struct RecordingEntry {
+	/* Sensor timestamp in nanoseconds */
+	uint64_t timestamp;
+	/* Position and size of the frame in the data file */
+	uint64_t offset;
+	uint32_t size;
+	/* Right eye of a stereo pair, 0 for mono or packed frames */
+	uint32_t rightOffset;
+	uint32_t sequence;
+	uint32_t fourcc;
+};
+
+/* Description of \a layout, with no planes for nullptr */
+RecordingLayout recordingLayout(const FrameLayout *layout);
+
+static_assert(sizeof(RecordingHeader) == 96, "recording header layout");
+static_assert(sizeof(RecordingEntry) == 32, "recording entry layout");
+
+constexpr char RecordingMagic[8] = { 'S', 'T', 'R', 'E', 'C', 0, 0, 0 };
+constexpr uint32_t RecordingVersion = 1;
+
+/*
+ * Maps the data file of a recording and loads its index. Frames are read in
+ * place from the mapping, entries pointing past the end of the data (a
+ * recording cut short) are left out.
+ */
+class RecordingReader
+{
+public:
+	RecordingReader();
+	~RecordingReader();
+
+	int open(const std::string &path);
+
+	unsigned int frames() const { return entries_.size(); }
+	const RecordingEntry &entry(unsigned int index) const { return entries_[index]; }
+	const uint8_t *frame(unsigned int index) const { return data_ + entries_[index].offset; }
+
+	/* Layout of the frame, and of the right eye (invalid if there is none) */
+	const FrameLayout &layout(unsigned int eye) const { return layouts_[eye]; }
+
+	/* Median distance between frame timestamps in nanoseconds, 0 if unknown */
+	uint64_t frameDuration() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY(RecordingReader)
+
+	uint8_t *data_ = nullptr;
+	size_t size_ = 0;
+	std::vector<RecordingEntry> entries_;
+	FrameLayout layouts_[2];
+};
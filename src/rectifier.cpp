@@ -0,0 +1,277 @@
+/*
+ * Stereo rectification through precomputed fixed-point remap tables
+ */
+
+#include "rectifier.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <libcamera/formats.h>
+
+#include "thread_pool.h"
+
+using namespace libcamera;
+
+namespace {
+
+constexpr unsigned int FracOne = 1 << Rectifier::FracBits;
+
+/*
+ * Bilinear interpolation in two rounded passes, first along x then along y,
+ * so that the NEON kernel can stay in 16 bits and match the scalar one.
+ */
+inline uint8_t lerp(unsigned int a, unsigned int b, unsigned int frac)
+{
+	return (a * (FracOne - frac) + b * frac + FracOne / 2) >> Rectifier::FracBits;
+}
+
+inline uint8_t bilinear(const uint8_t *p, unsigned int step, unsigned int stride,
+			unsigned int fx, unsigned int fy)
+{
+	uint8_t top = lerp(p[0], p[step], fx);
+	uint8_t bottom = lerp(p[stride], p[stride + step], fx);
+	return lerp(top, bottom, fy);
+}
+
+} /* namespace */
+
+/*
+ * Only formats whose planes are 8-bit samples on a regular grid can be
+ * remapped; YUYV mixes luma and chroma within a plane and is refused.
+ */
+Rectifier::Rectifier(const StereoCalibration &calibration, const FrameLayout &layout)
+	: layout_(layout), calibration_(calibration.scaled(layout.size))
+{
+	rectification_ = StereoRectification::compute(calibration_);
+
+	struct Plane {
+		unsigned int channels;
+		unsigned int hSub;
+		unsigned int vSub;
+	};
+	std::vector<Plane> planes;
+
+	const PixelFormat &format = layout.format;
+	if (format == formats::XRGB8888 || format == formats::XBGR8888)
+		planes = { { 4, 1, 1 } };
+	else if (format == formats::RGB888 || format == formats::BGR888)
+		planes = { { 3, 1, 1 } };
+	else if (format == formats::R8)
+		planes = { { 1, 1, 1 } };
+	else if (format == formats::YUV420 || format == formats::YVU420)
+		planes = { { 1, 1, 1 }, { 1, 2, 2 }, { 1, 2, 2 } };
+	else if (format == formats::NV12 || format == formats::NV21)
+		planes = { { 1, 1, 1 }, { 2, 2, 2 } };
+
+	if (planes.size() != layout.planes.size() ||
+	    layout.size.width < 4 || layout.size.height < 4)
+		return;
+
+	for (unsigned int eye = 0; eye < 2; ++eye) {
+		for (const Plane &plane : planes) {
+			PlaneMap map;
+			map.channels = plane.channels;
+			map.width = (layout.size.width + plane.hSub - 1) / plane.hSub;
+			map.height = (layout.size.height + plane.vSub - 1) / plane.vSub;
+			buildMap(eye, &map, plane.hSub, plane.vSub);
+			maps_[eye].push_back(std::move(map));
+		}
+	}
+}
+
+size_t Rectifier::tableSize() const
+{
+	size_t size = 0;
+
+	for (const std::vector<PlaneMap> &maps : maps_)
+		for (const PlaneMap &map : maps)
+			size += map.entries.size() * sizeof(Entry);
+
+	return size;
+}
+
+/*
+ * Same model as OpenCV's initUndistortRectifyMap(): a rectified pixel is
+ * turned back into a ray of the eye's camera, distorted and projected with
+ * its own intrinsics. Subsampled planes map their sample centres through
+ * full resolution coordinates.
+ */
+void Rectifier::buildMap(unsigned int eye, PlaneMap *map, unsigned int hSub,
+			 unsigned int vSub) const
+{
+	const CameraCalibration &cam = calibration_.eye[eye];
+	const StereoRectification &rect = rectification_;
+	const double *R = rect.R[eye];
+	const double *D = cam.D;
+	const double hOffset = (hSub - 1) / 2.0;
+	const double vOffset = (vSub - 1) / 2.0;
+
+	const unsigned int bands = (map->height + TileRows - 1) / TileRows;
+	map->entries.reserve(static_cast<size_t>(map->width) * map->height);
+	map->bands.reserve(bands + 1);
+
+	for (unsigned int band = 0; band < bands; ++band) {
+		const unsigned int y0 = band * TileRows;
+		const unsigned int y1 = std::min(y0 + TileRows, map->height);
+		map->bands.push_back(map->entries.size());
+
+		for (unsigned int x0 = 0; x0 < map->width; x0 += TileColumns) {
+			const unsigned int x1 = std::min(x0 + TileColumns, map->width);
+
+			for (unsigned int v = y0; v < y1; ++v) {
+				for (unsigned int u = x0; u < x1; ++u) {
+					const double ray[3] = {
+						(u * hSub + hOffset - rect.cx) / rect.focal,
+						(v * vSub + vOffset - rect.cy) / rect.focal,
+						1.0,
+					};
+
+					/* R is orthonormal, its transpose takes rays back */
+					const double X = R[0] * ray[0] + R[3] * ray[1] + R[6];
+					const double Y = R[1] * ray[0] + R[4] * ray[1] + R[7];
+					const double W = R[2] * ray[0] + R[5] * ray[1] + R[8];
+					const double x = X / W;
+					const double y = Y / W;
+
+					const double r2 = x * x + y * y;
+					const double radial = 1 + r2 * (D[0] + r2 * (D[1] + r2 * D[4]));
+					const double xd = x * radial + 2 * D[2] * x * y + D[3] * (r2 + 2 * x * x);
+					const double yd = y * radial + D[2] * (r2 + 2 * y * y) + 2 * D[3] * x * y;
+
+					double sx = cam.K[0] * xd + cam.K[1] * yd + cam.K[2];
+					double sy = cam.K[4] * yd + cam.K[5];
+					sx = (sx - hOffset) / hSub;
+					sy = (sy - vOffset) / vSub;
+
+					/*
+					 * The top-left sample stays one short of the
+					 * last row and column, pixels beyond the
+					 * edges repeat the border.
+					 */
+					sx = std::clamp(sx, 0.0, map->width - 1.0);
+					sy = std::clamp(sy, 0.0, map->height - 1.0);
+
+					unsigned int ix = std::min<unsigned int>(sx, map->width - 2);
+					unsigned int iy = std::min<unsigned int>(sy, map->height - 2);
+					unsigned int fx = lround((sx - ix) * FracOne);
+					unsigned int fy = lround((sy - iy) * FracOne);
+
+					if (fx == FracOne && ix < map->width - 2) {
+						ix++;
+						fx = 0;
+					}
+					if (fy == FracOne && iy < map->height - 2) {
+						iy++;
+						fy = 0;
+					}
+
+					map->entries.push_back({ static_cast<uint16_t>(ix),
+								 static_cast<uint16_t>(iy),
+								 static_cast<uint16_t>(fx | fy << 8) });
+				}
+			}
+		}
+	}
+
+	map->bands.push_back(map->entries.size());
+}
+
+void Rectifier::remapBand(const PlaneMap &map, unsigned int band,
+			  const uint8_t *src, unsigned int srcStride,
+			  uint8_t *dst, unsigned int dstStride) const
+{
+	const unsigned int channels = map.channels;
+	const unsigned int y0 = band * TileRows;
+	const unsigned int y1 = std::min(y0 + TileRows, map.height);
+	const Entry *entry = map.entries.data() + map.bands[band];
+
+	for (unsigned int x0 = 0; x0 < map.width; x0 += TileColumns) {
+		const unsigned int width = std::min(TileColumns, map.width - x0);
+
+		for (unsigned int y = y0; y < y1; ++y) {
+			uint8_t *out = dst + y * static_cast<size_t>(dstStride) + x0 * channels;
+			unsigned int x = 0;
+
+#if defined(__ARM_NEON)
+			/*
+			 * There is no gather, the neighbours are loaded one
+			 * by one and the weights applied eight pixels at a
+			 * time.
+			 */
+			for (; channels == 1 && x + 8 <= width; x += 8, entry += 8) {
+				uint8_t p[4][8];
+
+				for (unsigned int i = 0; i < 8; ++i) {
+					const uint8_t *s = src + entry[i].y * static_cast<size_t>(srcStride) + entry[i].x;
+					p[0][i] = s[0];
+					p[1][i] = s[1];
+					p[2][i] = s[srcStride];
+					p[3][i] = s[srcStride + 1];
+				}
+
+				const uint16x8_t frac = vld3q_u16(&entry->x).val[2];
+				const uint8x8_t fx = vmovn_u16(frac);
+				const uint8x8_t fy = vshrn_n_u16(frac, 8);
+				const uint8x8_t one = vdup_n_u8(FracOne);
+				const uint8x8_t gx = vsub_u8(one, fx);
+				const uint8x8_t gy = vsub_u8(one, fy);
+
+				uint8x8_t top = vrshrn_n_u16(vmlal_u8(vmull_u8(vld1_u8(p[0]), gx),
+								     vld1_u8(p[1]), fx), FracBits);
+				uint8x8_t bottom = vrshrn_n_u16(vmlal_u8(vmull_u8(vld1_u8(p[2]), gx),
+									vld1_u8(p[3]), fx), FracBits);
+				uint8x8_t value = vrshrn_n_u16(vmlal_u8(vmull_u8(top, gy),
+									bottom, fy), FracBits);
+
+				vst1_u8(out + x, value);
+			}
+#endif
+
+			for (; x < width; ++x, ++entry) {
+				const uint8_t *s = src + entry->y * static_cast<size_t>(srcStride)
+						 + entry->x * channels;
+				const unsigned int fx = entry->frac & 0xff;
+				const unsigned int fy = entry->frac >> 8;
+
+				for (unsigned int c = 0; c < channels; ++c)
+					out[x * channels + c] = bilinear(s + c, channels,
+									 srcStride, fx, fy);
+			}
+		}
+	}
+}
+
+void Rectifier::process(unsigned int eye, const Image &image, uint8_t *const dst[],
+			const unsigned int strides[], ThreadPool *pool) const
+{
+	const std::vector<PlaneMap> &maps = maps_[eye];
+	unsigned int tasks = 0;
+
+	for (const PlaneMap &map : maps)
+		tasks += map.bands.size() - 1;
+
+	ImageAccess access(image, (1U << maps.size()) - 1, Image::MapMode::ReadOnly);
+
+	auto task = [&](unsigned int index) {
+		unsigned int plane = 0;
+		while (index >= maps[plane].bands.size() - 1)
+			index -= maps[plane++].bands.size() - 1;
+
+		const PlaneView<const uint8_t> src = image.plane(plane);
+		remapBand(maps[plane], index, src.data, src.stride, dst[plane],
+			  strides[plane]);
+	};
+
+	if (!pool) {
+		for (unsigned int i = 0; i < tasks; ++i)
+			task(i);
+		return;
+	}
+
+	pool->run(tasks, task);
+}
@@ -0,0 +1,84 @@
+/*
+ * Stereo rectification through precomputed fixed-point remap tables
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include "frame_layout.h"
+#include "image.h"
+#include "stereo_calibration.h"
+
+class ThreadPool;
+
+/*
+ * Remaps each eye into the rectified frame with bilinear interpolation, for
+ * all planes of 8-bit gray, planar, semi-planar and packed RGB formats.
+ * Tables are computed once; process() only reads them.
+ */
+class Rectifier
+{
+public:
+	Rectifier(const StereoCalibration &calibration, const FrameLayout &layout);
+
+	bool isValid() const { return !maps_[0].empty(); }
+
+	const FrameLayout &layout() const { return layout_; }
+	const StereoRectification &rectification() const { return rectification_; }
+
+	/* Bytes of remap tables, both eyes and all planes */
+	size_t tableSize() const;
+
+	/*
+	 * Rectify one eye of \a image (in layout()) into the planes at \a dst,
+	 * which are laid out with \a strides. Each band of tile rows is a task
+	 * of \a pool.
+	 */
+	void process(unsigned int eye, const Image &image, uint8_t *const dst[],
+		     const unsigned int strides[], ThreadPool *pool = nullptr) const;
+
+	/* Rows of a band, and columns of a tile within it */
+	static constexpr unsigned int TileRows = 16;
+	static constexpr unsigned int TileColumns = 64;
+	/* Fractional bits of the interpolation weights */
+	static constexpr unsigned int FracBits = 7;
+
+private:
+	LIBCAMERA_DISABLE_COPY(Rectifier)
+
+	/* Top-left source sample and weights (fx | fy << 8) of a destination pixel */
+	struct Entry {
+		uint16_t x;
+		uint16_t y;
+		uint16_t frac;
+	};
+
+	struct PlaneMap {
+		unsigned int width;
+		unsigned int height;
+		/* Interleaved samples per pixel */
+		unsigned int channels;
+		/*
+		 * Entries are stored band by band, tile by tile within a band
+		 * and row by row within a tile, in the order process() reads
+		 * them.
+		 */
+		std::vector<Entry> entries;
+		std::vector<size_t> bands;
+	};
+
+	void buildMap(unsigned int eye, PlaneMap *map, unsigned int hSub,
+		      unsigned int vSub) const;
+	void remapBand(const PlaneMap &map, unsigned int band, const uint8_t *src,
+		       unsigned int srcStride, uint8_t *dst,
+		       unsigned int dstStride) const;
+
+	FrameLayout layout_;
+	StereoCalibration calibration_;
+	StereoRectification rectification_;
+	std::vector<PlaneMap> maps_[2];
+};
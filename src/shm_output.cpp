@@ -0,0 +1,354 @@
+/*
+ * Shared-memory frame output for consumers on the same board
+ */
+
+#include "shm_output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Linux 5.1, missing from older C libraries */
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+namespace {
+
+constexpr size_t PageSize = 4096;
+
+size_t alignUp(size_t value)
+{
+	return (value + PageSize - 1) & ~(PageSize - 1);
+}
+
+} /* namespace */
+
+/* Slots start on page boundaries, so that consumers get aligned rows */
+ShmOutput::ShmOutput(unsigned int slots, size_t slotSize, unsigned int maxHeld)
+	: slots_(slots), slotSize_(alignUp(slotSize)), maxHeld_(maxHeld),
+	  refs_(slots, 0)
+{
+}
+
+ShmOutput::~ShmOutput()
+{
+	stop();
+}
+
+int ShmOutput::start(const std::string &path, const FrameLayout &layout,
+		     const FrameLayout *right)
+{
+	struct sockaddr_un addr = {};
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+
+	int ret = createMemory();
+	if (ret < 0) {
+		stop();
+		return ret;
+	}
+
+	memcpy(hello_.magic, ShmMagic, sizeof(ShmMagic));
+	hello_.version = ShmVersion;
+	hello_.slots = slots_;
+	hello_.slotSize = slotSize_;
+	hello_.layout[0] = recordingLayout(&layout);
+	hello_.layout[1] = recordingLayout(right);
+
+	wake_ = eventfd(0, EFD_CLOEXEC);
+	fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (wake_ < 0 || fd_ < 0) {
+		ret = -errno;
+		stop();
+		return ret;
+	}
+
+	/* A socket left behind by a previous run would make bind() fail */
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	unlink(path.c_str());
+
+	if (bind(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+	    listen(fd_, 4) < 0) {
+		ret = -errno;
+		stop();
+		return ret;
+	}
+
+	path_ = path;
+	thread_ = std::thread(&ShmOutput::run, this);
+
+	return 0;
+}
+
+/*
+ * The memory is faulted in up front, the frame path then takes no page
+ * fault. A descriptor alone does not keep consumers from writing, they
+ * could reopen it read-write through /proc. Once the producer has its
+ * mapping the memfd is sealed against any later writable mapping or
+ * write(), and the seals themselves are sealed.
+ */
+int ShmOutput::createMemory()
+{
+	const size_t size = slotSize_ * slots_;
+
+	memfd_ = memfd_create("stereo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd_ < 0 || ftruncate(memfd_, size) < 0 ||
+	    fcntl(memfd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+		return -errno;
+
+	void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, memfd_, 0);
+	if (data == MAP_FAILED)
+		return -errno;
+	data_ = static_cast<uint8_t *>(data);
+
+	if (fcntl(memfd_, F_ADD_SEALS, F_SEAL_FUTURE_WRITE) < 0 ||
+	    fcntl(memfd_, F_ADD_SEALS, F_SEAL_SEAL) < 0)
+		return -errno;
+
+	char proc[32];
+	snprintf(proc, sizeof(proc), "/proc/self/fd/%d", memfd_);
+	readOnly_ = open(proc, O_RDONLY | O_CLOEXEC);
+	if (readOnly_ < 0)
+		return -errno;
+
+	return 0;
+}
+
+void ShmOutput::stop()
+{
+	if (thread_.joinable()) {
+		uint64_t one = 1;
+		if (write(wake_, &one, sizeof(one)) == sizeof(one))
+			thread_.join();
+		else
+			thread_.detach();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		while (!clients_.empty())
+			removeClient(clients_.back().get());
+	}
+
+	if (fd_ >= 0) {
+		close(fd_);
+		if (!path_.empty())
+			unlink(path_.c_str());
+	}
+	fd_ = -1;
+
+	if (wake_ >= 0)
+		close(wake_);
+	wake_ = -1;
+
+	if (data_)
+		munmap(data_, slotSize_ * slots_);
+	data_ = nullptr;
+
+	if (readOnly_ >= 0)
+		close(readOnly_);
+	if (memfd_ >= 0)
+		close(memfd_);
+	readOnly_ = memfd_ = -1;
+}
+
+/*
+ * Clients are only added and removed here, the ones polled stay valid until
+ * their events are handled. The eventfd is only written to stop.
+ */
+void ShmOutput::run()
+{
+	std::vector<struct pollfd> fds;
+	std::vector<Client *> polled;
+
+	while (true) {
+		fds.clear();
+		polled.clear();
+		fds.push_back({ wake_, POLLIN, 0 });
+		fds.push_back({ fd_, POLLIN, 0 });
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			for (const std::unique_ptr<Client> &client : clients_) {
+				fds.push_back({ client->fd, POLLIN, 0 });
+				polled.push_back(client.get());
+			}
+		}
+
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		if (fds[0].revents)
+			return;
+
+		if (fds[1].revents & POLLIN)
+			accept();
+
+		for (unsigned int i = 0; i < polled.size(); ++i) {
+			if (fds[i + 2].revents && !receive(polled[i])) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				removeClient(polled[i]);
+			}
+		}
+	}
+}
+
+int ShmOutput::sendHello(int fd) const
+{
+	char control[CMSG_SPACE(sizeof(int))] = {};
+	struct iovec iov = { const_cast<ShmHello *>(&hello_), sizeof(hello_) };
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &readOnly_, sizeof(int));
+
+	return sendmsg(fd, &msg, MSG_NOSIGNAL) < 0 ? -errno : 0;
+}
+
+void ShmOutput::accept()
+{
+	int fd = accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	/* A new socket has room for the hello, there is nothing to wait for */
+	if (sendHello(fd) < 0) {
+		close(fd);
+		return;
+	}
+
+	auto client = std::make_unique<Client>();
+	client->fd = fd;
+	client->held.assign(slots_, false);
+	client->holding = 0;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	clients_.push_back(std::move(client));
+}
+
+/* Returns false once the consumer is gone: EOF, or an error */
+bool ShmOutput::receive(Client *client)
+{
+	ShmRelease release;
+	ssize_t ret;
+
+	while ((ret = recv(client->fd, &release, sizeof(release), 0)) > 0) {
+		if (ret != sizeof(release))
+			continue;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		this->release(client, release.slot);
+	}
+
+	return ret < 0 && (errno == EAGAIN || errno == EINTR);
+}
+
+/* Releases of slots the consumer does not hold are ignored */
+void ShmOutput::release(Client *client, uint32_t slot)
+{
+	if (slot >= slots_ || !client->held[slot])
+		return;
+
+	client->held[slot] = false;
+	client->holding--;
+	refs_[slot]--;
+}
+
+/* Called with the mutex held, the slots the consumer held are free again */
+void ShmOutput::removeClient(Client *client)
+{
+	for (unsigned int slot = 0; slot < slots_; ++slot)
+		release(client, slot);
+
+	close(client->fd);
+
+	for (auto it = clients_.begin(); it != clients_.end(); ++it) {
+		if (it->get() == client) {
+			clients_.erase(it);
+			break;
+		}
+	}
+}
+
+/*
+ * Free slots are taken in turn, which leaves a released frame intact for as
+ * long as possible. Nothing is copied if no consumer can take the frame, and
+ * the copy runs unlocked, with a reference keeping the slot to itself.
+ */
+void ShmOutput::publish(const FrameSlot &slot)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	if (clients_.empty())
+		return;
+
+	unsigned int wanting = 0;
+	for (const std::unique_ptr<Client> &client : clients_)
+		wanting += client->holding < maxHeld_;
+
+	unsigned int index = slots_;
+	for (unsigned int i = 0; i < slots_ && index == slots_; ++i) {
+		if (!refs_[(next_ + i) % slots_])
+			index = (next_ + i) % slots_;
+	}
+
+	if (!wanting || index == slots_ || slot.bytesused > slotSize_) {
+		dropped_ += clients_.size();
+		return;
+	}
+
+	next_ = (index + 1) % slots_;
+	refs_[index]++;
+	lock.unlock();
+
+	memcpy(data_ + index * slotSize_, slot.data.data(), slot.bytesused);
+
+	lock.lock();
+	refs_[index]--;
+	published_++;
+
+	ShmFrame frame;
+	frame.slot = index;
+	frame.size = slot.bytesused;
+	frame.rightOffset = slot.rightOffset;
+	frame.sequence = slot.sequence;
+	frame.timestamp = slot.timestamp;
+	frame.duration = slot.duration;
+
+	/* A full socket is a consumer that is behind, it misses this frame */
+	for (const std::unique_ptr<Client> &client : clients_) {
+		if (client->holding >= maxHeld_ ||
+		    send(client->fd, &frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+			dropped_++;
+			continue;
+		}
+
+		client->held[index] = true;
+		client->holding++;
+		refs_[index]++;
+	}
+}
+
+ShmOutput::Stats ShmOutput::stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return { static_cast<unsigned int>(clients_.size()), published_, dropped_ };
+}
@@ -0,0 +1,149 @@
+/*
+ * Shared-memory frame output for consumers on the same board
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include "frame_layout.h"
+#include "frame_ring.h"
+#include "recording.h"
+
+/*
+ * Messages of the output socket, in host byte order. A consumer receives a
+ * ShmHello with the descriptor of the shared memory as SCM_RIGHTS when it
+ * connects, then a ShmFrame for every frame handed over to it, and sends a
+ * ShmRelease back once it is done with the slot.
+ */
+struct ShmHello {
+	char magic[8];
+	uint32_t version;
+	uint32_t slots;
+	/* Slot n starts at n * slotSize in the shared memory */
+	uint64_t slotSize;
+	/* Frame at offset 0 of a slot, and right eye at its rightOffset */
+	RecordingLayout layout[2];
+};
+
+struct ShmFrame {
+	uint32_t slot;
+	uint32_t size;
+	/* Right eye of a stereo pair, 0 for mono or packed frames */
+	uint32_t rightOffset;
+	uint32_t sequence;
+	/* Sensor timestamp and frame duration in nanoseconds, 0 if unknown */
+	uint64_t timestamp;
+	uint64_t duration;
+};
+
+struct ShmRelease {
+	uint32_t slot;
+};
+
+static_assert(sizeof(ShmHello) == 104, "shm hello layout");
+static_assert(sizeof(ShmFrame) == 32, "shm frame layout");
+
+constexpr char ShmMagic[8] = { 'S', 'T', 'S', 'H', 'M', 0, 0, 0 };
+constexpr uint32_t ShmVersion = 1;
+
+/*
+ * Publishes frames in a ring of slots in one memfd, which consumers map once
+ * and read in place: nothing is encoded, decoded or copied on their side.
+ * The memfd is sealed against resizing, and against writes by anyone but
+ * the producer (F_SEAL_FUTURE_WRITE, Linux 5.1), so a consumer cannot
+ * corrupt what the others read. The price is /dev/udmabuf: it takes sealed
+ * memfds but refuses write seals, so consumers cannot turn the slots into
+ * a dmabuf. Consumers connect to a Unix seqpacket socket, map the
+ * descriptor that comes with the ShmHello with PROT_READ, and read the
+ * slot of every ShmFrame in place until they release it.
+ *
+ * The producer calls publish() as it fills the capture ring, whatever the
+ * network stream does with the frame afterwards. A frame is copied into a
+ * slot no consumer holds and handed to every consumer that holds fewer than
+ * maxHeld slots and whose socket has room for the message. The others miss
+ * it, counted as dropped, so a slow consumer only loses frames of its own
+ * and never holds up the producer. When every slot is held the frame is
+ * dropped for all of them.
+ *
+ * Connections and releases are handled by a thread of the output, so that
+ * slots come back while the main loop is busy pushing to the network.
+ * publish() does not allocate, and only contends with that thread for the
+ * short bookkeeping around the copy.
+ */
+class ShmOutput
+{
+public:
+	struct Stats {
+		unsigned int consumers;
+		uint64_t published;
+		/* Frames consumers missed, summed over consumers */
+		uint64_t dropped;
+	};
+
+	ShmOutput(unsigned int slots, size_t slotSize, unsigned int maxHeld);
+	~ShmOutput();
+
+	/* \a right is the layout of the right eye of pairs, nullptr if none */
+	int start(const std::string &path, const FrameLayout &layout,
+		  const FrameLayout *right);
+
+	/* Hand a copy of \a slot to the consumers, if there are any */
+	void publish(const FrameSlot &slot);
+
+	Stats stats() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY(ShmOutput)
+
+	struct Client {
+		int fd;
+		/* Slots handed over and not released yet */
+		std::vector<bool> held;
+		unsigned int holding;
+	};
+
+	void run();
+	void accept();
+	bool receive(Client *client);
+
+	int createMemory();
+	int sendHello(int fd) const;
+	void release(Client *client, uint32_t slot);
+	void removeClient(Client *client);
+	void stop();
+
+	const unsigned int slots_;
+	const size_t slotSize_;
+	const unsigned int maxHeld_;
+
+	/* Guards the slot references, the clients and the counters */
+	mutable std::mutex mutex_;
+
+	int memfd_ = -1;
+	/* Descriptor of the memfd opened read-only, as sent to consumers */
+	int readOnly_ = -1;
+	uint8_t *data_ = nullptr;
+	/* Consumers holding each slot, and the first slot tried next */
+	std::vector<unsigned int> refs_;
+	unsigned int next_ = 0;
+	ShmHello hello_ = {};
+
+	int fd_ = -1;
+	/* eventfd waking the thread up to stop */
+	int wake_ = -1;
+	std::string path_;
+	std::vector<std::unique_ptr<Client>> clients_;
+	std::thread thread_;
+
+	uint64_t published_ = 0;
+	uint64_t dropped_ = 0;
+};
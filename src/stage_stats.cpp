@@ -0,0 +1,107 @@
+/*
+ * Lock-free latency histograms of the capture and streaming stages
+ */
+
+#include "stage_stats.h"
+
+#include <algorithm>
+
+const char *stageName(Stage stage)
+{
+	switch (stage) {
+	case Stage::Completion:
+		return "completion";
+	case Stage::Ring:
+		return "ring";
+	case Stage::Push:
+		return "push";
+	case Stage::Encoded:
+		return "encoded";
+	case Stage::Sent:
+		return "sent";
+	default:
+		return "unknown";
+	}
+}
+
+LatencyHistogram::LatencyHistogram()
+	: max_(0)
+{
+	for (std::atomic<uint32_t> &count : buckets_)
+		count.store(0, std::memory_order_relaxed);
+}
+
+/* Values below 8 get a bucket each, then 8 buckets per power of two */
+unsigned int LatencyHistogram::bucket(uint64_t value)
+{
+	if (value < (1U << SubBits))
+		return value;
+
+	const unsigned int msb = 63 - __builtin_clzll(value);
+	const unsigned int shift = msb - SubBits;
+	const unsigned int sub = (value >> shift) & ((1U << SubBits) - 1);
+
+	return ((shift + 1) << SubBits) + sub;
+}
+
+uint64_t LatencyHistogram::upperBound(unsigned int index)
+{
+	if (index < (1U << SubBits))
+		return index;
+
+	const unsigned int shift = (index >> SubBits) - 1;
+	const uint64_t sub = index & ((1U << SubBits) - 1);
+
+	return (((1ULL << SubBits) + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+	buckets_[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t max = max_.load(std::memory_order_relaxed);
+	while (us > max &&
+	       !max_.compare_exchange_weak(max, us, std::memory_order_relaxed))
+		;
+}
+
+/*
+ * Buckets are drained one by one, a value recorded meanwhile lands either in
+ * this interval or in the next one but is never lost.
+ */
+LatencyHistogram::Summary LatencyHistogram::take()
+{
+	uint32_t counts[Buckets];
+	Summary summary = {};
+
+	for (unsigned int i = 0; i < Buckets; ++i) {
+		counts[i] = buckets_[i].exchange(0, std::memory_order_relaxed);
+		summary.count += counts[i];
+	}
+	summary.max = max_.exchange(0, std::memory_order_relaxed);
+
+	if (!summary.count)
+		return summary;
+
+	const uint64_t p50 = (summary.count + 1) / 2;
+	const uint64_t p99 = summary.count - summary.count / 100;
+	uint64_t seen = 0;
+	bool median = false;
+
+	for (unsigned int i = 0; i < Buckets; ++i) {
+		if (!counts[i])
+			continue;
+
+		seen += counts[i];
+		if (!median && seen >= p50) {
+			summary.p50 = std::min(upperBound(i), summary.max);
+			median = true;
+		}
+		if (seen >= p99) {
+			summary.p99 = std::min(upperBound(i), summary.max);
+			break;
+		}
+	}
+
+	return summary;
+}
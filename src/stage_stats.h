@@ -0,0 +1,57 @@
+/*
+ * Lock-free latency histograms of the capture and streaming stages
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/* Points along the path of a frame, each measured from its sensor timestamp */
+enum class Stage {
+	/* Request completion in the camera thread */
+	Completion,
+	/* Frame committed to the ring (copy path) */
+	Ring,
+	/* Buffer handed to appsrc */
+	Push,
+	/* Access unit leaving the encoder */
+	Encoded,
+	/* RTP packet reaching udpsink */
+	Sent,
+	Count,
+};
+
+const char *stageName(Stage stage);
+
+/*
+ * Log-linear buckets of 8 per power of two, so that percentiles are within
+ * 12.5% of the recorded values. record() can be called from any thread;
+ * take() is meant for a single reader and restarts the interval.
+ */
+class LatencyHistogram
+{
+public:
+	/* All values in microseconds */
+	struct Summary {
+		uint64_t count;
+		uint64_t p50;
+		uint64_t p99;
+		uint64_t max;
+	};
+
+	LatencyHistogram();
+
+	void record(uint64_t us);
+	Summary take();
+
+private:
+	static constexpr unsigned int SubBits = 3;
+	static constexpr unsigned int Buckets = (64 - SubBits + 1) << SubBits;
+
+	static unsigned int bucket(uint64_t value);
+	static uint64_t upperBound(unsigned int bucket);
+
+	std::atomic<uint32_t> buckets_[Buckets];
+	std::atomic<uint64_t> max_;
+};
@@ -0,0 +1,132 @@
+/*
+ * Statistics endpoint serving the latest report over HTTP and UDP
+ */
+
+#include "stats_server.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+
+namespace {
+
+int openSocket(int type, uint16_t port)
+{
+	int fd = socket(AF_INET, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+	    (type == SOCK_STREAM && listen(fd, 4) < 0)) {
+		int ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+} /* namespace */
+
+StatsServer::StatsServer()
+{
+}
+
+StatsServer::~StatsServer()
+{
+	stop();
+}
+
+int StatsServer::start(uint16_t port)
+{
+	tcp_ = openSocket(SOCK_STREAM, port);
+	if (tcp_ < 0) {
+		int ret = tcp_;
+		tcp_ = -1;
+		return ret;
+	}
+
+	udp_ = openSocket(SOCK_DGRAM, port);
+	if (udp_ < 0) {
+		int ret = udp_;
+		udp_ = -1;
+		stop();
+		return ret;
+	}
+
+	tcpWatch_ = g_unix_fd_add(tcp_, G_IO_IN, onConnection, this);
+	udpWatch_ = g_unix_fd_add(udp_, G_IO_IN, onDatagram, this);
+
+	return 0;
+}
+
+void StatsServer::stop()
+{
+	if (tcpWatch_)
+		g_source_remove(tcpWatch_);
+	if (udpWatch_)
+		g_source_remove(udpWatch_);
+	tcpWatch_ = udpWatch_ = 0;
+
+	if (tcp_ >= 0)
+		close(tcp_);
+	if (udp_ >= 0)
+		close(udp_);
+	tcp_ = udp_ = -1;
+}
+
+/*
+ * The request is not parsed: clients are expected to send it in one go, and
+ * whatever has arrived is read and discarded before replying. The response
+ * fits in the socket buffer, so the non-blocking write completes at once.
+ */
+gboolean StatsServer::onConnection(gint fd, GIOCondition condition, gpointer data)
+{
+	StatsServer *server = static_cast<StatsServer *>(data);
+
+	int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (client < 0)
+		return TRUE;
+
+	char request[1024];
+	while (read(client, request, sizeof(request)) > 0)
+		;
+
+	std::string response = "HTTP/1.0 200 OK\r\n"
+			       "Content-Type: application/json\r\n"
+			       "Content-Length: " + std::to_string(server->report_.size()) + "\r\n"
+			       "Connection: close\r\n\r\n" + server->report_;
+	send(client, response.data(), response.size(), MSG_NOSIGNAL);
+	close(client);
+
+	return TRUE;
+}
+
+gboolean StatsServer::onDatagram(gint fd, GIOCondition condition, gpointer data)
+{
+	StatsServer *server = static_cast<StatsServer *>(data);
+	struct sockaddr_storage from;
+	socklen_t length = sizeof(from);
+	char request[256];
+
+	while (recvfrom(fd, request, sizeof(request), 0,
+			reinterpret_cast<struct sockaddr *>(&from), &length) >= 0) {
+		sendto(fd, server->report_.data(), server->report_.size(), 0,
+		       reinterpret_cast<struct sockaddr *>(&from), length);
+		length = sizeof(from);
+	}
+
+	return TRUE;
+}
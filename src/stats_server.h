@@ -0,0 +1,42 @@
+/*
+ * Statistics endpoint serving the latest report over HTTP and UDP
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include <libcamera/base/class.h>
+
+#include <glib.h>
+
+/*
+ * Listens on the same port for TCP and UDP. An HTTP request (any path) is
+ * answered with the report as application/json and the connection closed;
+ * any UDP datagram is answered with the report as a single datagram.
+ * Everything runs on the GLib main loop of the caller.
+ */
+class StatsServer
+{
+public:
+	StatsServer();
+	~StatsServer();
+
+	int start(uint16_t port);
+	void setReport(const std::string &report) { report_ = report; }
+
+private:
+	LIBCAMERA_DISABLE_COPY(StatsServer)
+
+	static gboolean onConnection(gint fd, GIOCondition condition, gpointer data);
+	static gboolean onDatagram(gint fd, GIOCondition condition, gpointer data);
+
+	void stop();
+
+	int tcp_ = -1;
+	int udp_ = -1;
+	guint tcpWatch_ = 0;
+	guint udpWatch_ = 0;
+	std::string report_ = "{}";
+};
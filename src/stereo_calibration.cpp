@@ -0,0 +1,225 @@
+/*
+ * Stereo camera calibration and rectifying transforms
+ */
+
+#include "stereo_calibration.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <math.h>
+#include <sstream>
+#include <string.h>
+
+using namespace libcamera;
+
+namespace {
+
+void multiply(const double *a, const double *b, double *out)
+{
+	for (unsigned int i = 0; i < 3; ++i)
+		for (unsigned int j = 0; j < 3; ++j)
+			out[i * 3 + j] = a[i * 3 + 0] * b[0 * 3 + j] +
+					 a[i * 3 + 1] * b[1 * 3 + j] +
+					 a[i * 3 + 2] * b[2 * 3 + j];
+}
+
+void transpose(const double *a, double *out)
+{
+	for (unsigned int i = 0; i < 3; ++i)
+		for (unsigned int j = 0; j < 3; ++j)
+			out[j * 3 + i] = a[i * 3 + j];
+}
+
+void apply(const double *m, const double *v, double *out)
+{
+	for (unsigned int i = 0; i < 3; ++i)
+		out[i] = m[i * 3 + 0] * v[0] + m[i * 3 + 1] * v[1] + m[i * 3 + 2] * v[2];
+}
+
+double norm(const double *v)
+{
+	return sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+/* Rodrigues rotation vector to matrix */
+void vectorToMatrix(const double *r, double *m)
+{
+	const double theta = norm(r);
+	if (theta < 1e-12) {
+		static const double identity[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+		memcpy(m, identity, sizeof(identity));
+		return;
+	}
+
+	const double k[3] = { r[0] / theta, r[1] / theta, r[2] / theta };
+	const double c = cos(theta);
+	const double s = sin(theta);
+	const double t = 1 - c;
+
+	m[0] = c + t * k[0] * k[0];
+	m[1] = t * k[0] * k[1] - s * k[2];
+	m[2] = t * k[0] * k[2] + s * k[1];
+	m[3] = t * k[1] * k[0] + s * k[2];
+	m[4] = c + t * k[1] * k[1];
+	m[5] = t * k[1] * k[2] - s * k[0];
+	m[6] = t * k[2] * k[0] - s * k[1];
+	m[7] = t * k[2] * k[1] + s * k[0];
+	m[8] = c + t * k[2] * k[2];
+}
+
+/* Rotation matrix to Rodrigues vector, stereo rotations are far from pi */
+void matrixToVector(const double *m, double *r)
+{
+	const double c = std::clamp((m[0] + m[4] + m[8] - 1) / 2, -1.0, 1.0);
+	const double theta = acos(c);
+	const double v[3] = { m[7] - m[5], m[2] - m[6], m[3] - m[1] };
+	const double s = sin(theta);
+	const double scale = s < 1e-12 ? 0.5 : theta / (2 * s);
+
+	for (unsigned int i = 0; i < 3; ++i)
+		r[i] = v[i] * scale;
+}
+
+bool readValues(std::istringstream &line, double *values, unsigned int min,
+		unsigned int max)
+{
+	unsigned int count = 0;
+	double value;
+
+	while (count < max && line >> value)
+		values[count++] = value;
+
+	return count >= min;
+}
+
+} /* namespace */
+
+int StereoCalibration::load(const std::string &path, StereoCalibration *calibration)
+{
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "Cannot open calibration " << path << std::endl;
+		return -ENOENT;
+	}
+
+	StereoCalibration calib;
+	unsigned int found = 0;
+	std::string text;
+
+	for (unsigned int number = 1; std::getline(file, text); ++number) {
+		text = text.substr(0, text.find('#'));
+
+		std::istringstream line(text);
+		std::string key;
+		if (!(line >> key))
+			continue;
+
+		bool ok;
+		if (key == "size") {
+			ok = static_cast<bool>(line >> calib.size.width >> calib.size.height);
+			found |= 1 << 0;
+		} else if (key == "M1" || key == "M2") {
+			ok = readValues(line, calib.eye[key[1] - '1'].K, 9, 9);
+			found |= 1 << (key[1] - '0');
+		} else if (key == "D1" || key == "D2") {
+			ok = readValues(line, calib.eye[key[1] - '1'].D, 0, 5);
+		} else if (key == "R") {
+			ok = readValues(line, calib.R, 9, 9);
+		} else if (key == "T") {
+			ok = readValues(line, calib.T, 3, 3);
+			found |= 1 << 3;
+		} else {
+			ok = false;
+		}
+
+		if (!ok) {
+			std::cerr << path << ":" << number << ": invalid entry '"
+				  << key << "'" << std::endl;
+			return -EINVAL;
+		}
+	}
+
+	/* The baseline is the only thing without a sensible default */
+	if (found != 0xf || calib.size.isNull() || norm(calib.T) == 0) {
+		std::cerr << path << ": size, M1, M2 and T are required" << std::endl;
+		return -EINVAL;
+	}
+
+	*calibration = calib;
+	return 0;
+}
+
+StereoCalibration StereoCalibration::scaled(const Size &to) const
+{
+	StereoCalibration calib = *this;
+	const double sx = static_cast<double>(to.width) / size.width;
+	const double sy = static_cast<double>(to.height) / size.height;
+
+	/* Pixel centres map onto pixel centres */
+	for (CameraCalibration &eye : calib.eye) {
+		eye.K[0] *= sx;
+		eye.K[1] *= sx;
+		eye.K[2] = (eye.K[2] + 0.5) * sx - 0.5;
+		eye.K[4] *= sy;
+		eye.K[5] = (eye.K[5] + 0.5) * sy - 0.5;
+	}
+
+	calib.size = to;
+	return calib;
+}
+
+/*
+ * Bouguet's method, as OpenCV's stereoRectify(): each camera is turned by
+ * half of R so that the image planes are parallel, then both are rotated
+ * so that the baseline lies along the x axis.
+ */
+StereoRectification StereoRectification::compute(const StereoCalibration &calib)
+{
+	StereoRectification rect;
+
+	double om[3];
+	matrixToVector(calib.R, om);
+	for (double &v : om)
+		v *= -0.5;
+
+	double rr[9];
+	vectorToMatrix(om, rr);
+
+	double t[3];
+	apply(rr, calib.T, t);
+
+	/* Rotate the translation onto the x axis */
+	const double direction[3] = { t[0] > 0 ? 1.0 : -1.0, 0, 0 };
+	double w[3] = {
+		t[1] * direction[2] - t[2] * direction[1],
+		t[2] * direction[0] - t[0] * direction[2],
+		t[0] * direction[1] - t[1] * direction[0],
+	};
+	const double nt = norm(t);
+	const double nw = norm(w);
+	if (nw > 0) {
+		const double angle = acos(fabs(t[0]) / nt) / nw;
+		for (double &v : w)
+			v *= angle;
+	}
+
+	double wr[9];
+	vectorToMatrix(w, wr);
+
+	double rrt[9];
+	transpose(rr, rrt);
+	multiply(wr, rrt, rect.R[0]);
+	multiply(wr, rr, rect.R[1]);
+
+	/* Shared intrinsics, keep the shorter focal length to lose fewer pixels */
+	const CameraCalibration &left = calib.eye[0];
+	const CameraCalibration &right = calib.eye[1];
+	rect.focal = std::min(left.K[4], right.K[4]);
+	rect.cx = (left.K[2] + right.K[2]) / 2;
+	rect.cy = (left.K[5] + right.K[5]) / 2;
+	rect.baseline = nt;
+
+	return rect;
+}
@@ -0,0 +1,59 @@
+/*
+ * Stereo camera calibration and rectifying transforms
+ */
+
+#pragma once
+
+#include <string>
+
+#include <libcamera/geometry.h>
+
+/*
+ * Pinhole intrinsics (row-major camera matrix) and Brown-Conrady distortion
+ * k1, k2, p1, p2, k3 of one eye.
+ */
+struct CameraCalibration {
+	double K[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	double D[5] = {};
+};
+
+/*
+ * Calibration of the stereo pair as produced by OpenCV's stereoCalibrate():
+ * R and T take points from the left camera frame to the right one. T is in
+ * whatever unit the calibration target was measured in.
+ */
+struct StereoCalibration {
+	libcamera::Size size;
+	CameraCalibration eye[2];
+	double R[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	double T[3] = {};
+
+	/*
+	 * Text file with one entry per line, '#' starting a comment:
+	 *
+	 *   size W H
+	 *   M1 <9 values>    D1 <up to 5 values>
+	 *   M2 <9 values>    D2 <up to 5 values>
+	 *   R <9 values>     T <3 values>
+	 */
+	static int load(const std::string &path, StereoCalibration *calibration);
+
+	/* Intrinsics rescaled to another capture size, e.g. a binned mode */
+	StereoCalibration scaled(const libcamera::Size &size) const;
+};
+
+/*
+ * Rotations taking each eye's camera frame to the common rectified frame,
+ * and the shared rectified intrinsics. Rectified rows are epipolar lines,
+ * with zero disparity at infinity.
+ */
+struct StereoRectification {
+	double R[2][9];
+	double focal;
+	double cx;
+	double cy;
+	/* Distance between the rectified optical centres, in units of T */
+	double baseline;
+
+	static StereoRectification compute(const StereoCalibration &calibration);
+};
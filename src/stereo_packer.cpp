@@ -0,0 +1,62 @@
+/*
+ * Packing of stereo pairs into a single side-by-side or top-bottom frame
+ */
+
+#include "stereo_packer.h"
+
+#include <assert.h>
+#include <string.h>
+
+using namespace libcamera;
+
+/*
+ * The packed frame uses GStreamer's default strides, so that it can be pushed
+ * without a video meta; the eye layout is whatever the camera produced.
+ */
+StereoPacker::StereoPacker(Layout layout, const FrameLayout &eye)
+	: layout_(layout), eye_(eye)
+{
+	Size size = eye.size;
+	if (layout == Layout::SideBySide)
+		size.width *= 2;
+	else
+		size.height *= 2;
+
+	packed_ = FrameLayout::create(eye.format, size, 0);
+}
+
+/*
+ * Copy one eye straight from the camera mapping into its half of dst. Each
+ * plane is packed on its own, so planar formats keep their chroma planes
+ * separate in the packed frame.
+ */
+void StereoPacker::pack(unsigned int eye, const Image &image, uint8_t *dst) const
+{
+	assert(eye < 2);
+
+	ImageAccess access(image, Image::AllPlanes, Image::MapMode::ReadOnly);
+
+	for (unsigned int p = 0; p < eye_.planes.size(); ++p) {
+		const PlaneView<const uint8_t> src = image.plane(p);
+		const PlaneLayout &out = packed_.planes[p];
+		uint8_t *base = plane(eye, p, dst);
+
+		for (unsigned int y = 0; y < src.height; ++y)
+			memcpy(base + y * static_cast<size_t>(out.stride), src.row(y),
+			       src.bytesPerLine);
+	}
+}
+
+uint8_t *StereoPacker::plane(unsigned int eye, unsigned int plane, uint8_t *dst) const
+{
+	const PlaneLayout &src = eye_.planes[plane];
+	const PlaneLayout &out = packed_.planes[plane];
+	uint8_t *base = dst + out.offset;
+
+	if (layout_ == Layout::SideBySide)
+		base += eye * src.bytesPerLine;
+	else
+		base += eye * src.rows * static_cast<size_t>(out.stride);
+
+	return base;
+}
@@ -0,0 +1,37 @@
+/*
+ * Packing of stereo pairs into a single side-by-side or top-bottom frame
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "frame_layout.h"
+#include "image.h"
+
+class StereoPacker
+{
+public:
+	enum class Layout {
+		SideBySide,
+		TopBottom,
+	};
+
+	StereoPacker(Layout layout, const FrameLayout &eye);
+
+	Layout layout() const { return layout_; }
+	const FrameLayout &eye() const { return eye_; }
+	const FrameLayout &packed() const { return packed_; }
+
+	bool isValid() const { return eye_.isValid() && packed_.isValid(); }
+
+	void pack(unsigned int eye, const Image &image, uint8_t *dst) const;
+
+	/* Start of an eye's plane within the packed frame at dst */
+	uint8_t *plane(unsigned int eye, unsigned int plane, uint8_t *dst) const;
+
+private:
+	Layout layout_;
+	FrameLayout eye_;
+	FrameLayout packed_;
+};
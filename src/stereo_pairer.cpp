@@ -0,0 +1,92 @@
+/*
+ * Pairing of completed requests from the two sensors of a stereo camera
+ */
+
+#include "stereo_pairer.h"
+
+#include <assert.h>
+
+using namespace libcamera;
+
+void StereoPairer::Queue::init(unsigned int depth)
+{
+	entries_.resize(depth);
+	head_ = 0;
+	count_ = 0;
+}
+
+void StereoPairer::Queue::push(const Entry &entry)
+{
+	assert(!full());
+	entries_[(head_ + count_) % entries_.size()] = entry;
+	count_++;
+}
+
+StereoPairer::Entry StereoPairer::Queue::pop()
+{
+	assert(!empty());
+	Entry entry = entries_[head_];
+	head_ = (head_ + 1) % entries_.size();
+	count_--;
+	return entry;
+}
+
+/*
+ * \a depth bounds the number of requests pending per eye and should match the
+ * number of requests allocated per camera. \a tolerance is in nanoseconds.
+ */
+StereoPairer::StereoPairer(unsigned int depth, int64_t tolerance,
+			   PairHandler onPair, DropHandler onDrop)
+	: tolerance_(tolerance), onPair_(std::move(onPair)),
+	  onDrop_(std::move(onDrop)), paired_(0), dropped_(0)
+{
+	assert(depth > 0);
+
+	pending_[Left].init(depth);
+	pending_[Right].init(depth);
+}
+
+void StereoPairer::drop(Request *request)
+{
+	dropped_.fetch_add(1, std::memory_order_relaxed);
+	onDrop_(request);
+}
+
+void StereoPairer::add(Eye eye, Request *request, int64_t timestamp)
+{
+	Queue &other = pending_[eye == Left ? Right : Left];
+	Queue &own = pending_[eye];
+
+	/* Frames of the other eye too old to match this one or any later one */
+	while (!other.empty() && other.front().timestamp + tolerance_ < timestamp)
+		drop(other.pop().request);
+
+	if (!other.empty()) {
+		/* The other eye is ahead by more than the tolerance */
+		if (other.front().timestamp - tolerance_ > timestamp) {
+			drop(request);
+			return;
+		}
+
+		Entry partner = other.pop();
+		paired_.fetch_add(1, std::memory_order_relaxed);
+		if (eye == Left)
+			onPair_(request, partner.request);
+		else
+			onPair_(partner.request, request);
+		return;
+	}
+
+	if (own.full())
+		drop(own.pop().request);
+
+	own.push({ request, timestamp });
+}
+
+StereoPairer::Stats StereoPairer::stats() const
+{
+	return {
+		paired_.load(std::memory_order_relaxed),
+		dropped_.load(std::memory_order_relaxed),
+	};
+}
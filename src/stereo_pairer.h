@@ -0,0 +1,86 @@
+/*
+ * Pairing of completed requests from the two sensors of a stereo camera
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+#include <libcamera/request.h>
+
+/*
+ * Requests are matched on their sensor timestamps. Each eye keeps a small
+ * fixed-size queue of requests still waiting for a partner; since timestamps
+ * are monotonic per sensor, anything older than the other eye's latest frame
+ * minus the tolerance can never be matched and is dropped.
+ *
+ * The pairer is not thread-safe. libcamera completes requests of all cameras
+ * from the CameraManager thread, which serialises the calls to add(). Only
+ * stats() may be called from other threads.
+ */
+class StereoPairer
+{
+public:
+	enum Eye {
+		Left = 0,
+		Right = 1,
+	};
+
+	struct Stats {
+		uint64_t paired;
+		uint64_t dropped;
+	};
+
+	using PairHandler = std::function<void(libcamera::Request *left,
+					       libcamera::Request *right)>;
+	using DropHandler = std::function<void(libcamera::Request *request)>;
+
+	StereoPairer(unsigned int depth, int64_t tolerance,
+		     PairHandler onPair, DropHandler onDrop);
+
+	void add(Eye eye, libcamera::Request *request, int64_t timestamp);
+
+	Stats stats() const;
+
+private:
+	LIBCAMERA_DISABLE_COPY(StereoPairer)
+
+	struct Entry {
+		libcamera::Request *request;
+		int64_t timestamp;
+	};
+
+	class Queue
+	{
+	public:
+		void init(unsigned int depth);
+
+		bool empty() const { return count_ == 0; }
+		bool full() const { return count_ == entries_.size(); }
+		const Entry &front() const { return entries_[head_]; }
+
+		void push(const Entry &entry);
+		Entry pop();
+
+	private:
+		std::vector<Entry> entries_;
+		unsigned int head_ = 0;
+		unsigned int count_ = 0;
+	};
+
+	void drop(libcamera::Request *request);
+
+	int64_t tolerance_;
+	PairHandler onPair_;
+	DropHandler onDrop_;
+
+	Queue pending_[2];
+
+	std::atomic<uint64_t> paired_;
+	std::atomic<uint64_t> dropped_;
+};
@@ -0,0 +1,127 @@
+/*
+ * CPU affinity and scheduling policy of the application's threads
+ */
+
+#include "thread_placement.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+
+namespace {
+
+const char *const roleNames[] = {
+	"capture",
+	"push",
+	"encode",
+	"workers",
+	"depth",
+};
+
+static_assert(sizeof(roleNames) / sizeof(roleNames[0]) ==
+	      static_cast<unsigned int>(ThreadRole::Count));
+
+} /* namespace */
+
+const char *threadRoleName(ThreadRole role)
+{
+	return roleNames[static_cast<unsigned int>(role)];
+}
+
+int parseThreadRole(const std::string &name, ThreadRole *role)
+{
+	for (unsigned int i = 0; i < static_cast<unsigned int>(ThreadRole::Count); ++i) {
+		if (name == roleNames[i]) {
+			*role = static_cast<ThreadRole>(i);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+int parseCpuList(const char *list, uint64_t *cpus)
+{
+	uint64_t mask = 0;
+	const char *p = list;
+
+	for (;;) {
+		char *end;
+		unsigned long first = strtoul(p, &end, 10);
+		unsigned long last = first;
+		if (end == p)
+			return -EINVAL;
+
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p)
+				return -EINVAL;
+		}
+
+		if (first > last || last >= 64)
+			return -EINVAL;
+		for (unsigned long cpu = first; cpu <= last; ++cpu)
+			mask |= uint64_t(1) << cpu;
+
+		if (!*end)
+			break;
+		if (*end != ',')
+			return -EINVAL;
+		p = end + 1;
+	}
+
+	*cpus = mask;
+	return 0;
+}
+
+std::string cpuList(uint64_t cpus)
+{
+	std::string list;
+
+	for (unsigned int cpu = 0; cpu < 64; ++cpu) {
+		if (!(cpus & (uint64_t(1) << cpu)))
+			continue;
+
+		/* Collapse runs of CPUs into ranges */
+		unsigned int last = cpu;
+		while (last + 1 < 64 && (cpus & (uint64_t(1) << (last + 1))))
+			last++;
+
+		if (!list.empty())
+			list += ",";
+		list += std::to_string(cpu);
+		if (last != cpu)
+			list += "-" + std::to_string(last);
+		cpu = last;
+	}
+
+	return list;
+}
+
+int placeThread(pthread_t thread, const ThreadPlacement &placement)
+{
+	if (placement.cpus) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (unsigned int cpu = 0; cpu < 64; ++cpu) {
+			if (placement.cpus & (uint64_t(1) << cpu))
+				CPU_SET(cpu, &set);
+		}
+
+		int ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+		if (ret)
+			return -ret;
+	}
+
+	if (placement.priority) {
+		struct sched_param param = {};
+		param.sched_priority = placement.priority;
+
+		int ret = pthread_setschedparam(thread, SCHED_FIFO, &param);
+		if (ret)
+			return -ret;
+	}
+
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * CPU affinity and scheduling policy of the application's threads
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+/* Threads grouped by what they do, each group placed as a whole */
+enum class ThreadRole {
+	/* libcamera thread completing requests */
+	Capture,
+	/* GLib main loop, pushing frames to appsrc */
+	Push,
+	/* GStreamer streaming threads feeding the encoders, and encoder threads */
+	Encode,
+	/* Pool splitting conversion and rectification */
+	Workers,
+	/* Disparity thread and its pool */
+	Depth,
+	Count,
+};
+
+const char *threadRoleName(ThreadRole role);
+/* Returns -EINVAL for unknown names */
+int parseThreadRole(const std::string &name, ThreadRole *role);
+
+struct ThreadPlacement {
+	/* Bit n allows CPU n, 0 for any CPU */
+	uint64_t cpus = 0;
+	/* SCHED_FIFO priority, 0 to keep the default policy */
+	int priority = 0;
+
+	bool isDefault() const { return !cpus && !priority; }
+};
+
+/* Parse a CPU list such as "0-1,3". Returns -EINVAL on errors */
+int parseCpuList(const char *list, uint64_t *cpus);
+std::string cpuList(uint64_t cpus);
+
+/*
+ * Apply the placement to a thread. Threads the thread creates afterwards
+ * inherit both. Returns 0 or a negative error code, -EPERM for instance
+ * when real-time scheduling is not allowed.
+ */
+int placeThread(pthread_t thread, const ThreadPlacement &placement);
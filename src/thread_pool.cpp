@@ -0,0 +1,81 @@
+/*
+ * Fixed pool of worker threads for splitting per-frame work
+ */
+
+#include "thread_pool.h"
+
+/* \a threads counts the caller, a pool of 1 runs everything inline */
+ThreadPool::ThreadPool(unsigned int threads)
+{
+	for (unsigned int i = 1; i < threads; ++i)
+		workers_.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	start_.notify_all();
+
+	for (std::thread &thread : workers_)
+		thread.join();
+}
+
+void ThreadPool::execute()
+{
+	for (;;) {
+		unsigned int index = next_.fetch_add(1, std::memory_order_relaxed);
+		if (index >= tasks_)
+			break;
+
+		(*task_)(index);
+	}
+}
+
+void ThreadPool::worker()
+{
+	uint64_t generation = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			start_.wait(lock, [&] { return stop_ || generation_ != generation; });
+			if (stop_)
+				return;
+			generation = generation_;
+		}
+
+		execute();
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (--busy_ == 0)
+			done_.notify_one();
+	}
+}
+
+void ThreadPool::run(unsigned int tasks, const Task &task)
+{
+	if (workers_.empty() || tasks <= 1) {
+		for (unsigned int i = 0; i < tasks; ++i)
+			task(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		task_ = &task;
+		tasks_ = tasks;
+		next_.store(0, std::memory_order_relaxed);
+		busy_ = workers_.size();
+		generation_++;
+	}
+	start_.notify_all();
+
+	execute();
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	done_.wait(lock, [&] { return busy_ == 0; });
+	task_ = nullptr;
+}
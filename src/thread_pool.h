@@ -0,0 +1,78 @@
+/*
+ * Fixed pool of worker threads for splitting per-frame work
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include <libcamera/base/class.h>
+
+/*
+ * run() splits a job into tasks indexed from 0, executes them on the workers
+ * and on the calling thread, and returns once all of them are done. Jobs are
+ * not queued: a single caller at a time is expected, typically the thread
+ * that owns the frame being processed.
+ */
+class ThreadPool
+{
+public:
+	/*
+	 * Reference to the callable of a job, which outlives run(). Unlike a
+	 * std::function it never allocates, however much the lambda captures,
+	 * so a job per frame costs no heap allocation.
+	 */
+	class Task
+	{
+	public:
+		template<typename Func>
+		Task(const Func &func)
+			: func_(&func),
+			  call_([](const void *func, unsigned int task) {
+				  (*static_cast<const Func *>(func))(task);
+			  })
+		{
+		}
+
+		void operator()(unsigned int task) const { call_(func_, task); }
+
+	private:
+		const void *func_;
+		void (*call_)(const void *func, unsigned int task);
+	};
+
+	explicit ThreadPool(unsigned int threads);
+	~ThreadPool();
+
+	/* Number of threads taking part in run(), including the caller */
+	unsigned int size() const { return workers_.size() + 1; }
+
+	void run(unsigned int tasks, const Task &task);
+
+	const std::vector<std::thread> &workers() const { return workers_; }
+	std::vector<std::thread> &workers() { return workers_; }
+
+private:
+	LIBCAMERA_DISABLE_COPY(ThreadPool)
+
+	void worker();
+	void execute();
+
+	std::vector<std::thread> workers_;
+
+	std::mutex mutex_;
+	std::condition_variable start_;
+	std::condition_variable done_;
+	uint64_t generation_ = 0;
+	unsigned int busy_ = 0;
+	bool stop_ = false;
+
+	const Task *task_ = nullptr;
+	unsigned int tasks_ = 0;
+	std::atomic<unsigned int> next_{ 0 };
+};
@@ -1,14 +1,117 @@
 // udp_cam_libcamera_gst.cpp
 //
-// Capture from libcamera (XRGB8888) and push frames into GStreamer appsrc.
-// Pipeline converts to I420, x264 encodes and sends RTP/H264 to UDP port.
+// Capture from libcamera (XRGB8888 by default, --format=YUV420/NV12 for
+// native YUV) and push frames into GStreamer appsrc, with caps, strides and
+// plane offsets taken from the negotiated stream configuration.
+// Pipeline converts to I420 unless the encoder takes the format as is, encodes H.264 (V4L2 hardware encoder when one
+// is available, x264 otherwise) and sends RTP/H264 to UDP port.
+// multiudpsink sends each encoded packet to every destination: the one on
+// the command line, --dest ones (unicast or multicast), and any added at
+// runtime through the --control socket.
+//
+// With --adaptive the payloader feeds an rtpbin, which sends RTCP sender
+// reports to port + 1 of every destination and takes their receiver reports
+// on --rtcp-port. Loss and queueing delay in those reports lower the encoder
+// bitrate, and with --adaptive=framerate then the sensor frame rate, until
+// the link keeps up; clean reports slowly restore both.
+//
+// Startup overlaps camera setup with GStreamer initialisation, the encoder
+// probe and plugin loading on a second thread; the pipeline is then built
+// and set to PLAYING, and only then are the cameras started, so no frame is
+// captured before it can be streamed. The time to the first packet sent is
+// printed and reported with the stats.
+//
+// Completed frames are copied into a lock-free ring of preallocated slots
+// that the GStreamer side drains, so the two threads never share a buffer.
+// The slots, the recorder ring, the disparity inputs and the buffers pushed
+// to appsrc all come from one arena mapped up front (from reserved huge
+// pages with --hugepages), and the appsrc buffers circulate through a pool,
+// so the copy path allocates nothing per frame once it has settled. Heap
+// allocations of the capture and push threads are counted to show it.
+// Camera buffers are read through stride-aware plane views, each read
+// bracketed with a dmabuf sync of the planes it touches.
+// By default the camera thread wakes the GLib main loop through an eventfd
+// and every frame is pushed once, as soon as it is complete; --push=timer
+// restores polling at the frame rate.
+// Buffers are timestamped with the sensor capture time rebased to the
+// pipeline clock.
+//
+// The latency of every stage, from sensor timestamp to request completion,
+// ring, appsrc, encoder output and udpsink, goes into lock-free histograms.
+// Every 5 s their p50/p99/max, the frame rate and the drop counters are
+// printed, and served as JSON with --stats-port.
+//
+// With --preview=HOST:PORT the (left) camera also outputs a second stream,
+// scaled down by the ISP, which is copied in the same requestComplete() pass
+// into a small buffer pool and sent as its own low bitrate RTP stream.
+//
+// With --roi=X,Y,WxH every request carries a ScalerCrop of that sensor area,
+// streamed at its native size unless --size says otherwise. The "roi"
+// command of the control socket moves or resizes it at runtime; the next
+// request queued to each camera takes the new crop.
+//
+// --cpus=ROLE:LIST and --priority=ROLE:N pin the capture (libcamera
+// completion), push (GLib main loop), encode (streaming thread into the
+// encoder, whose x264 threads inherit it), workers and depth threads to
+// CPUs, and run them with SCHED_FIFO.
+//
+// With --zero-copy the FrameBuffer dmabufs are wrapped as GstMemory and pushed
+// directly; the libcamera request is requeued once GStreamer releases them.
+//
+// --buffers=N sets the number of requests per camera. --buffers=auto
+// allocates up to 8 and measures how long each request is held between
+// completion and requeue; requests beyond what that hold time needs are
+// parked instead of queued, so frames never pile up downstream and the
+// camera is never left without a queued request.
+//
+// With --stereo both sensors of the IMX219-83 are configured identically and
+// their completed requests are paired by SensorTimestamp; unmatched frames
+// are dropped. The network stream carries the left eye of each pair, or both
+// eyes packed into one frame with --stereo-layout=side-by-side|top-bottom.
+//
+// With --cpu-convert XRGB8888 frames are converted to I420 straight into the
+// ring slot (NEON kernels, rows split over --threads) and the
+// pipeline has no videoconvert.
+//
+// With --raw both sensors stream Bayer frames (packed or not, following
+// --format) and the ISP output is left out: each frame is debayered on the
+// CPU, to half size GRAY8 by 2x2 binning or to XRGB8888 by bilinear
+// interpolation with --raw=rgb, and goes on to packing, rectification and
+// disparity as debayered.
+//
+// With --change-gate=LEVELS a completed frame only goes on (to the ring or
+// appsrc, and the recorder) when the block-wise SAD of its subsampled luma
+// against the last frame let through says it changed. While frames are
+// skipped a keyframe is still forced every --heartbeat ms.
+//
+// With --depth-stream=HOST:PORT the disparity maps of --disparity are
+// downsampled (--depth-scale), quantised (--depth-bits) and delta/run-length
+// coded on the depth thread, then sent from a third appsrc in rtpgstpay
+// packets. Maps are stamped with the sensor timestamp of their left frame,
+// in their header and through the RTP timestamp the video frame got too.
+//
+// With --rectify=FILE both eyes of a stereo pair are rectified from their
+// camera mappings into the ring slot, before packing. --disparity=bm|sgm then
+// matches their luma on a worker thread of its own, skipping pairs while it
+// is busy.
+//
+// With --record=FILE every delivered frame (or pair) is also copied into the
+// ring of a FileSink, whose writer thread appends it to FILE with aligned
+// O_DIRECT writes and indexes it in FILE.idx. --replay=FILE streams such a
+// recording instead of the cameras, wrapping the frames straight from its
+// mapping, at the recorded pace or as fast as the pipeline goes. --shm=PATH
+// hands every frame going into the ring to local consumers in the slots of a
+// shared memfd, announced over a Unix socket served by a thread of its own.
+// Each consumer has its own credit of slots, a slow one misses frames
+// instead of holding up the others, and the network stream's flow control
+// does not hold them up either.
 //
 // Build:
-// g++ udp_cam_libcamera_gst.cpp -o udp_cam_libcamera_gst \
-//   $(pkg-config --cflags --libs libcamera gstreamer-1.0 gstreamer-app-1.0) -pthread
+// g++ allocation_counter.cpp arena_pool.cpp buffer_tuner.cpp change_detector.cpp control_server.cpp convert.cpp debayer.cpp depth_encoder.cpp depth_worker.cpp disparity.cpp encoder.cpp file_sink.cpp frame_arena.cpp frame_layout.cpp frame_ring.cpp image.cpp options.cpp rate_controller.cpp recording.cpp rectifier.cpp shm_output.cpp stage_stats.cpp stats_server.cpp stereo_calibration.cpp stereo_packer.cpp stereo_pairer.cpp thread_placement.cpp thread_pool.cpp udp_cam_libcamera_gst.cpp -o udp_cam_libcamera_gst \
+//   $(pkg-config --cflags --libs libcamera gstreamer-1.0 gstreamer-app-1.0 gstreamer-allocators-1.0 gstreamer-video-1.0) -pthread
 //
 // Run:
-// ./udp_cam_libcamera_gst <destination-ip> <port>
+// ./udp_cam_libcamera_gst [--zero-copy] <destination-ip> <port>
 // Example: ./udp_cam_libcamera_gst 192.168.1.50 5000
 //
 
@@ -21,6 +124,13 @@
 #include <thread>
 #include <chrono>
 #include <cstdint>
+#include <ctime>
+#include <numeric>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <mutex>
 
 // libcamera
 #include <libcamera/libcamera.h>
@@ -29,81 +139,383 @@
 #include <libcamera/framebuffer.h>
 #include <libcamera/request.h>
 
+#include "allocation_counter.h"
+#include "arena_pool.h"
+#include "buffer_tuner.h"
+#include "change_detector.h"
+#include "control_server.h"
+#include "convert.h"
+#include "debayer.h"
+#include "depth_encoder.h"
+#include "depth_worker.h"
+#include "encoder.h"
+#include "file_sink.h"
+#include "frame_arena.h"
+#include "frame_layout.h"
+#include "frame_ring.h"
 #include "image.h"
+#include "options.h"
+#include "rate_controller.h"
+#include "recording.h"
+#include "rectifier.h"
+#include "shm_output.h"
+#include "stage_stats.h"
+#include "stats_server.h"
+#include "stereo_packer.h"
+#include "stereo_pairer.h"
+#include "thread_placement.h"
+#include "thread_pool.h"
 
 // mmap & sockets (we use only mmap here)
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
 // GStreamer
+#include <glib-unix.h>
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
+#include <gst/allocators/allocators.h>
+#include <gst/video/video.h>
 
 using namespace libcamera;
 
+// One per sensor; the first one is the left eye in stereo mode
+struct CameraContext {
+    StereoPairer::Eye eye = StereoPairer::Left;
+    std::shared_ptr<Camera> camera;
+    std::unique_ptr<CameraConfiguration> config;
+    std::unique_ptr<FrameBufferAllocator> allocator;
+    Stream *stream = nullptr;
+    // Second, ISP-scaled stream of --preview
+    Stream *preview = nullptr;
+    std::vector<std::unique_ptr<Request>> requests;
+    ImageCache images;
+    // Debayered frame of --raw, and the request and sequence it holds
+    std::unique_ptr<Image> debayered;
+    const Request *debayeredRequest = nullptr;
+    unsigned int debayeredSequence = 0;
+    bool acquired = false;
+    bool started = false;
+    // Last duration requested through FrameDurationLimits, in microseconds
+    std::atomic<int64_t> frameDuration{0};
+    // Generation of the region of interest last requested
+    std::atomic<unsigned int> roiGeneration{0};
+    // Requests queued to the camera, and those queued or held downstream
+    std::atomic<int> queued{0};
+    std::atomic<unsigned int> circulating{0};
+    // Requests left out of circulation by the buffer tuner
+    std::mutex parkedLock;
+    std::vector<Request *> parked;
+};
+
 // Globals
-static std::shared_ptr<Camera> g_camera;
+static std::vector<std::unique_ptr<CameraContext>> g_cameras;
 static std::unique_ptr<CameraManager> g_camManager;
+static std::unique_ptr<StereoPairer> g_pairer;
+static std::unique_ptr<StereoPacker> g_packer;
+// Layout of the camera frames and of what is pushed to appsrc
+static FrameLayout g_streamLayout;
+static BayerFormat g_bayer;
+static FrameLayout g_outLayout;
 static GstElement *g_appsrc = nullptr;
+static GstElement *g_netsink = nullptr;
+static GstElement *g_rtcpsink = nullptr;
+static GstElement *g_previewsrc = nullptr;
+static GstElement *g_encoder = nullptr;
+static EncoderBackend g_encoderBackend;
 static std::atomic<bool> g_running{true};
 static GstElement *pipeline;
-#define FPS 30
-const uint8_t *data_ptr = nullptr;
-uint8_t *frame = nullptr;
-size_t bytes_used = 0;
-uint32_t width = 800;
-uint32_t height = 600;
-std::vector<uint8_t> rgbBuffer(width * height * 3);
+static Options g_options;
+static GstAllocator *g_dmabufAllocator = nullptr;
+static GQuark g_releaseQuark;
+// Backs the ring slots, the recorder ring, the depth inputs and the pooled
+// GstBuffers; declared first so that it goes last
+static std::unique_ptr<FrameArena> g_arena;
+static GstBufferPool *g_pushPool = nullptr;
+static std::unique_ptr<FrameRing> g_ring;
+static int g_wakeupFd = -1;
+static std::atomic<bool> g_wakeupPending{false};
+static std::atomic<bool> g_appsrcFull{false};
+static std::unique_ptr<ThreadPool> g_workers;
+static std::unique_ptr<Rectifier> g_rectifier;
+static std::unique_ptr<DepthWorker> g_depth;
+static std::unique_ptr<FileSink> g_fileSink;
+// --shm, published on the camera thread as the ring is filled
+static std::unique_ptr<ShmOutput> g_shmOutput;
+// --change-gate, run on the camera thread
+static std::unique_ptr<ChangeDetector> g_changeDetector;
+static int64_t g_lastGated;
+static std::atomic<uint64_t> g_gateSkipped{0};
+static std::atomic<uint64_t> g_gateHeartbeats{0};
+
+// Preview frames are copied into a pool of a few buffers; none free means
+// the preview encoder is behind and the frame is dropped
+static FrameLayout g_previewLayout;
+static GstBufferPool *g_previewPool = nullptr;
+static std::atomic<uint64_t> g_previewPushed{0};
+static std::atomic<uint64_t> g_previewDropped{0};
+// --depth-stream: maps are encoded on the depth thread into a small pool,
+// and dropped when the depth branch still holds every buffer
+static std::unique_ptr<DepthEncoder> g_depthEncoder;
+static GstElement *g_depthsrc = nullptr;
+static GstBufferPool *g_depthPool = nullptr;
+static std::atomic<uint64_t> g_depthPushed{0};
+static std::atomic<uint64_t> g_depthDropped{0};
+static std::atomic<uint64_t> g_depthBytes{0};
+
+// Per-stage latencies and the counters reported with them
+static LatencyHistogram g_latency[static_cast<unsigned int>(Stage::Count)];
+
+// Request pool sizing of --buffers=auto: time from completion to requeue,
+// and how often a camera ran out of queued requests
+static constexpr unsigned int AutoBuffers = 8;
+static std::unique_ptr<BufferTuner> g_bufferTuner;
+static std::atomic<unsigned int> g_bufferTarget{UINT_MAX};
+static LatencyHistogram g_holdTime;
+static std::atomic<uint64_t> g_starved{0};
+static uint64_t g_holdP99;
+static std::atomic<int> g_queuedRequests{0};
+static std::atomic<uint64_t> g_pushDropped{0};
+static std::atomic<uint64_t> g_encodedFrames{0};
+// Heap allocations of the capture (ring side of deliver()) and push paths
+static std::atomic<uint64_t> g_captureAllocations{0};
+static std::atomic<uint64_t> g_pushAllocations{0};
+static std::unique_ptr<StatsServer> g_statsServer;
+static std::unique_ptr<ControlServer> g_controlServer;
+static int64_t g_statsTime;
+// Frame duration applied through FrameDurationLimits, in microseconds,
+// and the matching caps framerate
+static int64_t g_frameDuration;
+static unsigned int g_framerateNum;
+static unsigned int g_framerateDen;
+
+// Region of interest requested through ScalerCrop, the generation tells
+// cameras that it changed. The maximum is the area the ISP can crop from.
+static std::mutex g_roiLock;
+static Rectangle g_roi;
+static std::atomic<unsigned int> g_roiGeneration{0};
+static Rectangle g_roiMaximum;
+
+// Rate adaptation to RTCP receiver reports, and the capture frame duration
+// (microseconds, 0 for unchanged) it asks requeued requests for
+static std::unique_ptr<RateController> g_rateController;
+static RateController::Report g_lastReport;
+static guint g_lastReportSsrc = 0;
+static std::atomic<int64_t> g_captureDuration{0};
+
+// Recording streamed in place of the cameras with --replay
+static std::unique_ptr<RecordingReader> g_replay;
+static std::thread g_replayThread;
 
+// Startup milestones on CLOCK_MONOTONIC: main() entered, cameras configured,
+// GStreamer initialised, pipeline playing and the first packet sent
+struct Startup {
+    int64_t start = 0;
+    int64_t cameras = 0;
+    int64_t gstreamer = 0;
+    int64_t pipeline = 0;
+    std::atomic<int64_t> firstPacket{0};
+};
+static Startup g_startup;
+static int64_t g_gstReady;
 
-// ************ Encoder ************************************************
-// Convert XRGB8888 → RGB (drop X channel)
-void XRGB8888toRGB(const uint8_t* src, uint8_t* dst, int width, int height)
+// Frame duration in microseconds and the caps framerate matching it, exact
+// for the requested rate
+static void set_frame_rate(int64_t duration)
 {
-    int srcStride = width * 4;  // 4 bytes per pixel (XRGB)
-    int dstStride = width * 3;  // 3 bytes per pixel (RGB)
+    g_frameDuration = duration;
+    if (duration == 1000000 / g_options.fps) {
+        g_framerateNum = g_options.fps;
+        g_framerateDen = 1;
+        return;
+    }
 
-    for (int y = 0; y < height; y++) {
-        const uint8_t* s = src + y * srcStride;
-        uint8_t* d = dst + y * dstStride;
-        for (int x = 0; x < width; x++) {
-            d[0] = s[1]; // R
-            d[1] = s[2]; // G
-            d[2] = s[3]; // B
-            s += 4;
-            d += 3;
-        }
+    unsigned int divisor = std::gcd<int64_t, int64_t>(1000000, duration);
+    g_framerateNum = 1000000 / divisor;
+    g_framerateDen = duration / divisor;
+}
+
+// ************ Statistics ************************************************
+static int64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Sensor timestamps are CLOCK_MONOTONIC, the age of the frame is the latency
+static void record_latency(Stage stage, int64_t timestamp)
+{
+    if (timestamp <= 0)
+        return;
+
+    int64_t latency = monotonic_ns() - timestamp;
+    if (latency >= 0)
+        g_latency[static_cast<unsigned int>(stage)].record(latency / 1000);
+}
+// ************ Statistics ************************************************
+
+// ************ Thread placement ************************************************
+static void place_thread(pthread_t thread, ThreadRole role)
+{
+    const ThreadPlacement &placement = g_options.placement[static_cast<unsigned int>(role)];
+    if (placement.isDefault())
+        return;
+
+    int ret = placeThread(thread, placement);
+    if (ret < 0)
+        std::cerr << "Cannot place " << threadRoleName(role) << " thread: " << strerror(-ret)
+                  << (ret == -EPERM ? " (SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit)" : "")
+                  << "\n";
+}
+
+static void place_threads(std::vector<std::thread> &threads, ThreadRole role)
+{
+    for (std::thread &thread : threads)
+        place_thread(thread.native_handle(), role);
+}
+
+// The first event reaching an encoder comes from the streaming thread that
+// feeds it, before the encoder starts threads of its own
+static GstPadProbeReturn on_encoder_data(GstPad *pad, GstPadProbeInfo *info, gpointer data)
+{
+    place_thread(pthread_self(), ThreadRole::Encode);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void place_encoder_thread(GstElement *bin, const char *element)
+{
+    GstElement *encoder = gst_bin_get_by_name(GST_BIN(bin), element);
+    if (!encoder)
+        return;
+
+    GstPad *pad = gst_element_get_static_pad(encoder, "sink");
+    if (pad) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, on_encoder_data,
+                          nullptr, nullptr);
+        gst_object_unref(pad);
     }
+    gst_object_unref(encoder);
 }
-// ************ Encoder ************************************************
+// ************ Thread placement ************************************************
 
 // ************ Gstreamer ************************************************
-static gboolean push_frame(gpointer data) {
-    static guint64 timestamp = 0;
+// PTS is the capture time on the pipeline clock as running time. Sensor
+// timestamps are CLOCK_MONOTONIC nanoseconds, the age of the frame on that
+// clock is carried over to the pipeline clock so that any GstClock works.
+// The duration is the sensor's frame duration, or the distance to the
+// previous frame when the pipeline handler does not report it.
+struct StreamTime {
+    uint64_t timestamp = 0;
+    GstClockTime pts = GST_CLOCK_TIME_NONE;
+};
+static StreamTime g_streamTime;
+static StreamTime g_previewTime;
+static StreamTime g_depthTime;
+
+static void stamp_buffer(GstBuffer *buffer, uint64_t timestamp, uint64_t duration,
+                         StreamTime &last = g_streamTime)
+{
+    if (!duration && last.timestamp && timestamp > last.timestamp)
+        duration = timestamp - last.timestamp;
+    last.timestamp = timestamp;
+
+    GST_BUFFER_DURATION(buffer) = duration ? duration
+                                : g_frameDuration * GST_USECOND;
+
+    // No clock before PLAYING, appsrc then timestamps nothing
+    GstClock *clock = g_appsrc ? gst_element_get_clock(g_appsrc) : nullptr;
+    if (!clock || !timestamp) {
+        if (clock)
+            gst_object_unref(clock);
+        GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_NONE;
+        return;
+    }
+
+    const int64_t monotonic = monotonic_ns();
+    const int64_t clock_now = gst_clock_get_time(clock);
+    const int64_t base_time = gst_element_get_base_time(g_appsrc);
+    gst_object_unref(clock);
+
+    // Frames captured before the pipeline started count from zero, and PTS
+    // never goes backwards
+    int64_t pts = clock_now - (monotonic - static_cast<int64_t>(timestamp)) - base_time;
+    if (pts < 0)
+        pts = 0;
+    if (GST_CLOCK_TIME_IS_VALID(last.pts) && static_cast<GstClockTime>(pts) <= last.pts)
+        pts = last.pts + 1;
+
+    GST_BUFFER_PTS(buffer) = pts;
+    last.pts = pts;
+}
+
+// Tell downstream where the planes are, the camera strides may be padded
+static GstVideoMeta *add_video_meta(GstBuffer *buffer, const FrameLayout &layout = g_outLayout)
+{
+    gsize offset[GST_VIDEO_MAX_PLANES] = {};
+    gint stride[GST_VIDEO_MAX_PLANES] = {};
 
-    GstBuffer *buffer;
-    GstFlowReturn ret;
+    for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+        offset[i] = layout.planes[i].offset;
+        stride[i] = layout.planes[i].stride;
+    }
+
+    return gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE,
+                                          gst_video_format_from_string(gstFormatName(layout.format)),
+                                          layout.size.width, layout.size.height,
+                                          layout.planes.size(), offset, stride);
+}
+
+// Buffers of an arena pool keep their video meta when they are recycled, so
+// it is only added (and allocated) the first time a buffer goes out
+static void add_pooled_video_meta(GstBuffer *buffer, const FrameLayout &layout = g_outLayout)
+{
+    if (gst_buffer_get_video_meta(buffer))
+        return;
+
+    GstVideoMeta *meta = add_video_meta(buffer, layout);
+    if (meta)
+        GST_META_FLAG_SET(&meta->meta, GST_META_FLAG_POOLED);
+}
+
+// Frames go out in buffers of the arena pool, which grows to what the
+// pipeline holds and then recycles them. Heap buffers are only left as a
+// fallback if the arena cannot map more memory.
+static GstFlowReturn push_slot(FrameSlot *slot) {
+    const uint64_t allocations = threadAllocationCount();
+    GstBuffer *buffer = nullptr;
     GstMapInfo map;
 
-    if (!frame) return TRUE;
-    
-    // XRGB8888toRGB(frame, rgbBuffer.data(), width, height);
-    // buffer = gst_buffer_new_allocate(NULL, rgbBuffer.size(), NULL);
-    // gst_buffer_map(buffer, &map, GST_MAP_WRITE);
-    // memcpy(map.data, rgbBuffer.data(), rgbBuffer.size());
-    
-    buffer = gst_buffer_new_allocate(NULL, bytes_used, NULL);
+    // stereo pairs: only the left eye goes out on the network stream
+    size_t size = slot->rightOffset ? slot->rightOffset : slot->bytesused;
+    if (!g_pushPool || size > g_outLayout.frameSize ||
+        gst_buffer_pool_acquire_buffer(g_pushPool, &buffer, nullptr) != GST_FLOW_OK)
+        buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    else
+        gst_buffer_set_size(buffer, size);
+
     gst_buffer_map(buffer, &map, GST_MAP_WRITE);
-    memcpy(map.data, frame, bytes_used);
-    
+    memcpy(map.data, slot->data.data(), size);
     gst_buffer_unmap(buffer, &map);
-    GST_BUFFER_PTS(buffer) = timestamp;
-    GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale_int(1, GST_SECOND, FPS);
-    timestamp += GST_BUFFER_DURATION(buffer);
 
-    g_signal_emit_by_name(g_appsrc, "push-buffer", buffer, &ret);
-    gst_buffer_unref(buffer);
+    stamp_buffer(buffer, slot->timestamp, slot->duration);
+    g_ring->endRead(slot);
+    add_pooled_video_meta(buffer);
+
+    record_latency(Stage::Push, slot->timestamp);
+    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(g_appsrc), buffer);
+
+    g_pushAllocations.fetch_add(threadAllocationCount() - allocations,
+                                std::memory_order_relaxed);
+    return ret;
+}
+
+static gboolean push_frame(gpointer data) {
+    FrameSlot *slot = g_ring->beginRead();
+    if (!slot) return TRUE;
 
+    GstFlowReturn ret = push_slot(slot);
     if (ret != GST_FLOW_OK) {
         g_print("Failed to push buffer: %d\n", ret);
         return FALSE;
@@ -111,258 +523,2168 @@ static gboolean push_frame(gpointer data) {
 
     return TRUE;
 }
-// ************ Gstreamer ************************************************
 
-// requestCompleted callback: push frame to appsrc
-static void requestComplete(Request *request)
-{    
-    if (request->status() != Request::RequestComplete)
+// Called from the camera thread after a frame is committed, and from the
+// streaming thread when appsrc wants data again. Only the first call after
+// a drain touches the eventfd.
+static void wake_push_side()
+{
+    if (g_wakeupPending.exchange(true, std::memory_order_acq_rel))
         return;
 
-    for (auto [stream, buffer] : request->buffers()) {
-        std::unique_ptr<Image> image = Image::fromFrameBuffer(buffer, Image::MapMode::ReadOnly);
-    	for (unsigned int i = 0; i < buffer->planes().size(); ++i) {
-    		const unsigned int bytesused = buffer->metadata().planes()[i].bytesused;
-    
-    		Span<uint8_t> data = image->data(i);
-    		bytes_used = std::min<unsigned int>(bytesused, data.size());
-    
-    		if (bytesused > data.size())
-    			std::cerr << "payload size " << bytesused
-    				  << " larger than plane size " << data.size()
-    				  << std::endl;
-    
-            if (!frame) {
-                frame = (uint8_t*)malloc(bytes_used);
-            }
-            memcpy(frame, data.data(), bytes_used);
+    uint64_t one = 1;
+    if (write(g_wakeupFd, &one, sizeof(one)) < 0)
+        std::cerr << "Failed to signal frame: " << strerror(errno) << std::endl;
+}
+
+// Event mode: push everything that is ready while appsrc accepts data. The
+// pending flag is cleared before draining so that a frame committed during
+// the drain raises a new wakeup.
+static gboolean on_frame_ready(gint fd, GIOCondition condition, gpointer data)
+{
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        std::cerr << "Failed to read wakeup: " << strerror(errno) << std::endl;
+    g_wakeupPending.store(false, std::memory_order_release);
+
+    while (!g_appsrcFull.load(std::memory_order_acquire)) {
+        FrameSlot *slot = g_ring->beginRead();
+        if (!slot)
+            break;
+
+        GstFlowReturn ret = push_slot(slot);
+        if (ret != GST_FLOW_OK) {
+            g_print("Failed to push buffer: %d\n", ret);
+            return G_SOURCE_REMOVE;
         }
     }
-    // Reuse and requeue request for next capture
-    request->reuse(Request::ReuseBuffers);
-    g_camera->queueRequest(request);
+
+    return G_SOURCE_CONTINUE;
 }
 
-// SIGINT handler to stop gracefully
-static void sigint_handler(int)
+// appsrc flow control: while its queue is full, frames wait in the ring,
+// where the drop policy keeps the freshest ones
+static void on_need_data(GstElement *appsrc, guint length, gpointer data)
 {
-    g_running = false;
-    if (g_appsrc)
-        gst_app_src_end_of_stream(GST_APP_SRC(g_appsrc));
+    g_appsrcFull.store(false, std::memory_order_release);
+    if (g_ring)
+        wake_push_side();
 }
 
-int main(int argc, char *argv[])
+static void on_enough_data(GstElement *appsrc, gpointer data)
 {
-    // ***************** Arguments ********************************************
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <destination-ip> <port>\n";
-        return EXIT_FAILURE;
-    }
-    const char *dest_ip = argv[1];
-    int dest_port = atoi(argv[2]);
-    // ***************** Arguments ********************************************
+    g_appsrcFull.store(true, std::memory_order_release);
+}
 
+// Destinations of multiudpsink as "host:port,host:port"
+static std::string destinations()
+{
+    gchar *clients = nullptr;
+    g_object_get(g_netsink, "clients", &clients, NULL);
+    std::string list = clients ? clients : "";
+    g_free(clients);
+    return list;
+}
 
-    // Setup SIGINT
-    // std::signal(SIGINT, sigint_handler);
+// Print the interval's statistics and hand them to the stats endpoint as
+// JSON. Latencies are in microseconds, counters are totals since start.
+static gboolean print_stats(gpointer data)
+{
+    static uint64_t last_encoded = 0;
+    static FrameRing::Stats last_ring = {};
+    static uint64_t last_capture_allocations = 0;
+    static uint64_t last_push_allocations = 0;
 
-    // ***************** Camera ***********************************************
-    g_camManager = std::make_unique<CameraManager>();
-    if (g_camManager->start() != 0) {
-        std::cerr << "Failed to start CameraManager\n";
-        gst_object_unref(g_appsrc);
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
+    const int64_t now = monotonic_ns();
+    const double interval = (now - g_statsTime) / 1e9;
+    const uint64_t encoded = g_encodedFrames.load(std::memory_order_relaxed);
+    const double fps = interval > 0 ? (encoded - last_encoded) / interval : 0;
+    g_statsTime = now;
+    last_encoded = encoded;
+
+    std::ostringstream json;
+    const int64_t first_packet = g_startup.firstPacket.load(std::memory_order_relaxed);
+    json << "{\"interval_s\":" << interval << ",\"fps\":" << fps
+         << ",\"startup\":{\"cameras_ms\":" << (g_startup.cameras - g_startup.start) / 1000000
+         << ",\"gstreamer_ms\":" << (g_startup.gstreamer - g_startup.start) / 1000000
+         << ",\"pipeline_ms\":" << (g_startup.pipeline - g_startup.start) / 1000000
+         << ",\"first_packet_ms\":"
+         << (first_packet ? (first_packet - g_startup.start) / 1000000 : -1) << "}"
+         << ",\"requests_queued\":" << g_queuedRequests.load(std::memory_order_relaxed)
+         << ",\"push_dropped\":" << g_pushDropped.load(std::memory_order_relaxed)
+         << ",\"stages\":{";
+
+    std::cout << "fps " << fps << ", requests queued "
+              << g_queuedRequests.load(std::memory_order_relaxed) << std::endl;
+
+    for (unsigned int i = 0; i < static_cast<unsigned int>(Stage::Count); ++i) {
+        const char *name = stageName(static_cast<Stage>(i));
+        LatencyHistogram::Summary latency = g_latency[i].take();
+
+        json << (i ? "," : "") << "\"" << name << "\":{\"count\":" << latency.count
+             << ",\"p50_us\":" << latency.p50 << ",\"p99_us\":" << latency.p99
+             << ",\"max_us\":" << latency.max << "}";
+
+        if (latency.count)
+            std::cout << "  " << name << ": p50 " << latency.p50 / 1000.0
+                      << " ms, p99 " << latency.p99 / 1000.0
+                      << " ms, max " << latency.max / 1000.0 << " ms" << std::endl;
     }
+    json << "}";
 
-    auto cameras = g_camManager->cameras();
-    if (cameras.empty()) {
-        std::cerr << "No cameras available\n";
-        g_camManager->stop();
-        gst_object_unref(g_appsrc);
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
+    if (g_ring) {
+        FrameRing::Stats stats = g_ring->stats();
+        std::cout << "frames: produced " << stats.produced
+                  << " consumed " << stats.consumed
+                  << " dropped " << stats.dropped << std::endl;
+        json << ",\"ring\":{\"produced\":" << stats.produced
+             << ",\"consumed\":" << stats.consumed
+             << ",\"dropped\":" << stats.dropped << "}";
+
+        // Per frame of the interval, 0 once the pool has settled
+        const uint64_t capture = g_captureAllocations.load(std::memory_order_relaxed);
+        const uint64_t push = g_pushAllocations.load(std::memory_order_relaxed);
+        const uint64_t produced = stats.produced - last_ring.produced;
+        const uint64_t consumed = stats.consumed - last_ring.consumed;
+        const double capture_per_frame =
+            produced ? double(capture - last_capture_allocations) / produced : 0;
+        const double push_per_frame =
+            consumed ? double(push - last_push_allocations) / consumed : 0;
+        last_ring = stats;
+        last_capture_allocations = capture;
+        last_push_allocations = push;
+
+        if (countingAllocations()) {
+            std::cout << "allocations per frame: capture " << capture_per_frame
+                      << " push " << push_per_frame << std::endl;
+            json << ",\"allocations\":{\"capture\":" << capture
+                 << ",\"push\":" << push
+                 << ",\"capture_per_frame\":" << capture_per_frame
+                 << ",\"push_per_frame\":" << push_per_frame << "}";
+        }
+    }
+    if (g_arena) {
+        FrameArena::Stats stats = g_arena->stats();
+        json << ",\"arena\":{\"mapped\":" << stats.mapped
+             << ",\"allocated\":" << stats.allocated
+             << ",\"huge_pages\":" << (stats.hugePages ? "true" : "false") << "}";
+    }
+    if (g_pairer) {
+        StereoPairer::Stats stats = g_pairer->stats();
+        std::cout << "stereo: paired " << stats.paired
+                  << " unmatched " << stats.dropped << std::endl;
+        json << ",\"stereo\":{\"paired\":" << stats.paired
+             << ",\"unmatched\":" << stats.dropped << "}";
+    }
+    if (g_depth) {
+        DepthWorker::Stats stats = g_depth->stats();
+        std::cout << "disparity: computed " << stats.computed
+                  << " skipped " << stats.skipped
+                  << " last " << stats.lastDuration / 1000 << " ms" << std::endl;
+        json << ",\"disparity\":{\"computed\":" << stats.computed
+             << ",\"skipped\":" << stats.skipped
+             << ",\"last_us\":" << stats.lastDuration << "}";
+    }
+    if (g_changeDetector) {
+        const uint64_t skipped = g_gateSkipped.load(std::memory_order_relaxed);
+        const uint64_t heartbeats = g_gateHeartbeats.load(std::memory_order_relaxed);
+        std::cout << "change gate: skipped " << skipped
+                  << " heartbeats " << heartbeats << std::endl;
+        json << ",\"gate\":{\"skipped\":" << skipped
+             << ",\"heartbeats\":" << heartbeats << "}";
+    }
+    if (g_depthsrc) {
+        const uint64_t pushed = g_depthPushed.load(std::memory_order_relaxed);
+        const uint64_t dropped = g_depthDropped.load(std::memory_order_relaxed);
+        const uint64_t bytes = g_depthBytes.load(std::memory_order_relaxed);
+        std::cout << "depth stream: pushed " << pushed << " dropped " << dropped
+                  << ", " << (pushed ? bytes / pushed : 0) << " bytes per map" << std::endl;
+        json << ",\"depth_stream\":{\"pushed\":" << pushed << ",\"dropped\":" << dropped
+             << ",\"bytes\":" << bytes << "}";
+    }
+    if (g_fileSink) {
+        FileSink::Stats stats = g_fileSink->stats();
+        std::cout << "record: written " << stats.written
+                  << " dropped " << stats.dropped
+                  << " (" << stats.bytes / (1024 * 1024) << " MiB)" << std::endl;
+        json << ",\"record\":{\"written\":" << stats.written
+             << ",\"dropped\":" << stats.dropped
+             << ",\"bytes\":" << stats.bytes << "}";
     }
+    if (g_shmOutput) {
+        ShmOutput::Stats stats = g_shmOutput->stats();
+        std::cout << "shm: " << stats.consumers << " consumers, published "
+                  << stats.published << " dropped " << stats.dropped << std::endl;
+        json << ",\"shm\":{\"consumers\":" << stats.consumers
+             << ",\"published\":" << stats.published
+             << ",\"dropped\":" << stats.dropped << "}";
+    }
+    if (g_bufferTuner) {
+        std::cout << "buffers: " << g_bufferTuner->target() << " in circulation, hold p99 "
+                  << g_holdP99 / 1000.0 << " ms" << std::endl;
+        json << ",\"buffers\":{\"target\":" << g_bufferTuner->target()
+             << ",\"hold_p99_us\":" << g_holdP99 << "}";
+    }
+    if (g_previewsrc) {
+        const uint64_t pushed = g_previewPushed.load(std::memory_order_relaxed);
+        const uint64_t dropped = g_previewDropped.load(std::memory_order_relaxed);
+        std::cout << "preview: pushed " << pushed << " dropped " << dropped << std::endl;
+        json << ",\"preview\":{\"pushed\":" << pushed << ",\"dropped\":" << dropped << "}";
+    }
+    if (g_netsink)
+        json << ",\"destinations\":\"" << destinations() << "\"";
+    if (g_rateController) {
+        const RateController::Target &target = g_rateController->target();
+        std::cout << "adaptive: " << target.bitrate << " kbit/s, frame rate / "
+                  << (1u << target.tier) << ", loss " << g_lastReport.loss * 100
+                  << "%, rtt " << g_lastReport.rtt / 1000 << " ms" << std::endl;
+        json << ",\"adaptive\":{\"bitrate_kbps\":" << target.bitrate
+             << ",\"tier\":" << target.tier
+             << ",\"loss\":" << g_lastReport.loss
+             << ",\"jitter_us\":" << g_lastReport.jitter
+             << ",\"rtt_us\":" << g_lastReport.rtt
+             << ",\"base_rtt_us\":" << g_rateController->baseRtt(g_lastReportSsrc) << "}";
+    }
+    json << "}";
 
-    // choose first camera (CSI on Pi is usually index 0)
-    g_camera = g_camManager->get(cameras[0]->id());
-    if (!g_camera) {
-        std::cerr << "Failed to acquire camera\n";
-        g_camManager->stop();
-        gst_object_unref(g_appsrc);
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
+    if (g_statsServer)
+        g_statsServer->setReport(json.str());
+
+    return TRUE;
+}
+
+// ************ Region of interest ************************************************
+// Crop to \a roi from the next queued request on. Crops of the stream size
+// are streamed pixel for pixel, others are scaled to it by the ISP.
+static ControlServer::Reply set_roi(const Rectangle &roi)
+{
+    if (g_roiMaximum.isNull())
+        return { false, "the camera cannot crop" };
+
+    const Rectangle bounded = roi.boundedTo(g_roiMaximum);
+    if (bounded.isNull())
+        return { false, roi.toString() + " is outside of " + g_roiMaximum.toString() };
+
+    {
+        std::lock_guard<std::mutex> lock(g_roiLock);
+        g_roi = bounded;
     }
+    g_roiGeneration.fetch_add(1, std::memory_order_release);
 
-    if (g_camera->acquire() != 0) {
-        std::cerr << "Failed to acquire camera\n";
-        g_camManager->stop();
-        gst_object_unref(g_appsrc);
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
+    std::cout << "Region of interest " << bounded.toString() << std::endl;
+    return { true, bounded.toString() };
+}
+
+// "roi" alone reports the current crop, "roi full" restores the whole area
+static ControlServer::Reply change_roi(const std::vector<std::string> &args)
+{
+    if (args.empty()) {
+        std::lock_guard<std::mutex> lock(g_roiLock);
+        return { true, g_roi.isNull() ? g_roiMaximum.toString() : g_roi.toString() };
     }
 
-    // Generate configuration and select XRGB8888
-    // std::unique_ptr<CameraConfiguration> config = g_camera->generateConfiguration({ StreamRole::VideoRecording, StreamRole::Viewfinder });
-    // std::unique_ptr<CameraConfiguration> config = g_camera->generateConfiguration({ StreamRole::StillCapture });
-    // std::unique_ptr<CameraConfiguration> config = g_camera->generateConfiguration({ StreamRole::VideoRecording });
-    std::unique_ptr<CameraConfiguration> config = g_camera->generateConfiguration({ StreamRole::Viewfinder });
-    if (!config) {
-        std::cerr << "Failed to generate camera configuration\n";
-        g_camera->release();
-        g_camManager->stop();
-        gst_object_unref(g_appsrc);
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
+    if (args.size() == 1 && args[0] == "full")
+        return set_roi(g_roiMaximum);
+
+    int values[4];
+    for (unsigned int i = 0; args.size() == 4 && i < 4; ++i) {
+        char *end;
+        values[i] = strtol(args[i].c_str(), &end, 10);
+        if (*end || values[i] < 0 || (i >= 2 && !values[i]))
+            return { false, "invalid value '" + args[i] + "'" };
     }
+    if (args.size() != 4)
+        return { false, "expected X Y WIDTH HEIGHT or full" };
 
-    StreamConfiguration &streamCfg = config->at(0);
-    // Pick a sensible resolution & format
-    // streamCfg.size.width = 640;
-    // streamCfg.size.height = 480;
-    // streamCfg.size.width = 1640;
-    // streamCfg.size.height = 1232;
+    return set_roi(Rectangle(values[0], values[1], values[2], values[3]));
+}
+// ************ Region of interest ************************************************
 
-    // Preferred pixel format for Raspberry Pi (if available)
-    // streamCfg.pixelFormat = libcamera::formats::XRGB8888;
-    // streamCfg.pixelFormat = libcamera::formats::YUV420;
-    // streamCfg.pixelFormat = libcamera::formats::SBGGR16;
-    
-    // Validate & configure
-    CameraConfiguration::Status status = config->validate();
-    if (status == CameraConfiguration::Status::Invalid) {
-        std::cerr << "Camera configuration invalid\n";
-        g_camera->release();
-        g_camManager->stop();
-        gst_object_unref(g_appsrc);
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
+// ************ Destinations ************************************************
+// "add" and "remove" of the control socket. multiudpsink counts clients
+// added more than once, each remove drops one reference. RTCP goes to the
+// port above the RTP one.
+static ControlServer::Reply change_destination(const char *signal,
+                                               const std::vector<std::string> &args)
+{
+    if (args.size() != 2)
+        return { false, "expected HOST PORT" };
+
+    unsigned long port = strtoul(args[1].c_str(), nullptr, 10);
+    if (!port || port > 65535)
+        return { false, "invalid port '" + args[1] + "'" };
+
+    if (!strcmp(signal, "remove")) {
+        const std::string list = "," + destinations() + ",";
+        if (list.find("," + args[0] + ":" + args[1] + ",") == std::string::npos)
+            return { false, args[0] + ":" + args[1] + " is not a destination" };
     }
-    g_camera->configure(config.get());
 
-    // Save negotiated size (in case driver chose different)
-    width = streamCfg.size.width;
-    height = streamCfg.size.height;
-    // std::cout << "Using camera size: " << width << "x" << height << " format XRGB8888\n";
-    std::cout << "Default viewfinder configuration is: " << streamCfg.toString() << std::endl;
+    g_signal_emit_by_name(g_netsink, signal, args[0].c_str(), static_cast<gint>(port));
+    if (g_rtcpsink)
+        g_signal_emit_by_name(g_rtcpsink, signal, args[0].c_str(), static_cast<gint>(port + 1));
+    std::cout << "Destination " << args[0] << ":" << port
+              << (strcmp(signal, "add") ? " removed" : " added") << std::endl;
+    return { true, "" };
+}
+
+static void add_control_commands()
+{
+    g_controlServer->addCommand("add", "add HOST PORT",
+        [](const std::vector<std::string> &args) { return change_destination("add", args); });
+    g_controlServer->addCommand("remove", "remove HOST PORT",
+        [](const std::vector<std::string> &args) { return change_destination("remove", args); });
+    g_controlServer->addCommand("destinations", "destinations",
+        [](const std::vector<std::string> &) { return ControlServer::Reply{ true, destinations() }; });
+    if (!g_cameras.empty())
+        g_controlServer->addCommand("roi", "roi [X Y WIDTH HEIGHT | full]", change_roi);
+}
+// ************ Destinations ************************************************
 
-    // (Optional) Update caps on appsrc if camera changed resolution/format
-    // GstCaps *caps = gst_caps_from_string(
-    //     ("video/x-raw,format=XRGB,width=" + std::to_string(width) + ",height=" + std::to_string(height) + ",framerate=30/1").c_str());
-    // gst_app_src_set_caps(GST_APP_SRC(g_appsrc), caps);
-    // gst_caps_unref(caps);
+// End of a replay, or a pipeline error: leave the main loop
+static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer data)
+{
+    GMainLoop *loop = static_cast<GMainLoop *>(data);
 
-    // Allocate buffers
-    FrameBufferAllocator allocator(g_camera);
-    for (auto &cfg : *config) {
-        if (allocator.allocate(cfg.stream()) < 0) {
-            std::cerr << "Failed to allocate buffers\n";
-            g_camera->release();
-            g_camManager->stop();
-            gst_object_unref(g_appsrc);
-            gst_object_unref(pipeline);
-            return EXIT_FAILURE;
-        }
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_EOS:
+        g_main_loop_quit(loop);
+        break;
+    case GST_MESSAGE_ERROR: {
+        GError *err = nullptr;
+        gchar *debug = nullptr;
+        gst_message_parse_error(msg, &err, &debug);
+        std::cerr << "Pipeline error: " << err->message << "\n";
+        g_error_free(err);
+        g_free(debug);
+        g_main_loop_quit(loop);
+        break;
+    }
+    default:
+        break;
     }
 
-    // Create requests
-    std::vector<std::unique_ptr<Request>> requests;
-    Stream *stream = streamCfg.stream();
-    const auto &buffers = allocator.buffers(stream);
-    for (auto &buf : buffers) {
-        std::unique_ptr<Request> req = g_camera->createRequest();
-        if (!req) {
-            std::cerr << "Failed to create request\n";
-            continue;
-        }
-        if (req->addBuffer(stream, buf.get()) < 0) {
-            std::cerr << "Failed to add buffer\n";
-            continue;
-        }
-        requests.push_back(std::move(req));
+    return TRUE;
+}
+
+// Latency of buffers (or the first buffer of lists) passing a pad, from the
+// running time of their capture. Encoder output also counts frames.
+static GstPadProbeReturn on_stage_probe(GstPad *pad, GstPadProbeInfo *info, gpointer data)
+{
+    const Stage stage = static_cast<Stage>(GPOINTER_TO_INT(data));
+    GstBuffer *buffer = nullptr;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        if (gst_buffer_list_length(list))
+            buffer = gst_buffer_list_get(list, 0);
+    } else {
+        buffer = GST_PAD_PROBE_INFO_BUFFER(info);
     }
 
-    // Connect callback
-    g_camera->requestCompleted.connect(requestComplete);
+    if (stage == Stage::Encoded)
+        g_encodedFrames.fetch_add(1, std::memory_order_relaxed);
 
-    // Start camera & queue requests
-    if (g_camera->start() != 0) {
-        std::cerr << "Failed to start camera\n";
-        g_camera->release();
-        g_camManager->stop();
-        gst_object_unref(g_appsrc);
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
+    if (stage == Stage::Sent && !g_startup.firstPacket.load(std::memory_order_relaxed)) {
+        int64_t none = 0;
+        const int64_t now = monotonic_ns();
+        if (g_startup.firstPacket.compare_exchange_strong(none, now))
+            std::cout << "First packet sent " << (now - g_startup.start) / 1000000
+                      << " ms after start" << std::endl;
     }
 
-    for (auto &r : requests)
-        g_camera->queueRequest(r.get());
+    GstClock *clock = gst_element_get_clock(pipeline);
+    if (!clock)
+        return GST_PAD_PROBE_OK;
 
-    std::cout << "Streaming to " << dest_ip << ":" << dest_port << " — press Ctrl+C to stop\n";
+    const GstClockTime running = gst_clock_get_time(clock) - gst_element_get_base_time(pipeline);
+    gst_object_unref(clock);
 
-    // Main loop: keep running until SIGINT
-        std::cout << "Streaming MJPEG RTP to " << dest_ip << ":" << dest_port << " ...\n";
-    std::cout << "Press Ctrl-C to stop\n";
-    // ***************** Camera ***********************************************
+    if (buffer && GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)) &&
+        running >= GST_BUFFER_PTS(buffer))
+        g_latency[static_cast<unsigned int>(stage)].record((running - GST_BUFFER_PTS(buffer)) / 1000);
 
-    // ***************** GStreamer ********************************************
-    gst_init(&argc, &argv);
+    return GST_PAD_PROBE_OK;
+}
 
-    char pipeline_desc[1024];
-    std::snprintf(pipeline_desc, sizeof(pipeline_desc),
-        "appsrc name=mysrc is-live=true block=true format=TIME "
-        "caps=video/x-raw,format=BGRx,width=800,height=600,framerate=30/1 "
-        "! videoconvert "
-        "! video/x-raw,format=I420 "
-        "! x264enc tune=zerolatency speed-preset=ultrafast "
-        "! rtph264pay config-interval=1 pt=96 "
-        "! udpsink host=%s port=%d auto-multicast=false",
-        dest_ip, dest_port);
-    
-    std::cout << "GStreamer pipeline: " << pipeline_desc << std::endl;
+static void add_stage_probe(const char *element, const char *pad_name, Stage stage)
+{
+    GstElement *elem = gst_bin_get_by_name(GST_BIN(pipeline), element);
+    if (!elem)
+        return;
 
-    GError *err = nullptr;
-    pipeline = gst_parse_launch(pipeline_desc, &err);
-    if (!pipeline) {
-        std::cerr << "Failed to create pipeline: " << (err ? err->message : "(unknown)") << "\n";
-        if (err) g_error_free(err);
-        return EXIT_FAILURE;
+    GstPad *pad = gst_element_get_static_pad(elem, pad_name);
+    if (pad) {
+        gst_pad_add_probe(pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER |
+                                                            GST_PAD_PROBE_TYPE_BUFFER_LIST),
+                          on_stage_probe, GINT_TO_POINTER(static_cast<int>(stage)), nullptr);
+        gst_object_unref(pad);
     }
+    gst_object_unref(elem);
+}
 
-    // Get appsrc element
-    g_appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "mysrc");
-    if (!g_appsrc) {
-        std::cerr << "Failed to get appsrc element from pipeline\n";
-        gst_object_unref(pipeline);
-        return EXIT_FAILURE;
-    }
+// ************ Requests ************************************************
+// One entry per request of all cameras, indexed by the request cookie. The
+// memory count tracks GstMemory objects still wrapping its buffers in
+// zero-copy mode.
+struct InflightRequest {
+    CameraContext *camera = nullptr;
+    Request *request = nullptr;
+    std::atomic<unsigned int> memories{0};
+    // Completion time in nanoseconds, for the hold time
+    std::atomic<int64_t> completed{0};
+};
+static std::vector<InflightRequest> g_inflight;
 
-    // Start pipeline playing
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+static void queue_request(CameraContext *ctx, Request *request)
+{
+    request->reuse(Request::ReuseBuffers);
 
-    // Push one frame every 1/FPS second
-    g_timeout_add(1000 / FPS, push_frame, NULL);
-    
-    // Main loop
-    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
-    g_main_loop_run(loop);
-    // ***************** GStreamer ********************************************
+    // Frame rate changes of the rate adaptation ride on the next request
+    const int64_t duration = g_captureDuration.load(std::memory_order_relaxed);
+    if (duration && ctx->frameDuration.exchange(duration, std::memory_order_relaxed) != duration)
+        request->controls().set(controls::FrameDurationLimits,
+                                Span<const int64_t, 2>({ duration, duration }));
 
-    // Clean up
-    std::cout << "Stopping...\n";
-    g_camera->stop();
-    // free allocator buffers
-    for (auto &cfg : *config)
-        allocator.free(cfg.stream());
+    // and so do new regions of interest
+    const unsigned int generation = g_roiGeneration.load(std::memory_order_acquire);
+    if (ctx->roiGeneration.exchange(generation, std::memory_order_relaxed) != generation) {
+        std::lock_guard<std::mutex> lock(g_roiLock);
+        request->controls().set(controls::ScalerCrop, g_roi);
+    }
+
+    g_queuedRequests.fetch_add(1, std::memory_order_relaxed);
+    ctx->queued.fetch_add(1, std::memory_order_relaxed);
+    ctx->camera->queueRequest(request);
+}
 
-    g_camera->release();
-    g_camManager->stop();
+// Requests beyond the pool target leave circulation until the tuner
+// raises it again. The count only changes together with the parked list,
+// under its lock, so unpark_requests() never sees one without the other;
+// the unlocked check spares the lock while the pool is at its target.
+static bool park_request(CameraContext *ctx, Request *request)
+{
+    const unsigned int target = g_bufferTarget.load(std::memory_order_relaxed);
+    if (ctx->circulating.load(std::memory_order_relaxed) <= target)
+        return false;
+
+    std::lock_guard<std::mutex> lock(ctx->parkedLock);
+    if (ctx->circulating.load(std::memory_order_relaxed) <= target)
+        return false;
+
+    ctx->circulating.fetch_sub(1, std::memory_order_relaxed);
+    ctx->parked.push_back(request);
+    return true;
+}
+
+// Hand a request back to its camera once downstream is done with it. Called
+// from the camera thread, or from GStreamer threads with zero-copy.
+static void requeue_request(Request *request)
+{
+    InflightRequest &inflight = g_inflight[request->cookie()];
+
+    if (g_bufferTuner) {
+        const int64_t completed = inflight.completed.load(std::memory_order_relaxed);
+        if (completed)
+            g_holdTime.record((monotonic_ns() - completed) / 1000);
+        if (park_request(inflight.camera, request))
+            return;
+    }
+
+    queue_request(inflight.camera, request);
+}
+
+// Buffer of the stream that is sent out
+static FrameBuffer *stream_buffer(Request *request)
+{
+    return request->findBuffer(g_inflight[request->cookie()].camera->stream);
+}
+
+static int64_t sensor_timestamp(Request *request)
+{
+    std::optional<int64_t> ts = request->metadata().get(controls::SensorTimestamp);
+    if (ts)
+        return *ts;
+
+    return stream_buffer(request)->metadata().timestamp;
+}
+
+// Frame duration reported by the sensor in nanoseconds, 0 if unknown
+static uint64_t frame_duration(Request *request)
+{
+    std::optional<int64_t> duration = request->metadata().get(controls::FrameDuration);
+    return duration && *duration > 0 ? *duration * 1000 : 0;
+}
+// ************ Requests ************************************************
+
+// ************ Zero-copy ************************************************
+
+// Destroy notify of a wrapped plane: the last one hands the request back
+// to the camera. Runs on whichever GStreamer thread drops the memory.
+static void release_plane(gpointer data)
+{
+    InflightRequest *inflight = static_cast<InflightRequest *>(data);
+    if (inflight->memories.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    if (!g_running)
+        return;
+
+    requeue_request(inflight->request);
+}
+
+static GstMemory *wrap_plane(InflightRequest &inflight,
+                             const FrameBuffer::Plane &plane, unsigned int size)
+{
+    GstMemory *mem = gst_dmabuf_allocator_alloc_with_flags(
+        g_dmabufAllocator, plane.fd.get(), plane.offset + plane.length,
+        GST_FD_MEMORY_FLAG_DONT_CLOSE);
+    gst_memory_resize(mem, plane.offset, std::min(size, plane.length));
+
+    inflight.memories.fetch_add(1, std::memory_order_relaxed);
+    gst_mini_object_set_qdata(GST_MINI_OBJECT(mem), g_releaseQuark,
+                              &inflight, release_plane);
+    return mem;
+}
+
+// Wrap the planes of a completed request (or top-bottom pair) as dmabuf
+// memories and push them without touching the pixels. The requests stay
+// owned by GStreamer until every memory has been released.
+static void push_request(Request *left, Request *right)
+{
+    // Downstream is saturated (or not built yet, without an allocator to
+    // wrap the planes): hand the buffers straight back to the camera
+    if (!g_appsrc || !g_dmabufAllocator || g_appsrcFull.load(std::memory_order_acquire)) {
+        g_pushDropped.fetch_add(1, std::memory_order_relaxed);
+        requeue_request(left);
+        if (right)
+            requeue_request(right);
+        return;
+    }
+
+    Request *eyes[2] = { left, right };
+    const unsigned int numEyes = right ? 2 : 1;
+    GstBuffer *buffer = gst_buffer_new();
+
+    // A top-bottom plane is the left eye's plane followed by the right
+    // one's, so the memories of both eyes are interleaved plane by plane
+    const unsigned int numPlanes = stream_buffer(left)->planes().size();
+    for (unsigned int i = 0; i < numPlanes; ++i) {
+        for (unsigned int e = 0; e < numEyes; ++e) {
+            // whole rows, so that the planes land on the layout's offsets
+            FrameBuffer *fb = stream_buffer(eyes[e]);
+            const PlaneLayout &plane = g_streamLayout.planes[i];
+            unsigned int size = plane.stride * plane.rows;
+
+            gst_buffer_append_memory(buffer,
+                wrap_plane(g_inflight[eyes[e]->cookie()], fb->planes()[i], size));
+        }
+    }
+
+    stamp_buffer(buffer, sensor_timestamp(left), frame_duration(left));
+    add_video_meta(buffer);
+    record_latency(Stage::Push, sensor_timestamp(left));
+
+    // appsrc takes ownership; on failure the buffer is freed and the
+    // requests requeued through release_plane()
+    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(g_appsrc), buffer);
+    if (ret != GST_FLOW_OK)
+        g_print("Failed to push buffer: %d\n", ret);
+}
+// ************ Zero-copy ************************************************
+// ************ Gstreamer ************************************************
+
+// Debayer a raw frame into the camera's frame of the stream layout, once
+// per completed request however many times it is read
+static Image *debayer_request(CameraContext *ctx, Request *request, const Image &raw)
+{
+    const unsigned int sequence = stream_buffer(request)->metadata().sequence;
+    if (ctx->debayeredRequest == request && ctx->debayeredSequence == sequence)
+        return ctx->debayered.get();
+
+    ImageAccess access(raw, 1 << 0, Image::MapMode::ReadOnly);
+    const PlaneView<const uint8_t> src = raw.plane(0);
+    const PlaneView<uint8_t> dst = ctx->debayered->plane(0);
+
+    if (g_options.raw == RawOutput::Gray)
+        BayertoGRAY8Binned(src.data, src.stride, g_bayer, dst.data, dst.stride,
+                           src.width, src.height, g_workers.get());
+    else
+        BayertoXRGB8888(src.data, src.stride, g_bayer, dst.data, dst.stride,
+                        src.width, src.height, g_workers.get());
+
+    ctx->debayeredRequest = request;
+    ctx->debayeredSequence = sequence;
+    return ctx->debayered.get();
+}
+
+static Image *request_image(Request *request)
+{
+    CameraContext *ctx = g_inflight[request->cookie()].camera;
+    Image *image = ctx->images.find(stream_buffer(request));
+    if (!image || g_options.raw == RawOutput::Off)
+        return image;
+
+    return debayer_request(ctx, request, *image);
+}
+
+// Copy all planes of the streamed buffer into dst at their layout offsets,
+// in one go when the strides match and row by row when they don't. Returns
+// the number of bytes written
+static size_t copy_image(const Image *image, const FrameLayout &layout, uint8_t *dst, size_t size)
+{
+    ImageAccess access(*image, Image::AllPlanes, Image::MapMode::ReadOnly);
+
+    size_t end = 0;
+    for (unsigned int i = 0; i < image->layout().planes.size() && i < layout.planes.size(); ++i) {
+        const PlaneLayout &plane = layout.planes[i];
+        const PlaneView<const uint8_t> src = image->plane(i);
+        const size_t length = static_cast<size_t>(plane.stride) * plane.rows;
+
+        if (src.height != plane.rows || src.bytesPerLine != plane.bytesPerLine) {
+            std::cerr << "plane " << i << " does not match the layout" << std::endl;
+            break;
+        }
+
+        if (plane.offset + length > size) {
+            std::cerr << "frame larger than ring slot" << std::endl;
+            break;
+        }
+
+        if (src.stride == plane.stride) {
+            memcpy(dst + plane.offset, src.data,
+                   length - plane.stride + plane.bytesPerLine);
+        } else {
+            for (unsigned int y = 0; y < plane.rows; ++y)
+                memcpy(dst + plane.offset + y * static_cast<size_t>(plane.stride),
+                       src.row(y), plane.bytesPerLine);
+        }
+        end = plane.offset + length;
+    }
+
+    return end;
+}
+
+static size_t copy_request(Request *request, uint8_t *dst, size_t size)
+{
+    Image *image = request_image(request);
+    if (!image) {
+        std::cerr << "No mapping for completed buffer\n";
+        return 0;
+    }
+
+    return copy_image(image, g_streamLayout, dst, size);
+}
+
+// The preview frame is a fraction of the main one, copying it costs less
+// than holding the request until the preview encoder is done
+static void push_preview(Request *request)
+{
+    CameraContext *ctx = g_inflight[request->cookie()].camera;
+    FrameBuffer *fb = request->findBuffer(ctx->preview);
+    if (!fb || fb->metadata().status != FrameMetadata::FrameSuccess)
+        return;
+
+    Image *image = ctx->images.find(fb);
+    if (!image)
+        return;
+
+    GstBuffer *buffer = nullptr;
+    GstBufferPoolAcquireParams params = {};
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    if (gst_buffer_pool_acquire_buffer(g_previewPool, &buffer, &params) != GST_FLOW_OK) {
+        g_previewDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    GstMapInfo map;
+    gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+    copy_image(image, g_previewLayout, map.data, map.size);
+    gst_buffer_unmap(buffer, &map);
+
+    stamp_buffer(buffer, sensor_timestamp(request), frame_duration(request), g_previewTime);
+    add_pooled_video_meta(buffer, g_previewLayout);
+    if (gst_app_src_push_buffer(GST_APP_SRC(g_previewsrc), buffer) == GST_FLOW_OK)
+        g_previewPushed.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Handler of the depth worker, on its thread. The map is stamped with the
+// sensor timestamp of its left frame, which the video frame got as well
+static void push_depth(const uint16_t *disparity, unsigned int stride, uint64_t timestamp)
+{
+    if (!g_depthsrc)
+        return;
+
+    GstBuffer *buffer = nullptr;
+    GstBufferPoolAcquireParams params = {};
+    params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+    if (gst_buffer_pool_acquire_buffer(g_depthPool, &buffer, &params) != GST_FLOW_OK) {
+        g_depthDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    GstMapInfo map;
+    gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+    const size_t size = g_depthEncoder->encode(disparity, stride, timestamp, map.data);
+    gst_buffer_unmap(buffer, &map);
+    gst_buffer_set_size(buffer, size);
+
+    stamp_buffer(buffer, timestamp, 0, g_depthTime);
+    if (gst_app_src_push_buffer(GST_APP_SRC(g_depthsrc), buffer) == GST_FLOW_OK) {
+        g_depthPushed.fetch_add(1, std::memory_order_relaxed);
+        g_depthBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+// Queue a copy of a filled ring slot for the disk writer
+static void record_slot(const FrameSlot *slot)
+{
+    FrameSlot *record = g_fileSink->begin();
+    if (!record)
+        return;
+
+    memcpy(record->data.data(), slot->data.data(), slot->bytesused);
+    record->bytesused = slot->bytesused;
+    record->rightOffset = slot->rightOffset;
+    record->timestamp = slot->timestamp;
+    record->duration = slot->duration;
+    record->sequence = slot->sequence;
+    g_fileSink->commit(record);
+}
+
+// Zero-copy has no slot to share, both eyes are copied from the camera
+// mappings one after the other
+static void record_requests(Request *left, Request *right)
+{
+    FrameSlot *record = g_fileSink->begin();
+    if (!record)
+        return;
+
+    uint8_t *dst = record->data.data();
+    const size_t size = record->data.size();
+    size_t offset = copy_request(left, dst, size);
+
+    record->rightOffset = 0;
+    if (right) {
+        record->rightOffset = offset;
+        offset += copy_request(right, dst + offset, size - offset);
+    }
+
+    record->bytesused = offset;
+    record->timestamp = sensor_timestamp(left);
+    record->duration = frame_duration(left);
+    record->sequence = stream_buffer(left)->metadata().sequence;
+    g_fileSink->commit(record);
+}
+
+// Convert the XRGB8888 buffer to I420 at the output layout offsets, returns
+// the number of bytes written
+static size_t convert_request(Request *request, uint8_t *dst, size_t size)
+{
+    Image *image = request_image(request);
+    if (!image || size < g_outLayout.frameSize) {
+        std::cerr << "Cannot convert completed buffer\n";
+        return 0;
+    }
+
+    ImageAccess access(*image, 1 << 0, Image::MapMode::ReadOnly);
+    const PlaneView<uint8_t> src = image->plane(0);
+    const std::vector<PlaneLayout> &out = g_outLayout.planes;
+    XRGB8888toI420(src.data, src.stride,
+                   dst + out[0].offset, out[0].stride,
+                   dst + out[1].offset, out[1].stride,
+                   dst + out[2].offset, out[2].stride,
+                   g_outLayout.size.width, g_outLayout.size.height,
+                   g_workers.get());
+
+    return g_outLayout.frameSize;
+}
+
+// Where the rectified eyes live in a slot: their halves of the packed frame,
+// or one after the other in the stream layout
+static void rectified_planes(uint8_t *dst, uint8_t *planes[2][3],
+                             unsigned int strides[2][3])
+{
+    const FrameLayout &layout = g_rectifier->layout();
+
+    for (unsigned int i = 0; i < layout.planes.size(); ++i) {
+        for (unsigned int eye = 0; eye < 2; ++eye) {
+            if (g_packer) {
+                planes[eye][i] = g_packer->plane(eye, i, dst);
+                strides[eye][i] = g_packer->packed().planes[i].stride;
+            } else {
+                planes[eye][i] = dst + eye * layout.frameSize + layout.planes[i].offset;
+                strides[eye][i] = layout.planes[i].stride;
+            }
+        }
+    }
+}
+
+// Rectify both eyes into the slot. Returns the number of bytes written and
+// the offset of the right eye, 0 when packed
+static size_t rectify_pair(Image *images[2], uint8_t *dst, size_t *rightOffset)
+{
+    const FrameLayout &layout = g_rectifier->layout();
+    uint8_t *planes[2][3];
+    unsigned int strides[2][3];
+
+    rectified_planes(dst, planes, strides);
+    g_rectifier->process(StereoPairer::Left, *images[0], planes[0], strides[0], g_workers.get());
+    g_rectifier->process(StereoPairer::Right, *images[1], planes[1], strides[1], g_workers.get());
+
+    *rightOffset = g_packer ? 0 : layout.frameSize;
+    return g_packer ? g_packer->packed().frameSize : 2 * layout.frameSize;
+}
+
+// Offer the luma of a rectified pair in dst to the depth worker
+static void feed_depth(uint8_t *dst, uint64_t timestamp)
+{
+    if (!g_depth->begin())
+        return;
+
+    const Size &size = g_depth->size();
+    uint8_t *planes[2][3];
+    unsigned int strides[2][3];
+
+    rectified_planes(dst, planes, strides);
+
+    for (unsigned int eye = 0; eye < 2; ++eye) {
+        uint8_t *gray = g_depth->input(eye);
+
+        if (g_rectifier->layout().format == formats::XRGB8888) {
+            XRGB8888toGRAY8(planes[eye][0], strides[eye][0], gray, g_depth->stride(),
+                            size.width, size.height, g_workers.get());
+            continue;
+        }
+
+        for (unsigned int y = 0; y < size.height; ++y)
+            memcpy(gray + y * g_depth->stride(),
+                   planes[eye][0] + y * static_cast<size_t>(strides[eye][0]),
+                   size.width);
+    }
+
+    g_depth->commit(timestamp);
+}
+
+// Whether the frame (the left eye of a pair) goes on to the stream and the
+// recorder: it changed since the last frame let through, or none was for a
+// heartbeat. Heartbeats force a keyframe, so that receivers joining a
+// static scene get a picture.
+static bool gate_frame(Request *request)
+{
+    Image *image = request_image(request);
+    if (!image)
+        return true;
+
+    const int64_t timestamp = sensor_timestamp(request);
+    const bool heartbeat = timestamp - g_lastGated >= g_options.heartbeat * INT64_C(1000000);
+    const bool changed = g_changeDetector->changed(*image);
+    if (!changed && !heartbeat) {
+        g_gateSkipped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (!changed && g_encoder) {
+        gst_element_send_event(g_encoder,
+            gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        g_gateHeartbeats.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    g_changeDetector->commit();
+    g_lastGated = timestamp;
+    return true;
+}
+
+// Hand a mono frame (right == nullptr) or a stereo pair to the push side,
+// then give the requests back to the cameras
+static void deliver(Request *left, Request *right)
+{
+    if (g_changeDetector && !gate_frame(left)) {
+        requeue_request(left);
+        if (right)
+            requeue_request(right);
+        return;
+    }
+
+    if (g_fileSink && g_options.zeroCopy)
+        record_requests(left, right);
+
+    // Without packing only the left eye is streamed
+    if (right && !g_packer && g_options.zeroCopy) {
+        requeue_request(right);
+        right = nullptr;
+    }
+
+    if (g_options.zeroCopy) {
+        push_request(left, right);
+        return;
+    }
+
+    // Requeueing is left out, libcamera allocates when queueing requests
+    const uint64_t allocations = threadAllocationCount();
+
+    // No slot means the frame is dropped (counted by the ring)
+    FrameSlot *slot = g_ring->beginWrite();
+    if (slot) {
+        size_t offset;
+        Image *images[2];
+
+        if (right && g_rectifier && (images[0] = request_image(left)) &&
+            (images[1] = request_image(right))) {
+            offset = rectify_pair(images, slot->data.data(), &slot->rightOffset);
+            if (g_depth)
+                feed_depth(slot->data.data(), sensor_timestamp(left));
+        } else if (right && g_packer && (images[0] = request_image(left)) &&
+                   (images[1] = request_image(right))) {
+            // Each eye goes straight from its camera mapping into its half
+            g_packer->pack(StereoPairer::Left, *images[0], slot->data.data());
+            g_packer->pack(StereoPairer::Right, *images[1], slot->data.data());
+            offset = g_packer->packed().frameSize;
+            slot->rightOffset = 0;
+        } else {
+            offset = g_options.cpuConvert
+                   ? convert_request(left, slot->data.data(), slot->data.size())
+                   : copy_request(left, slot->data.data(), slot->data.size());
+
+            slot->rightOffset = 0;
+            if (right) {
+                slot->rightOffset = offset;
+                offset += copy_request(right, slot->data.data() + offset,
+                                       slot->data.size() - offset);
+            }
+        }
+
+        slot->bytesused = offset;
+        slot->sequence = stream_buffer(left)->metadata().sequence;
+        slot->timestamp = sensor_timestamp(left);
+        slot->duration = frame_duration(left);
+        if (g_fileSink)
+            record_slot(slot);
+        // Local consumers don't wait for appsrc to take the frame
+        if (g_shmOutput)
+            g_shmOutput->publish(*slot);
+        g_ring->commitWrite(slot);
+        record_latency(Stage::Ring, slot->timestamp);
+
+        if (g_options.pushMode == PushMode::Event)
+            wake_push_side();
+    }
+    g_captureAllocations.fetch_add(threadAllocationCount() - allocations,
+                                   std::memory_order_relaxed);
+
+    // Reuse and requeue request for next capture
+    requeue_request(left);
+    if (right)
+        requeue_request(right);
+}
+
+// requestCompleted callback of every camera: push frame to appsrc
+static void requestComplete(Request *request)
+{    
+    InflightRequest &inflight = g_inflight[request->cookie()];
+
+    // Every camera completes its requests on the CameraManager thread
+    static std::once_flag placed;
+    std::call_once(placed, [] { place_thread(pthread_self(), ThreadRole::Capture); });
+
+    g_queuedRequests.fetch_sub(1, std::memory_order_relaxed);
+    if (request->status() != Request::RequestComplete)
+        return;
+
+    // The last queued request completing leaves the next frame without one
+    // unless a request is requeued in time
+    if (inflight.camera->queued.fetch_sub(1, std::memory_order_relaxed) == 1)
+        g_starved.fetch_add(1, std::memory_order_relaxed);
+    inflight.completed.store(monotonic_ns(), std::memory_order_relaxed);
+
+    record_latency(Stage::Completion, sensor_timestamp(request));
+
+    if (g_previewsrc && inflight.camera->preview)
+        push_preview(request);
+
+    if (!g_pairer) {
+        deliver(request, nullptr);
+        return;
+    }
+
+    g_pairer->add(inflight.camera->eye, request, sensor_timestamp(request));
+}
+
+// A raw frame is a single plane of g_bayer samples, which FrameLayout
+// doesn't describe
+static FrameLayout raw_layout(const StreamConfiguration &cfg)
+{
+    PlaneLayout plane;
+    plane.width = cfg.size.width;
+    plane.bytesPerLine = g_bayer.bytesPerLine(cfg.size.width);
+    plane.stride = cfg.stride;
+    plane.rows = cfg.size.height;
+    plane.offset = 0;
+
+    FrameLayout layout;
+    layout.format = cfg.pixelFormat;
+    layout.size = cfg.size;
+    layout.planes.push_back(plane);
+    layout.frameSize = static_cast<size_t>(plane.stride) * plane.rows;
+    return layout;
+}
+
+// Acquire, configure and allocate one camera. A reference configuration
+// (the left eye's) forces the same size and format, anything the camera
+// cannot match exactly is an error.
+static int setup_camera(CameraContext &ctx, const std::string &id,
+                        const StreamConfiguration *reference, unsigned int cookie)
+{
+    ctx.camera = g_camManager->get(id);
+    if (!ctx.camera) {
+        std::cerr << "Failed to acquire camera\n";
+        return -ENODEV;
+    }
+
+    if (ctx.camera->acquire() != 0) {
+        std::cerr << "Failed to acquire camera\n";
+        return -EBUSY;
+    }
+    ctx.acquired = true;
+
+    // Generate configuration and select XRGB8888
+    // std::unique_ptr<CameraConfiguration> config = g_camera->generateConfiguration({ StreamRole::VideoRecording, StreamRole::Viewfinder });
+    // std::unique_ptr<CameraConfiguration> config = g_camera->generateConfiguration({ StreamRole::StillCapture });
+    // std::unique_ptr<CameraConfiguration> config = g_camera->generateConfiguration({ StreamRole::VideoRecording });
+    // The left camera adds a preview stream for --preview
+    // --raw replaces the processed stream with the sensor's Bayer frames
+    const bool preview = g_options.preview.port && !reference;
+    if (g_options.raw != RawOutput::Off)
+        ctx.config = ctx.camera->generateConfiguration({ StreamRole::Raw });
+    else if (preview)
+        ctx.config = ctx.camera->generateConfiguration({ StreamRole::VideoRecording,
+                                                         StreamRole::Viewfinder });
+    else
+        ctx.config = ctx.camera->generateConfiguration({ StreamRole::Viewfinder });
+    if (!ctx.config || (preview && ctx.config->size() < 2)) {
+        std::cerr << "Failed to generate camera configuration\n";
+        return -EINVAL;
+    }
+
+    StreamConfiguration &streamCfg = ctx.config->at(0);
+    // Pick a sensible resolution & format
+    // streamCfg.size.width = 640;
+    // streamCfg.size.height = 480;
+    // streamCfg.size.width = 1640;
+    // streamCfg.size.height = 1232;
+
+    // Preferred pixel format for Raspberry Pi (if available)
+    // streamCfg.pixelFormat = libcamera::formats::XRGB8888;
+    // streamCfg.pixelFormat = libcamera::formats::YUV420;
+    // streamCfg.pixelFormat = libcamera::formats::SBGGR16;
+
+    if (g_options.pixelFormat.isValid())
+        streamCfg.pixelFormat = g_options.pixelFormat;
+    if (!g_options.size.isNull())
+        streamCfg.size = g_options.size;
+
+    if (reference) {
+        streamCfg.size = reference->size;
+        streamCfg.pixelFormat = reference->pixelFormat;
+    }
+
+    // A region of interest is streamed at its native size by default
+    if (!g_options.roi.isNull() && g_options.size.isNull())
+        streamCfg.size = g_options.roi.size();
+
+    // The tuner keeps only part of an auto pool in circulation
+    if (g_options.tuneBuffers)
+        streamCfg.bufferCount = std::max(streamCfg.bufferCount, AutoBuffers);
+    else if (g_options.buffers)
+        streamCfg.bufferCount = g_options.buffers;
+
+    // Scaled by the ISP, into a format every encoder takes
+    if (preview) {
+        StreamConfiguration &previewCfg = ctx.config->at(1);
+        previewCfg.size = g_options.previewSize;
+        previewCfg.pixelFormat = formats::YUV420;
+        previewCfg.bufferCount = streamCfg.bufferCount;
+    }
+    
+    // Validate & configure
+    CameraConfiguration::Status status = ctx.config->validate();
+    if (status == CameraConfiguration::Status::Invalid) {
+        std::cerr << "Camera configuration invalid\n";
+        return -EINVAL;
+    }
+    if (status == CameraConfiguration::Status::Adjusted && !reference)
+        std::cout << "Camera configuration adjusted to " << streamCfg.toString() << std::endl;
+
+    if (reference && (streamCfg.size.width != reference->size.width ||
+                      streamCfg.size.height != reference->size.height ||
+                      streamCfg.pixelFormat != reference->pixelFormat ||
+                      streamCfg.stride != reference->stride)) {
+        std::cerr << "Cameras cannot be configured identically: "
+                  << streamCfg.toString() << " vs " << reference->toString() << "\n";
+        return -EINVAL;
+    }
+
+    // The kernels read whole 2x2 quads and mirror one row and column
+    if (g_options.raw != RawOutput::Off &&
+        (!BayerFormat::fromPixelFormat(streamCfg.pixelFormat, &g_bayer) ||
+         streamCfg.size.width < 4 || streamCfg.size.height < 4 ||
+         streamCfg.size.width % 2 || streamCfg.size.height % 2)) {
+        std::cerr << "Cannot debayer " << streamCfg.toString() << " frames\n";
+        return -EINVAL;
+    }
+
+    if (ctx.camera->configure(ctx.config.get()) < 0) {
+        std::cerr << "Failed to configure camera\n";
+        return -EINVAL;
+    }
+
+    std::cout << "Default viewfinder configuration is: " << streamCfg.toString()
+              << ", " << streamCfg.bufferCount << " buffers" << std::endl;
+    if (preview)
+        std::cout << "Preview configuration is: " << ctx.config->at(1).toString() << std::endl;
+
+    // Allocate buffers
+    ctx.allocator = std::make_unique<FrameBufferAllocator>(ctx.camera);
+    for (auto &cfg : *ctx.config) {
+        if (ctx.allocator->allocate(cfg.stream()) < 0) {
+            std::cerr << "Failed to allocate buffers\n";
+            return -ENOMEM;
+        }
+    }
+
+    // Create requests
+    Stream *stream = streamCfg.stream();
+    ctx.stream = stream;
+    const auto &buffers = ctx.allocator->buffers(stream);
+    if (preview)
+        ctx.preview = ctx.config->at(1).stream();
+    for (unsigned int i = 0; i < buffers.size(); ++i) {
+        // the cookie indexes the request's entry in g_inflight
+        std::unique_ptr<Request> req = ctx.camera->createRequest(cookie);
+        if (!req) {
+            std::cerr << "Failed to create request\n";
+            continue;
+        }
+        if (req->addBuffer(stream, buffers[i].get()) < 0) {
+            std::cerr << "Failed to add buffer\n";
+            continue;
+        }
+        // Requests beyond the preview buffers only carry the main stream
+        if (ctx.preview && i < ctx.allocator->buffers(ctx.preview).size() &&
+            req->addBuffer(ctx.preview, ctx.allocator->buffers(ctx.preview)[i].get()) < 0) {
+            std::cerr << "Failed to add preview buffer\n";
+            continue;
+        }
+        ctx.requests.push_back(std::move(req));
+        cookie++;
+    }
+
+    // Map every buffer once up front, the completion path only looks them up
+    const FrameLayout layout = g_options.raw != RawOutput::Off
+                             ? raw_layout(streamCfg) : FrameLayout::fromStream(streamCfg);
+    if (!layout.isValid()) {
+        std::cerr << "Cannot map " << streamCfg.pixelFormat.toString() << " frames\n";
+        return -EINVAL;
+    }
+    if (ctx.images.map(buffers, Image::MapMode::ReadOnly, layout) < 0 ||
+        (ctx.preview && ctx.images.map(ctx.allocator->buffers(ctx.preview),
+                                       Image::MapMode::ReadOnly,
+                                       FrameLayout::fromStream(ctx.config->at(1))) < 0)) {
+        std::cerr << "Failed to map buffers\n";
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+// Frame duration in microseconds clamped to the limits of the configured
+// sensor mode of every camera
+static int64_t clamp_frame_duration(int64_t duration)
+{
+    for (auto &ctx : g_cameras) {
+        const ControlInfoMap &info = ctx->camera->controls();
+        auto it = info.find(&controls::FrameDurationLimits);
+        if (it == info.end())
+            continue;
+
+        duration = std::clamp(duration, it->second.min().get<int64_t>(),
+                              it->second.max().get<int64_t>());
+    }
+
+    return duration;
+}
+
+static int64_t select_frame_duration()
+{
+    return clamp_frame_duration(1000000 / g_options.fps);
+}
+
+static void release_cameras()
+{
+    for (auto &ctx : g_cameras) {
+        if (ctx->started)
+            ctx->camera->stop();
+        ctx->started = false;
+    }
+
+    for (auto &ctx : g_cameras) {
+        // unmap before the buffers go away
+        ctx->images.clear();
+        ctx->requests.clear();
+        // free allocator buffers
+        ctx->allocator.reset();
+
+        if (ctx->acquired)
+            ctx->camera->release();
+        ctx->acquired = false;
+    }
+}
+
+// Stop and release everything set up once the cameras are, on exit as on
+// any failure after setup_cameras(). Parts never set up are skipped.
+static void teardown()
+{
+    // Stop the pipeline first so that it drops any buffers still wrapping
+    // camera memory
+    if (pipeline)
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+    if (g_replayThread.joinable())
+        g_replayThread.join();
+
+    release_cameras();
+    if (g_camManager)
+        g_camManager->stop();
+
+    // Frames still queued for the disk are written out before exiting
+    g_fileSink.reset();
+    // The depth thread pushes maps until it is joined
+    g_depth.reset();
+
+    g_controlServer.reset();
+    g_shmOutput.reset();
+    if (g_netsink)
+        gst_object_unref(g_netsink);
+    if (g_rtcpsink)
+        gst_object_unref(g_rtcpsink);
+    if (g_previewsrc)
+        gst_object_unref(g_previewsrc);
+    if (g_previewPool) {
+        gst_buffer_pool_set_active(g_previewPool, FALSE);
+        gst_object_unref(g_previewPool);
+    }
+    if (g_depthsrc)
+        gst_object_unref(g_depthsrc);
+    if (g_depthPool) {
+        gst_buffer_pool_set_active(g_depthPool, FALSE);
+        gst_object_unref(g_depthPool);
+    }
+    if (g_pushPool) {
+        gst_buffer_pool_set_active(g_pushPool, FALSE);
+        gst_object_unref(g_pushPool);
+    }
+    if (g_encoder)
+        gst_object_unref(g_encoder);
+    if (g_appsrc)
+        gst_object_unref(g_appsrc);
+    if (pipeline)
+        gst_object_unref(pipeline);
+    if (g_dmabufAllocator)
+        gst_object_unref(g_dmabufAllocator);
+    if (g_wakeupFd >= 0)
+        close(g_wakeupFd);
+}
+
+// ************ Replay ************************************************
+// The recorded frames (left eye or packed pair) become the stream, at the
+// recorded frame rate
+static int setup_replay()
+{
+    g_replay = std::make_unique<RecordingReader>();
+    if (g_replay->open(g_options.replayPath) < 0)
+        return -1;
+
+    g_streamLayout = g_replay->layout(0);
+    g_outLayout = g_streamLayout;
+    if (!gstFormatName(g_outLayout.format)) {
+        std::cerr << "Cannot stream " << g_outLayout.format.toString() << " frames\n";
+        return -1;
+    }
+
+    const uint64_t duration = g_replay->frameDuration();
+    set_frame_rate(duration ? (duration + 500) / 1000 : 1000000 / g_options.fps);
+
+    std::cout << "Replaying " << g_replay->frames() << " frames of "
+              << g_outLayout.format.toString() << " " << g_outLayout.size.toString()
+              << " at " << 1e6 / g_frameDuration << " fps\n";
+    return 0;
+}
+
+// Runs on a thread of its own and pushes every frame wrapped straight from
+// the mapping of the recording. appsrc blocks when full, which paces
+// --replay-pace=max at the rate of the pipeline. Paced replays shift the
+// recorded timestamps to now, so that PTS and latencies look like those of
+// a live capture.
+static void replay_frames()
+{
+    const bool paced = g_options.replayPace == ReplayPace::Recorded;
+
+    do {
+        const int64_t start = monotonic_ns();
+        const uint64_t first = g_replay->entry(0).timestamp;
+
+        for (unsigned int i = 0; i < g_replay->frames() && g_running; ++i) {
+            const RecordingEntry &entry = g_replay->entry(i);
+            int64_t timestamp = monotonic_ns();
+
+            if (paced && entry.timestamp >= first) {
+                timestamp = start + static_cast<int64_t>(entry.timestamp - first);
+                struct timespec due = { static_cast<time_t>(timestamp / 1000000000),
+                                        static_cast<long>(timestamp % 1000000000) };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, nullptr);
+            }
+
+            const size_t size = entry.rightOffset ? entry.rightOffset : entry.size;
+            GstBuffer *buffer = gst_buffer_new_wrapped_full(
+                GST_MEMORY_FLAG_READONLY, const_cast<uint8_t *>(g_replay->frame(i)),
+                size, 0, size, nullptr, nullptr);
+
+            stamp_buffer(buffer, timestamp, paced ? 0 : g_frameDuration * GST_USECOND);
+            add_video_meta(buffer);
+            record_latency(Stage::Push, timestamp);
+
+            // Flushing or EOS, the pipeline is going down
+            if (gst_app_src_push_buffer(GST_APP_SRC(g_appsrc), buffer) != GST_FLOW_OK)
+                return;
+        }
+    } while (g_options.replayLoop && g_running);
+
+    gst_app_src_end_of_stream(GST_APP_SRC(g_appsrc));
+}
+// ************ Replay ************************************************
+
+// ************ Rate adaptation ************************************************
+// A receiver report, handed from the RTCP thread of rtpbin to the main loop
+struct ReceiverReport {
+    guint ssrc;
+    RateController::Report report;
+};
+
+static gboolean apply_report(gpointer data)
+{
+    std::unique_ptr<ReceiverReport> received(static_cast<ReceiverReport *>(data));
+    const RateController::Report *report = &received->report;
+
+    g_lastReport = *report;
+    g_lastReportSsrc = received->ssrc;
+    if (!g_rateController->update(received->ssrc, *report, monotonic_ns()))
+        return G_SOURCE_REMOVE;
+
+    const RateController::Target &target = g_rateController->target();
+    setEncoderBitrate(g_encoder, g_encoderBackend, target.bitrate);
+    if (g_options.adaptation == Adaptation::FrameRate)
+        g_captureDuration = clamp_frame_duration(g_frameDuration << target.tier);
+
+    std::cout << "Adapting to " << target.bitrate << " kbit/s, frame rate / "
+              << (1u << target.tier) << " (loss " << report->loss * 100
+              << "%, rtt " << report->rtt / 1000 << " ms)" << std::endl;
+    return G_SOURCE_REMOVE;
+}
+
+// rtpbin signals every RTCP packet of a remote source; those of receivers
+// carry a report block about our stream
+static void on_ssrc_active(GstElement *rtpbin, guint session_id, guint ssrc, gpointer data)
+{
+    GObject *session = nullptr;
+    g_signal_emit_by_name(rtpbin, "get-internal-session", session_id, &session);
+    if (!session)
+        return;
+
+    GObject *source = nullptr;
+    g_signal_emit_by_name(session, "get-source-by-ssrc", ssrc, &source);
+    g_object_unref(session);
+    if (!source)
+        return;
+
+    GstStructure *stats = nullptr;
+    g_object_get(source, "stats", &stats, NULL);
+    g_object_unref(source);
+    if (!stats)
+        return;
+
+    gboolean have_rb = FALSE;
+    gboolean internal = FALSE;
+    guint fraction_lost = 0, jitter = 0, round_trip = 0;
+    gst_structure_get_boolean(stats, "have-rb", &have_rb);
+    gst_structure_get_boolean(stats, "internal", &internal);
+    gst_structure_get_uint(stats, "rb-fractionlost", &fraction_lost);
+    gst_structure_get_uint(stats, "rb-jitter", &jitter);
+    gst_structure_get_uint(stats, "rb-round-trip", &round_trip);
+    gst_structure_free(stats);
+
+    if (!have_rb || internal)
+        return;
+
+    // Loss is in 1/256, jitter in 90 kHz RTP clock ticks and the round trip
+    // in 1/65536 s
+    auto received = new ReceiverReport;
+    received->ssrc = ssrc;
+    received->report.loss = fraction_lost / 256.0;
+    received->report.jitter = jitter * 1000000ULL / 90000;
+    received->report.rtt = round_trip * 1000000ULL / 65536;
+    g_idle_add(apply_report, received);
+}
+
+// Encoders without rate control only adapt their frame rate
+static void setup_rate_adaptation()
+{
+    RateController::Config config;
+    config.maxBitrate = g_options.encoder.bitrate;
+    config.minBitrate = g_options.minBitrate;
+    config.frameRate = g_options.adaptation == Adaptation::FrameRate;
+    if (!g_encoder || !setEncoderBitrate(g_encoder, g_encoderBackend, config.maxBitrate)) {
+        std::cerr << "Encoder " << encoderName(g_encoderBackend)
+                  << " has no rate control, only the frame rate adapts\n";
+        config.minBitrate = config.maxBitrate;
+    }
+    g_rateController = std::make_unique<RateController>(config);
+
+    GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(pipeline), "rtpbin");
+    g_signal_connect(rtpbin, "on-ssrc-active", G_CALLBACK(on_ssrc_active), NULL);
+    gst_object_unref(rtpbin);
+
+    g_rtcpsink = gst_bin_get_by_name(GST_BIN(pipeline), "rtcpsink");
+}
+// ************ Rate adaptation ************************************************
+
+// Open and configure the cameras, and everything that follows from their
+// stream configuration: layouts, rectification, disparity and packing
+static int setup_cameras(unsigned int numCameras)
+{
+    g_camManager = std::make_unique<CameraManager>();
+    if (g_camManager->start() != 0) {
+        std::cerr << "Failed to start CameraManager\n";
+        return -1;
+    }
+
+    auto cameras = g_camManager->cameras();
+    if (cameras.size() < numCameras) {
+        std::cerr << (cameras.empty() ? "No cameras available\n"
+                                      : "Stereo capture needs two cameras\n");
+        g_camManager->stop();
+        return -1;
+    }
+
+    // choose first camera (CSI on Pi is usually index 0), the second one is
+    // the right eye and must match the configuration of the first
+    unsigned int cookie = 0;
+    for (unsigned int i = 0; i < numCameras; ++i) {
+        auto ctx = std::make_unique<CameraContext>();
+        ctx->eye = i == 0 ? StereoPairer::Left : StereoPairer::Right;
+        const StreamConfiguration *reference =
+            i == 0 ? nullptr : &g_cameras[0]->config->at(0);
+        int ret = setup_camera(*ctx, cameras[i]->id(), reference, cookie);
+        g_cameras.push_back(std::move(ctx));
+        if (ret < 0) {
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+        cookie += g_cameras.back()->requests.size();
+    }
+
+    g_inflight = std::vector<InflightRequest>(cookie);
+    for (auto &ctx : g_cameras) {
+        for (auto &req : ctx->requests) {
+            g_inflight[req->cookie()].camera = ctx.get();
+            g_inflight[req->cookie()].request = req.get();
+        }
+    }
+
+    StreamConfiguration &streamCfg = g_cameras[0]->config->at(0);
+
+    // Crops have to fit the configured sensor mode of every camera
+    for (auto &ctx : g_cameras) {
+        const ControlInfoMap &info = ctx->camera->controls();
+        auto it = info.find(&controls::ScalerCrop);
+        if (it == info.end()) {
+            g_roiMaximum = Rectangle();
+            break;
+        }
+        const Rectangle maximum = it->second.max().get<Rectangle>();
+        g_roiMaximum = ctx == g_cameras[0] ? maximum : g_roiMaximum.boundedTo(maximum);
+    }
+    if (!g_options.roi.isNull()) {
+        ControlServer::Reply reply = set_roi(g_options.roi);
+        if (!reply.ok) {
+            std::cerr << "Invalid region of interest: " << reply.text << "\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+    }
+
+    // Everything downstream (caps, layouts, ring) follows the validated
+    // configuration, the rate is limited by the configured sensor mode
+    set_frame_rate(select_frame_duration());
+    if (g_frameDuration != 1000000 / g_options.fps)
+        std::cout << "Frame rate limited to " << 1e6 / g_frameDuration << " fps\n";
+
+    g_wakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (g_wakeupFd < 0) {
+        std::cerr << "Failed to create wakeup eventfd\n";
+        release_cameras();
+        g_camManager->stop();
+        return -1;
+    }
+
+    // Raw frames are streamed, rectified and matched as debayered
+    const bool raw = g_options.raw != RawOutput::Off;
+    if (g_options.raw == RawOutput::Gray)
+        g_streamLayout = FrameLayout::create(formats::R8, Size(streamCfg.size.width / 2,
+                                                               streamCfg.size.height / 2), 0);
+    else if (raw)
+        g_streamLayout = FrameLayout::create(formats::XRGB8888, streamCfg.size, 0);
+    else
+        g_streamLayout = FrameLayout::fromStream(streamCfg);
+    if (!g_streamLayout.isValid() || !gstFormatName(g_streamLayout.format) ||
+        (!raw && g_streamLayout.planes.size() != g_cameras[0]->allocator->buffers(streamCfg.stream())[0]->planes().size())) {
+        std::cerr << "Cannot stream " << streamCfg.pixelFormat.toString() << " frames\n";
+        release_cameras();
+        g_camManager->stop();
+        return -1;
+    }
+    g_outLayout = g_streamLayout;
+
+    // Every camera debayers into a frame of its own, read like a mapping
+    for (unsigned int i = 0; raw && i < g_cameras.size(); ++i) {
+        uint8_t *data = g_arena->allocate(g_streamLayout.frameSize);
+        if (!data) {
+            std::cerr << "Failed to allocate debayered frames\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+        g_cameras[i]->debayered = Image::fromPlanes({ Span<uint8_t>(data, g_streamLayout.frameSize) });
+        g_cameras[i]->debayered->setLayout(g_streamLayout);
+    }
+
+    if (g_cameras[0]->preview) {
+        g_previewLayout = FrameLayout::fromStream(g_cameras[0]->config->at(1));
+        if (!g_previewLayout.isValid() || !gstFormatName(g_previewLayout.format)) {
+            std::cerr << "Cannot stream " << g_previewLayout.format.toString()
+                      << " preview frames\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+    }
+
+    if (g_options.cpuConvert) {
+        if (streamCfg.pixelFormat != formats::XRGB8888) {
+            std::cerr << "--cpu-convert needs XRGB8888 frames, got "
+                      << streamCfg.pixelFormat.toString() << "\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+
+        g_outLayout = FrameLayout::create(formats::YUV420, streamCfg.size, 0);
+    }
+
+    if (!g_options.calibration.empty()) {
+        StereoCalibration calibration;
+        if (StereoCalibration::load(g_options.calibration, &calibration) < 0) {
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+
+        g_rectifier = std::make_unique<Rectifier>(calibration, g_streamLayout);
+        if (!g_rectifier->isValid()) {
+            std::cerr << "Cannot rectify " << g_streamLayout.format.toString() << " frames\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+
+        std::cout << "Rectification tables: " << g_rectifier->tableSize() / 1024
+                  << " KiB, baseline " << g_rectifier->rectification().baseline << "\n";
+    }
+
+    if (g_options.depth) {
+        // Matching runs on the luma plane, or on gray converted from RGB
+        const PixelFormat &format = g_streamLayout.format;
+        if (format != formats::YUV420 && format != formats::YVU420 &&
+            format != formats::NV12 && format != formats::NV21 &&
+            format != formats::XRGB8888 && format != formats::R8) {
+            std::cerr << "Cannot compute disparity from " << format.toString() << " frames\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+
+        if (g_options.depthStream.port) {
+            g_depthEncoder = std::make_unique<DepthEncoder>(g_options.depthEncoding,
+                                                            g_streamLayout.size);
+            if (!g_depthEncoder->isValid()) {
+                std::cerr << "Cannot scale " << g_streamLayout.size.toString()
+                          << " disparity maps down " << g_options.depthEncoding.scale << " times\n";
+                release_cameras();
+                g_camManager->stop();
+                return -1;
+            }
+        }
+
+        g_depth = std::make_unique<DepthWorker>(g_options.disparity, g_streamLayout.size,
+                                                g_options.threads,
+                                                g_depthEncoder ? push_depth : DepthWorker::Handler(),
+                                                g_arena.get());
+        if (!g_depth->isValid()) {
+            std::cerr << "Invalid disparity configuration for " << g_streamLayout.size.toString() << "\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+        place_thread(g_depth->thread().native_handle(), ThreadRole::Depth);
+        place_threads(g_depth->pool().workers(), ThreadRole::Depth);
+    }
+
+    if (g_options.cpuConvert || g_rectifier || raw) {
+        g_workers = std::make_unique<ThreadPool>(g_options.threads);
+        place_threads(g_workers->workers(), ThreadRole::Workers);
+    }
+
+    // Gated on the frames as captured (or debayered), before any processing
+    if (g_options.changeThreshold) {
+        g_changeDetector = std::make_unique<ChangeDetector>(g_streamLayout,
+                                                            g_options.changeThreshold);
+        if (!g_changeDetector->isValid()) {
+            std::cerr << "Cannot detect changes in " << g_streamLayout.format.toString()
+                      << " " << g_streamLayout.size.toString() << " frames\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+    }
+
+    if (g_options.stereo && g_options.stereoOutput != StereoOutput::Left) {
+        StereoPacker::Layout layout = g_options.stereoOutput == StereoOutput::SideBySide
+                                    ? StereoPacker::Layout::SideBySide
+                                    : StereoPacker::Layout::TopBottom;
+        g_packer = std::make_unique<StereoPacker>(layout, g_streamLayout);
+        if (!g_packer->isValid()) {
+            std::cerr << "Cannot pack " << g_streamLayout.format.toString() << " frames\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+
+        // Wrapped dmabufs are only a valid packed frame if the camera
+        // already uses the strides GStreamer expects
+        const FrameLayout &eye = g_packer->eye();
+        const FrameLayout native = FrameLayout::create(eye.format, eye.size, 0);
+        for (unsigned int i = 0; g_options.zeroCopy && i < eye.planes.size(); ++i) {
+            if (eye.planes[i].stride == native.planes[i].stride)
+                continue;
+
+            std::cerr << "Stride " << eye.planes[i].stride
+                      << " does not allow zero-copy top-bottom packing\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+
+        g_outLayout = g_packer->packed();
+    }
+
+    return 0;
+}
+
+// Start capturing from every camera with all requests queued
+static int start_cameras()
+{
+    // Unmatched requests go straight back to their camera
+    if (g_options.stereo)
+        g_pairer = std::make_unique<StereoPairer>(
+            g_cameras[0]->requests.size(), g_options.pairTolerance,
+            deliver, requeue_request);
+
+    // Start cameras & queue requests
+    for (auto &ctx : g_cameras) {
+        // Connect callback
+        ctx->camera->requestCompleted.connect(requestComplete);
+
+        ctx->frameDuration = g_frameDuration;
+        ctx->roiGeneration = g_roiGeneration.load();
+
+        ControlList controls;
+        controls.set(controls::FrameDurationLimits,
+                     Span<const int64_t, 2>({ g_frameDuration, g_frameDuration }));
+        if (!g_roi.isNull())
+            controls.set(controls::ScalerCrop, g_roi);
+
+        if (ctx->camera->start(&controls) != 0) {
+            std::cerr << "Failed to start camera\n";
+            release_cameras();
+            g_camManager->stop();
+            return -1;
+        }
+        ctx->started = true;
+    }
+
+    // Tuning starts from the whole pool and only ever drops requests that
+    // downstream has proven not to need
+    if (g_options.tuneBuffers) {
+        unsigned int allocated = UINT_MAX;
+        for (auto &ctx : g_cameras)
+            allocated = std::min<unsigned int>(allocated, ctx->requests.size());
+        g_bufferTuner = std::make_unique<BufferTuner>(allocated);
+        g_bufferTarget = allocated;
+    }
+
+    for (auto &ctx : g_cameras) {
+        ctx->circulating = ctx->requests.size();
+        for (auto &r : ctx->requests)
+            queue_request(ctx.get(), r.get());
+    }
+
+    return 0;
+}
+
+// ************ Buffer tuning ************************************************
+static void unpark_requests(CameraContext &ctx)
+{
+    const unsigned int target = g_bufferTarget.load(std::memory_order_relaxed);
+    std::vector<Request *> requests;
+
+    {
+        std::lock_guard<std::mutex> lock(ctx.parkedLock);
+        while (!ctx.parked.empty() && ctx.circulating < target) {
+            requests.push_back(ctx.parked.back());
+            ctx.parked.pop_back();
+            ctx.circulating++;
+        }
+    }
+
+    for (Request *request : requests)
+        queue_request(&ctx, request);
+}
+
+// Once a second, resize the circulating pool for the hold times measured
+static gboolean tune_buffers(gpointer data)
+{
+    const LatencyHistogram::Summary hold = g_holdTime.take();
+    const bool starved = g_starved.exchange(0, std::memory_order_relaxed) > 0;
+    if (!hold.count && !starved)
+        return TRUE;
+
+    const int64_t duration = g_captureDuration ? g_captureDuration.load() : g_frameDuration;
+    const unsigned int previous = g_bufferTuner->target();
+    const unsigned int target = g_bufferTuner->update(hold.p99, duration, starved);
+    g_holdP99 = hold.p99;
+    if (target == previous)
+        return TRUE;
+
+    std::cout << "Buffer pool " << previous << " -> " << target << " requests (hold p99 "
+              << hold.p99 / 1000.0 << " ms" << (starved ? ", starved" : "") << ")" << std::endl;
+    g_bufferTarget = target;
+    for (auto &ctx : g_cameras)
+        unpark_requests(*ctx);
+
+    return TRUE;
+}
+// ************ Buffer tuning ************************************************
+
+// ************ Startup ************************************************
+// Elements of the pipelines besides the encoder, which probeEncoder() loads
+static const char *const g_pipelineElements[] = {
+    "appsrc", "videoconvert", "rtph264pay", "multiudpsink", "udpsink",
+    "udpsrc", "rtpbin", "rtpgstpay",
+};
+
+// Run next to camera setup: the registry, the encoder probe (which opens
+// V4L2 devices) and the plugins are most of the time to the first packet
+static void init_gstreamer(int *argc, char ***argv)
+{
+    gst_init(argc, argv);
+
+    g_encoderBackend = probeEncoder(g_options.encoder.backend);
+
+    for (const char *name : g_pipelineElements) {
+        GstElementFactory *factory = gst_element_factory_find(name);
+        if (!factory)
+            continue;
+
+        GstPluginFeature *loaded = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+        if (loaded)
+            gst_object_unref(loaded);
+        gst_object_unref(factory);
+    }
+
+    g_gstReady = monotonic_ns();
+}
+// ************ Startup ************************************************
+
+// SIGINT handler to stop gracefully: leave the main loop, the cleanup after
+// it stops the pipeline and the cameras and flushes the recording. Runs on
+// the main loop, as a GLib signal source.
+static gboolean sigint_handler(gpointer data)
+{
+    g_running = false;
+    g_main_loop_quit(static_cast<GMainLoop *>(data));
+    return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char *argv[])
+{
+    g_startup.start = monotonic_ns();
+
+    // ***************** Arguments ********************************************
+    if (parseOptions(argc, argv, &g_options) < 0) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *dest_ip = g_options.destIp.c_str();
+    int dest_port = g_options.destPort;
+    // ***************** Arguments ********************************************
+
+
+    // GStreamer and its plugins load while the cameras are set up, the
+    // pipeline is built once both are done and the cameras start last
+    std::thread gst_thread(init_gstreamer, &argc, &argv);
+
+    // ***************** Camera ***********************************************
+    g_arena = std::make_unique<FrameArena>(g_options.hugePages);
+
+    const unsigned int numCameras = g_options.stereo ? 2 : 1;
+    if (g_options.replayPath.empty() ? setup_cameras(numCameras) < 0 : setup_replay() < 0) {
+        gst_thread.join();
+        return EXIT_FAILURE;
+    }
+
+    // Output frame geometry of the network stream
+    const unsigned int out_width = g_outLayout.size.width;
+    const unsigned int out_height = g_outLayout.size.height;
+    const size_t out_size = g_outLayout.frameSize;
+    const char *out_format = gstFormatName(g_outLayout.format);
+
+    // Slots are sized once for the largest frame (or pair) the streams can
+    // produce
+    const size_t slot_size = g_packer && !g_options.zeroCopy
+                           ? out_size : g_streamLayout.frameSize * numCameras;
+    if (!g_options.zeroCopy && !g_replay)
+        g_ring = std::make_unique<FrameRing>(g_options.ringSlots, slot_size,
+                                             g_options.dropPolicy, g_arena.get());
+
+    // Recordings hold what goes into the ring, or both camera frames as
+    // they are with zero-copy
+    if (!g_options.recordPath.empty()) {
+        const bool separate_eyes = g_options.stereo && (g_options.zeroCopy || !g_packer);
+        g_fileSink = std::make_unique<FileSink>(g_options.recordSlots, slot_size,
+                                                g_arena.get());
+        if (g_fileSink->open(g_options.recordPath,
+                             g_options.zeroCopy ? g_streamLayout : g_outLayout,
+                             separate_eyes ? &g_streamLayout : nullptr) < 0) {
+            gst_thread.join();
+            teardown();
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Local consumers get what the network stream and the recorder get
+    if (!g_options.shmPath.empty()) {
+        const bool separate_eyes = g_options.stereo && !g_packer;
+        g_shmOutput = std::make_unique<ShmOutput>(g_options.shmSlots, slot_size,
+                                                  g_options.shmFrames);
+        int ret = g_shmOutput->start(g_options.shmPath, g_outLayout,
+                                     separate_eyes ? &g_streamLayout : nullptr);
+        if (ret < 0) {
+            std::cerr << "Cannot share frames on " << g_options.shmPath
+                      << ": " << strerror(-ret) << "\n";
+            gst_thread.join();
+            teardown();
+            return EXIT_FAILURE;
+        }
+    }
+    g_startup.cameras = monotonic_ns();
+    // ***************** Camera ***********************************************
+
+    // ***************** GStreamer ********************************************
+    gst_thread.join();
+    g_startup.gstreamer = g_gstReady;
+
+    g_dmabufAllocator = gst_dmabuf_allocator_new();
+    g_releaseQuark = g_quark_from_static_string("udp-cam-release");
+
+    // In zero-copy mode appsrc is fed from the camera thread, which must
+    // never block; the request pool bounds the queue instead. Event mode
+    // relies on need-data/enough-data rather than blocking the main loop.
+    // The replay thread is paced by blocking.
+    const bool blocking = g_replay ||
+                          (!g_options.zeroCopy && g_options.pushMode == PushMode::Timer);
+
+    const EncoderBackend encoder = g_encoderBackend;
+    std::cout << "Using encoder " << encoderName(encoder) << std::endl;
+
+    // Formats the encoder takes natively skip the CPU colour conversion, and
+    // dmabufs then reach the encoder untouched
+    const bool convert = !encoderAccepts(encoder, out_format);
+    const std::string encoder_desc = encoderPipeline(encoder, g_options.encoder,
+                                                     g_options.zeroCopy && !convert);
+
+    const std::string ttl = g_options.multicastTtl
+                          ? " ttl-mc=" + std::to_string(g_options.multicastTtl) : "";
+
+    // Adaptation puts an rtpbin between payloader and sink for the RTCP
+    // session, sender reports out and receiver reports in
+    const bool adaptive = g_options.adaptation != Adaptation::Off;
+    std::string rtcp_desc;
+    if (adaptive)
+        rtcp_desc = " rtpbin.send_rtcp_src_0 ! multiudpsink name=rtcpsink sync=false async=false"
+                    " auto-multicast=false" + ttl +
+                    " udpsrc name=rtcpsrc port=" + std::to_string(g_options.rtcpPort) +
+                    " ! rtpbin.recv_rtcp_sink_0";
+
+    // The preview is a branch of its own from a second appsrc, at the
+    // camera's frame rate and with its own encoder instance
+    std::string preview_desc;
+    if (g_previewLayout.isValid()) {
+        const char *preview_format = gstFormatName(g_previewLayout.format);
+        EncoderConfig preview_config = g_options.encoder;
+        preview_config.bitrate = g_options.previewBitrate;
+        preview_desc = " appsrc name=previewsrc is-live=true block=false format=TIME"
+                       " caps=video/x-raw,format=" + std::string(preview_format) +
+                       ",width=" + std::to_string(g_previewLayout.size.width) +
+                       ",height=" + std::to_string(g_previewLayout.size.height) +
+                       ",framerate=" + std::to_string(g_framerateNum) + "/" +
+                       std::to_string(g_framerateDen) + " ! " +
+                       (encoderAccepts(encoder, preview_format)
+                        ? "" : "videoconvert ! video/x-raw,format=I420 ! ") +
+                       encoderPipeline(encoder, preview_config, false, "previewenc") +
+                       " ! rtph264pay config-interval=1 pt=96"
+                       " ! udpsink host=" + g_options.preview.host +
+                       " port=" + std::to_string(g_options.preview.port);
+    }
+
+    // Disparity maps go out as they are encoded, in generic GStreamer RTP
+    // payloads whose caps receivers get again every second
+    std::string depth_desc;
+    if (g_depthEncoder) {
+        const Size &size = g_depthEncoder->size();
+        depth_desc = " appsrc name=depthsrc is-live=true block=false format=TIME"
+                     " caps=application/x-disparity,codec=" +
+                     std::string(g_options.depthEncoding.codec == DepthEncoder::Codec::Raw
+                                 ? "raw" : "delta") +
+                     ",width=" + std::to_string(size.width) +
+                     ",height=" + std::to_string(size.height) +
+                     " ! rtpgstpay name=depthpay config-interval=1 pt=97"
+                     " ! udpsink host=" + g_options.depthStream.host +
+                     " port=" + std::to_string(g_options.depthStream.port);
+    }
+
+    char pipeline_desc[8192];
+    std::snprintf(pipeline_desc, sizeof(pipeline_desc),
+        "%s"
+        "appsrc name=mysrc is-live=true block=%s format=TIME "
+        "caps=video/x-raw,format=%s,width=%u,height=%u,framerate=%u/%u "
+        "! %s"
+        "%s "
+        "! rtph264pay name=pay config-interval=1 pt=96 "
+        "%s"
+        "! multiudpsink name=netsink auto-multicast=false%s%s%s%s",
+        adaptive ? "rtpbin name=rtpbin " : "",
+        blocking ? "true" : "false", out_format, out_width, out_height,
+        g_framerateNum, g_framerateDen,
+        convert ? "videoconvert ! video/x-raw,format=I420 ! " : "", encoder_desc.c_str(),
+        adaptive ? "! rtpbin.send_rtp_sink_0 rtpbin.send_rtp_src_0 " : "",
+        ttl.c_str(), rtcp_desc.c_str(), preview_desc.c_str(), depth_desc.c_str());
+    
+    std::cout << "GStreamer pipeline: " << pipeline_desc << std::endl;
+
+    GError *err = nullptr;
+    pipeline = gst_parse_launch(pipeline_desc, &err);
+    if (!pipeline) {
+        std::cerr << "Failed to create pipeline: " << (err ? err->message : "(unknown)") << "\n";
+        if (err) g_error_free(err);
+        teardown();
+        return EXIT_FAILURE;
+    }
+
+    // Get appsrc element
+    g_appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "mysrc");
+    if (!g_appsrc) {
+        std::cerr << "Failed to get appsrc element from pipeline\n";
+        teardown();
+        return EXIT_FAILURE;
+    }
+
+    // Rate adaptation sets its bitrate, the change gate forces keyframes
+    g_encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+
+    // Keep at most one frame queued in appsrc, anything beyond that is
+    // handled by the ring or the request pool
+    g_object_set(g_appsrc, "max-bytes", (guint64)out_size, NULL);
+    // Buffers carry their capture time, so they reach appsrc up to a frame
+    // late; report that as the source latency for synchronising sinks
+    g_object_set(g_appsrc, "min-latency",
+                 (gint64)(g_frameDuration * GST_USECOND), NULL);
+    g_signal_connect(g_appsrc, "need-data", G_CALLBACK(on_need_data), NULL);
+    g_signal_connect(g_appsrc, "enough-data", G_CALLBACK(on_enough_data), NULL);
+
+    // Enough buffers for the appsrc queue and what the converter and the
+    // encoder hold, the pool grows if the pipeline holds more
+    if (g_ring) {
+        g_pushPool = arenaBufferPoolNew(g_arena.get(), out_size, 4, 0);
+        if (!g_pushPool)
+            std::cerr << "Failed to allocate stream buffers, copying into heap buffers\n";
+    }
+    const FrameArena::Stats arena = g_arena->stats();
+    if (g_options.hugePages && arena.mapped && !arena.hugePages)
+        std::cerr << "Not enough huge pages reserved (vm.nr_hugepages), "
+                  << "frame buffers use normal pages\n";
+
+    if (!preview_desc.empty()) {
+        g_previewPool = arenaBufferPoolNew(g_arena.get(), g_previewLayout.frameSize, 3, 3);
+        if (!g_previewPool) {
+            std::cerr << "Failed to allocate preview buffers\n";
+            teardown();
+            return EXIT_FAILURE;
+        }
+        g_previewsrc = gst_bin_get_by_name(GST_BIN(pipeline), "previewsrc");
+    }
+
+    // PTS follows the sensor timestamp in both streams, with the same RTP
+    // timestamp offset a video frame and its map carry the same RTP timestamp
+    if (!depth_desc.empty()) {
+        g_depthPool = arenaBufferPoolNew(g_arena.get(), g_depthEncoder->maxEncodedSize(), 2, 2);
+        if (!g_depthPool) {
+            std::cerr << "Failed to allocate depth stream buffers\n";
+            teardown();
+            return EXIT_FAILURE;
+        }
+
+        GstElement *pay = gst_bin_get_by_name(GST_BIN(pipeline), "pay");
+        GstElement *depthpay = gst_bin_get_by_name(GST_BIN(pipeline), "depthpay");
+        const guint offset = g_random_int();
+        g_object_set(pay, "timestamp-offset", offset, NULL);
+        g_object_set(depthpay, "timestamp-offset", offset, NULL);
+        gst_object_unref(pay);
+        gst_object_unref(depthpay);
+
+        g_depthsrc = gst_bin_get_by_name(GST_BIN(pipeline), "depthsrc");
+    }
+
+    // Every packet of the single encoded stream goes to all destinations
+    g_netsink = gst_bin_get_by_name(GST_BIN(pipeline), "netsink");
+    if (adaptive)
+        setup_rate_adaptation();
+
+    Destination primary;
+    primary.host = dest_ip;
+    primary.port = dest_port;
+    std::vector<Destination> targets = g_options.destinations;
+    targets.insert(targets.begin(), primary);
+    for (const Destination &dest : targets) {
+        g_signal_emit_by_name(g_netsink, "add", dest.host.c_str(), static_cast<gint>(dest.port));
+        if (g_rtcpsink)
+            g_signal_emit_by_name(g_rtcpsink, "add", dest.host.c_str(),
+                                  static_cast<gint>(dest.port + 1));
+    }
+
+    add_stage_probe("encoder", "src", Stage::Encoded);
+    place_encoder_thread(pipeline, "encoder");
+    place_encoder_thread(pipeline, "previewenc");
+    add_stage_probe("netsink", "sink", Stage::Sent);
+
+    if (!g_options.controlPath.empty()) {
+        g_controlServer = std::make_unique<ControlServer>();
+        int ret = g_controlServer->start(g_options.controlPath);
+        if (ret < 0) {
+            std::cerr << "Cannot listen on " << g_options.controlPath
+                      << ": " << strerror(-ret) << "\n";
+            g_controlServer.reset();
+        } else {
+            add_control_commands();
+        }
+    }
+
+    if (g_options.statsPort) {
+        g_statsServer = std::make_unique<StatsServer>();
+        int ret = g_statsServer->start(g_options.statsPort);
+        if (ret < 0) {
+            std::cerr << "Cannot serve statistics on port " << g_options.statsPort
+                      << ": " << strerror(-ret) << "\n";
+            g_statsServer.reset();
+        }
+    }
+
+    // Start pipeline playing, and the cameras once it is: the encoder is
+    // open and the clock running by the time the first frame completes
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    if (gst_element_get_state(pipeline, nullptr, nullptr, 5 * GST_SECOND) == GST_STATE_CHANGE_FAILURE) {
+        std::cerr << "Failed to start the pipeline\n";
+        teardown();
+        return EXIT_FAILURE;
+    }
+    g_startup.pipeline = monotonic_ns();
+
+    if (!g_replay && start_cameras() < 0) {
+        teardown();
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Startup: cameras " << (g_startup.cameras - g_startup.start) / 1000000
+              << " ms, GStreamer " << (g_startup.gstreamer - g_startup.start) / 1000000
+              << " ms in parallel, pipeline playing at "
+              << (g_startup.pipeline - g_startup.start) / 1000000 << " ms" << std::endl;
+    std::cout << "Streaming to " << dest_ip << ":" << dest_port;
+    for (const Destination &dest : g_options.destinations)
+        std::cout << ", " << dest.host << ":" << dest.port;
+    std::cout << " — press Ctrl+C to stop\n";
+
+    // Push one frame per frame duration (zero-copy pushes on completion)
+    if (g_replay) {
+        g_replayThread = std::thread(replay_frames);
+        place_thread(g_replayThread.native_handle(), ThreadRole::Push);
+    }
+    if (g_ring) {
+        if (g_options.pushMode == PushMode::Timer)
+            g_timeout_add(g_frameDuration / 1000, push_frame, NULL);
+        else
+            g_unix_fd_add(g_wakeupFd, G_IO_IN, on_frame_ready, NULL);
+    }
+    g_statsTime = monotonic_ns();
+    g_timeout_add_seconds(5, print_stats, NULL);
+    if (g_bufferTuner)
+        g_timeout_add_seconds(1, tune_buffers, NULL);
+    
+    // Main loop
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    GstBus *bus = gst_element_get_bus(pipeline);
+    gst_bus_add_watch(bus, on_bus_message, loop);
+    gst_object_unref(bus);
+    g_unix_signal_add(SIGINT, sigint_handler, loop);
+    g_unix_signal_add(SIGTERM, sigint_handler, loop);
+
+    // Last, so that no thread started from here inherits the placement
+    for (unsigned int i = 0; i < static_cast<unsigned int>(ThreadRole::Count); ++i) {
+        const ThreadPlacement &placement = g_options.placement[i];
+        if (!placement.isDefault())
+            std::cout << "Threads " << threadRoleName(static_cast<ThreadRole>(i))
+                      << ": CPUs " << (placement.cpus ? cpuList(placement.cpus) : "any")
+                      << ", " << (placement.priority ? "SCHED_FIFO " + std::to_string(placement.priority)
+                                                     : std::string("default policy")) << std::endl;
+    }
+    place_thread(pthread_self(), ThreadRole::Push);
+    g_main_loop_run(loop);
+    // ***************** GStreamer ********************************************
+
+    // Clean up
+    std::cout << "Stopping...\n";
+    g_running = false;
 
-    // End-of-stream for appsrc and stop pipeline
     gst_app_src_end_of_stream(GST_APP_SRC(g_appsrc));
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_object_unref(g_appsrc);
-    gst_object_unref(pipeline);
+    teardown();
 
     return 0;
 }